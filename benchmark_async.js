@@ -0,0 +1,99 @@
+// Compares issuing lots of independent opens/hashes in one tick four ways:
+//  synchronously, through the *_async calls with batching turned off (one
+//  threadpool job per call), through them batched, and (for hashing) as one
+//  hand-built hash512_256_batch call.
+//
+// Usage: node benchmark_async.js [calls per tick]
+
+var nacl = require('nacl');
+var microtime = require('microtime');
+
+var PER_TICK = parseInt(process.argv[2] || '256', 10);
+/** How many ticks' worth of calls to time for each approach. */
+var ROUNDS = 50;
+
+var messages = [];
+for (var i = 0; i < PER_TICK; i++)
+  messages.push('message number ' + i + ' of ' + PER_TICK);
+
+var alice = nacl.box_keypair(), bob = nacl.box_keypair();
+var nonce = nacl.box_random_nonce();
+var boxed = messages.map(function(m) {
+  return nacl.box(m, nonce, bob.pk, alice.sk);
+});
+var signer = nacl.sign_keypair();
+var signed = messages.map(function(m) { return nacl.sign(m, signer.sk); });
+
+function report(what, started) {
+  var elapsed = microtime.now() - started;
+  console.log(what + ':', ((elapsed * 1000) / (ROUNDS * PER_TICK)).toFixed(0),
+              'nS/op');
+}
+
+function timeSync(what, op) {
+  var started = microtime.now();
+  for (var r = 0; r < ROUNDS; r++) {
+    for (var i = 0; i < PER_TICK; i++)
+      op(i);
+  }
+  report(what, started);
+}
+
+/** Runs ROUNDS ticks of PER_TICK async calls back to back, then `next`. */
+function timeAsync(what, op, next) {
+  var started = microtime.now(), round = 0;
+  function go() {
+    var left = PER_TICK;
+    function done(err) {
+      if (err)
+        throw err;
+      if (--left)
+        return;
+      if (++round < ROUNDS)
+        return go();
+      report(what, started);
+      next();
+    }
+    for (var i = 0; i < PER_TICK; i++)
+      op(i, done);
+  }
+  go();
+}
+
+timeSync('hash512_256', function(i) { nacl.hash512_256(messages[i]); });
+var started = microtime.now();
+for (var r = 0; r < ROUNDS; r++)
+  nacl.hash512_256_batch(messages);
+report('hash512_256_batch', started);
+timeSync('box_open', function(i) {
+  nacl.box_open(boxed[i], nonce, alice.pk, bob.sk);
+});
+timeSync('sign_open', function(i) { nacl.sign_open(signed[i], signer.pk); });
+
+/**
+ * Time all the async calls under the given scheduler options, then `next`.
+ *  {maxBatch: 1} makes every call its own threadpool job: plain per-call
+ *  dispatch, which is what batching has to beat.
+ */
+function timeAllAsync(label, options, next) {
+  nacl.batch_configure(options);
+  timeAsync('hash512_256_async ' + label, function(i, done) {
+    nacl.hash512_256_async(messages[i], done);
+  }, function() {
+    timeAsync('box_open_async ' + label, function(i, done) {
+      nacl.box_open_async(boxed[i], nonce, alice.pk, bob.sk, done);
+    }, function() {
+      timeAsync('sign_open_async ' + label, function(i, done) {
+        nacl.sign_open_async(signed[i], signer.pk, done);
+      }, function() {
+        console.log(nacl.batch_stats());
+        next();
+      });
+    });
+  });
+}
+
+var defaults = nacl.batch_stats();
+timeAllAsync('(per call)', {maxBatch: 1}, function() {
+  timeAllAsync('(batched)', {maxBatch: defaults.maxBatch}, function() {});
+});
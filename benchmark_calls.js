@@ -0,0 +1,90 @@
+// Measures the per-call overhead of the bindings: tiny payloads, so the time
+//  is mostly argument coercion and result encoding rather than crypto.  Every
+//  operation runs once with binary string arguments and once with Buffers.
+//
+// Usage: node benchmark_calls.js [path/to/nacl.node ...]
+//
+// To compare a binding-layer change, build the tree before and after it and
+//  pass both addons; each operation is then measured against each of them in
+//  turn, in the order given.  With no arguments we just use require('nacl').
+
+var microtime = require('microtime');
+
+var builds = process.argv.slice(2);
+if (!builds.length)
+  builds = ['nacl'];
+var impls = builds.map(function(path) { return require(path); });
+var nacl = impls[0];
+
+/** How long to keep calling each operation for, in uS. */
+const RUN_FOR = 500000;
+
+/** Returns the average nS per call of `op` over RUN_FOR uS. */
+function measure(op) {
+  var count = 0, started = microtime.now(), elapsed;
+  do {
+    op(); op(); op(); op();
+    count += 4;
+    elapsed = microtime.now() - started;
+  } while (elapsed < RUN_FOR);
+  return (elapsed * 1000) / count;
+}
+
+function asBuffer(s) {
+  return new Buffer(s, 'binary');
+}
+
+function label(what, i) {
+  return impls.length > 1 ? what + ' [' + builds[i] + ']:' : what + ':';
+}
+
+function compare(what, makeOp) {
+  impls.forEach(function(impl, i) {
+    var str = measure(makeOp(impl, function(s) { return s; })),
+        buf = measure(makeOp(impl, asBuffer));
+    console.log(label(what, i), 'strings', str.toFixed(0), 'nS/call',
+                'buffers', buf.toFixed(0), 'nS/call');
+  });
+}
+
+var message = 'sixteen byte msg';
+var skey = nacl.secretbox_random_key(),
+    snonce = nacl.secretbox_random_nonce(),
+    sboxed = nacl.secretbox(message, snonce, skey);
+var akey = nacl.auth_random_key(),
+    authed = nacl.auth(message, akey);
+var signer = nacl.sign_keypair(),
+    signed = nacl.sign(message, signer.sk);
+
+compare('hash512_256', function(impl, arg) {
+  var m = arg(message);
+  return function() { impl.hash512_256(m); };
+});
+compare('secretbox', function(impl, arg) {
+  var m = arg(message), n = arg(snonce), k = arg(skey);
+  return function() { impl.secretbox(m, n, k); };
+});
+compare('secretbox_open', function(impl, arg) {
+  var c = arg(sboxed), n = arg(snonce), k = arg(skey);
+  return function() { impl.secretbox_open(c, n, k); };
+});
+compare('auth', function(impl, arg) {
+  var m = arg(message), k = arg(akey);
+  return function() { impl.auth(m, k); };
+});
+compare('auth_verify', function(impl, arg) {
+  var a = arg(authed), m = arg(message), k = arg(akey);
+  return function() { impl.auth_verify(a, m, k); };
+});
+compare('sign_peek', function(impl, arg) {
+  var sm = arg(signed);
+  return function() { impl.sign_peek(sm); };
+});
+
+// utf8 messages only come in as strings
+impls.forEach(function(impl, i) {
+  console.log(label('secretbox_utf8', i),
+              measure(function() {
+                impl.secretbox_utf8(message, snonce, skey);
+              }).toFixed(0), 'nS/call');
+});
@@ -0,0 +1,103 @@
+// Compares the native addon with the WebAssembly fallback (emnacled.js; build
+//  it with tools/build_emnacl.sh first), reporting each one's throughput on
+//  the same payloads, passed as Buffers.
+//
+// Usage: node benchmark_wasm.js
+
+var nacl = require('nacl');
+var emnacl = require('./emnacled');
+var microtime = require('microtime');
+
+console.log('wasm flavour:', emnacl.FLAVOUR);
+
+/** How long to keep calling each operation for, in uS. */
+const RUN_FOR = 500000;
+
+const PAYLOAD_SIZES = [64, 1024, 16384, 262144];
+
+/**
+ * Call `op` repeatedly for RUN_FOR uS, returning the MB/s it managed for a
+ *  payload of `payloadLen` bytes, or the ops/s if `payloadLen` is 0.
+ */
+function measure(op, payloadLen) {
+  var count = 0, started = microtime.now(), elapsed;
+  do {
+    op();
+    count++;
+    elapsed = microtime.now() - started;
+  } while (elapsed < RUN_FOR);
+  if (!payloadLen)
+    return count / (elapsed / 1e6);
+  return (count * payloadLen) / elapsed; // bytes per uS == MB/s
+}
+
+function compare(what, payloadLen, makeOp) {
+  var native = measure(makeOp(nacl), payloadLen),
+      wasm = measure(makeOp(emnacl), payloadLen);
+  console.log(what, payloadLen ? payloadLen + ' bytes:' : '',
+              'native', native.toFixed(2), 'wasm', wasm.toFixed(2),
+              payloadLen ? 'MB/s' : 'ops/s',
+              '(wasm is ' + (wasm / native).toFixed(3) + 'x)');
+}
+
+function payloadOf(size) {
+  var buf = new Buffer(size);
+  for (var i = 0; i < size; i++)
+    buf[i] = i & 0xff;
+  return buf;
+}
+
+console.log("=== Keys ===");
+compare('sign_keypair', 0, function(impl) {
+  return function() { impl.sign_keypair(); };
+});
+compare('box_keypair', 0, function(impl) {
+  return function() { impl.box_keypair(); };
+});
+console.log();
+
+PAYLOAD_SIZES.forEach(function(size) {
+  var payload = payloadOf(size);
+  var signKeys = nacl.sign_keypair();
+  var alice = nacl.box_keypair(), bob = nacl.box_keypair();
+  var nonce = nacl.box_random_nonce(), key = nacl.secretbox_random_key();
+  var authKey = nacl.auth_random_key();
+
+  console.log("=== " + size + " byte payloads ===");
+  compare('sign', size, function(impl) {
+    return function() { impl.sign(payload, signKeys.sk); };
+  });
+  var signed = nacl.sign(payload, signKeys.sk);
+  compare('sign_open', size, function(impl) {
+    return function() { impl.sign_open(signed, signKeys.pk); };
+  });
+  compare('box', size, function(impl) {
+    return function() { impl.box(payload, nonce, bob.pk, alice.sk); };
+  });
+  var boxed = nacl.box(payload, nonce, bob.pk, alice.sk);
+  compare('box_open', size, function(impl) {
+    return function() { impl.box_open(boxed, nonce, alice.pk, bob.sk); };
+  });
+  compare('secretbox', size, function(impl) {
+    return function() { impl.secretbox(payload, nonce, key); };
+  });
+  var sboxed = nacl.secretbox(payload, nonce, key);
+  compare('secretbox_open', size, function(impl) {
+    return function() { impl.secretbox_open(sboxed, nonce, key); };
+  });
+  compare('stream_xsalsa20_xor', size, function(impl) {
+    return function() {
+      impl.stream_xsalsa20_xor(payload, 0, size, nonce, key);
+    };
+  });
+  compare('onetimeauth', size, function(impl) {
+    return function() { impl.onetimeauth(payload, 0, size, key); };
+  });
+  compare('auth', size, function(impl) {
+    return function() { impl.auth(payload, authKey); };
+  });
+  compare('hash512_256', size, function(impl) {
+    return function() { impl.hash512_256(payload); };
+  });
+  console.log();
+});
@@ -1,160 +1,181 @@
+// Glue for the WebAssembly build of nacl; tools/build_emnacl.sh appends this
+//  to emscripten's output (--post-js) and the top-level emnacled.js loads the
+//  result.  It wraps the emnacl_* entry points from src/emnacl_exports.cc in
+//  the same API (names, argument checks, error types and messages) that the
+//  native addon in src/nacl_node.cc exports.
+//
+// Data moves between JS and the wasm heap in bulk through a Buffer view of the
+//  heap, never a byte at a time, and every call carves its scratch space out
+//  of one reusable arena rather than allocating.
+//
+// Not provided: the keypair pools and workload capture, which only make sense
+//  for the native addon.  hash512_256_batch is a plain loop here.
+
+var $buf = require('buffer'), $crypto = require('crypto');
+
+// emscripten's node shell may have pointed module.exports at its Module
+//  object by the time we run; hang the API off whichever one is live.
+exports = module.exports;
 
-// XXX For node only: clobber the random bytes
-var $crypto = require('crypto');
-_randombytes = function(ptr, len) {
-  var buf = $crypto.randomBytes(len);
-  for (var i = 0; i < len; i++) {
-    HEAPU8[ptr++] = buf[i];
-  }
-};
+////////////////////////////////////////////////////////////////////////////////
+// Heap access
+
+var heapView = null;
 
-var NACL = {
-  declare: function(name) {
-    var func =  eval('_' + name);
-    if (!func) {
-      console.log('no such function: ' + '_' + name);
+/**
+ * A Buffer aliasing the whole wasm heap.  Growing the memory swaps out the
+ *  underlying ArrayBuffer, so don't hold on to this across anything that can
+ *  malloc.
+ */
+function heap() {
+  if (!heapView || heapView.buffer !== HEAPU8.buffer)
+    heapView = $buf.Buffer.from(HEAPU8.buffer, HEAPU8.byteOffset,
+                                HEAPU8.length);
+  return heapView;
+}
+
+/** Every arena allocation is rounded up to this. */
+const ARENA_ALIGN = 8;
+/** Enough rounding slop for the most pieces any one call carves out. */
+const ARENA_SLOP = 8 * ARENA_ALIGN;
+/**
+ * An arena that grew past this for one big call gets handed back afterwards
+ *  rather than pinning that much heap forever.
+ */
+const ARENA_KEEP_BYTES = 1 << 20;
+
+/**
+ * Scratch space for a call's arguments and results: one malloc'd region that
+ *  a call bump-allocates out of and gives back wholesale when it is done.  It
+ *  is only ever replaced by a bigger one (up to ARENA_KEEP_BYTES), so the
+ *  steady state never touches malloc.
+ */
+var Arena = {
+  base: 0,
+  size: 0,
+  used: 0,
+
+  /**
+   * Get ready for a call that needs `bytes` of scratch.  This is the only
+   *  place that can malloc (and so grow the heap), so do it before touching
+   *  HEAPU8.
+   */
+  begin: function(bytes) {
+    bytes += ARENA_SLOP;
+    this.used = 0;
+    if (bytes <= this.size)
+      return;
+    if (this.base)
+      _free(this.base);
+    this.size = Math.max(bytes, this.size * 2, 4096);
+    this.base = _malloc(this.size);
+    if (!this.base) {
+      this.size = 0;
+      throw new Error("out of memory");
     }
-    return func;
-  }
+  },
+
+  alloc: function(bytes) {
+    var ptr = this.base + this.used;
+    this.used += (bytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    return ptr;
+  },
+
+  end: function() {
+    if (this.size > ARENA_KEEP_BYTES) {
+      _free(this.base);
+      this.base = this.size = 0;
+    }
+    this.used = 0;
+  },
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 // Strings, Types
 
-function makeSizey() {
-  var addr = STACKTOP;
-  Runtime.stackAlloc(8);
-  return addr;
-}
-function fetchSizey(addr) {
-  return HEAP32[addr >> 2];
+function checkArgs(args, count, msg) {
+  if (args.length !== count)
+    throw new Error(msg);
 }
 
-function ustr_t(x) {
-  return function() {
-    var addr = STACKTOP;
-    Runtime.stackAlloc(x);
-    return addr;
-  };
+/**
+ * The byte length of a binary string / Buffer / Uint8Array argument, throwing
+ *  the same way the native binding does for anything else.
+ */
+function binLength(val, humanlabel) {
+  if (typeof val === 'string' || val instanceof Uint8Array)
+    return val.length;
+  throw new Error(humanlabel + " needs to be a binary string or buffer");
 }
-function alloc_ustr(len) {
-  var addr = STACKTOP;
-  Runtime.stackAlloc(len);
-  return addr;
+
+/** The byte length of a JS string argument once utf-8 encoded. */
+function utf8Length(val, humanlabel) {
+  if (typeof val !== 'string')
+    throw new Error(humanlabel + " needs to be a string");
+  return $buf.Buffer.byteLength(val, 'utf8');
 }
 
-/**
- * Convert an 8-bit binary string of known length to a JavaScript string.
- */
-function BinStrToJSStr(ptr, offset, length) {
-  var s = "";
-  for (var i = offset; i < length; i++) {
-    s += String.fromCharCode(HEAPU8[ptr + i]);
-  }
-  return s;
+function checkUint32(val, humanlabel) {
+  if (typeof val !== 'number' || val < 0 || val > 0xffffffff ||
+      Math.floor(val) !== val)
+    throw new Error(humanlabel + " needs to be a uint32");
 }
 
-/**
- * Convert a *null-terminated* utf8-encoded string stored in a ctypes rep to a
- *  JS string rep.  You need to make sure you allocated space for an put a nul
- *  in!
- */
-function Utf8StrToJSStr(ptr, offset) {
-  ptr += offset;
-  var s = "";
-  for(;;) {
-    var c = HEAPU8[ptr++];
-    // (null-terminator?)
-    if (c === 0)
-      break;
-    // multi-blurn! I mean, byte
-    if (c & 0x80) {
-      // 3-byte
-      if (c & 0x20) {
-        c = ((c & 0xf) << 12) |
-            ((HEAPU8[ptr++] & 0x3f) << 6) |
-            (HEAPU8[ptr++] & 0x3f);
-      }
-      // 2-byte
-      else {
-        c = ((c & 0x1f) << 6) |
-            (HEAPU8[ptr++] & 0x3f);
-      }
-    }
-    s += String.fromCharCode(c);
-  }
-  return s;
+/** Copy a binary string / Buffer / Uint8Array into the heap at `ptr`. */
+function binIn(val, ptr) {
+  if (typeof val === 'string')
+    heap().write(val, ptr, val.length, 'binary');
+  else
+    HEAPU8.set(val, ptr);
 }
 
-/**
- * Convert a JS string that contains a (binary-encoded) utf8-string inside of it
- *  into the proper JS string representation of that string, effectively just
- *  performing utf-8 decoding.
- */
-function JSUtf8StrToJSStr(u8str) {
-  var binStr = JSStrToBinStr(u8str, 0);
-  return Utf8StrToJSStr(binStr, 0);
+/** utf-8 encode a JS string straight into the heap at `ptr`. */
+function utf8In(val, ptr, nbytes) {
+  heap().write(val, ptr, nbytes, 'utf8');
 }
 
-/**
- * Convert a JS string containing an 8-bit binary string into a ctypes 8-bit
- *  binary string.
- */
-function JSStrToBinStr(jsStr, offset) {
-  var ptr = alloc_ustr(jsStr.length - offset), length = jsStr.length;
-  for (var i = offset; i < length; i++, ptr++) {
-    HEAPU8[ptr] = jsStr.charCodeAt(i);
-  }
+/** Allocate room for a binary argument in the arena and copy it in. */
+function arenaBin(val) {
+  var ptr = Arena.alloc(val.length);
+  binIn(val, ptr);
   return ptr;
 }
 
+function binOut(ptr, length) {
+  return heap().toString('binary', ptr, ptr + length);
+}
+
+function utf8Out(ptr, length) {
+  return heap().toString('utf8', ptr, ptr + length);
+}
+
+/** A binary string for a binary string / Buffer / Uint8Array argument. */
+function toBinStr(val) {
+  if (typeof val === 'string')
+    return val;
+  return $buf.Buffer.from(val.buffer, val.byteOffset, val.length)
+           .toString('binary');
+}
+
 /**
- * Convert a standard utf-16 JS string into a ctypes 8-bit utf-8 encoded string.
+ * Check a (buffer, offset, length) run of arguments starting at args[nbuf],
+ *  the way ArgReader::readRange checks a BufferRangeArg in the addon.
  */
-function JSStrToUtf8Str(jsStr) {
-  var arr = [], length = jsStr.length;
-  for (var i = 0; i < length; i++) {
-    var c = jsStr.charCodeAt(i);
-    if (c <= 0x7f) {
-      arr.push(c);
-    }
-    else if (c <= 0x7ff) {
-      arr.push(0xc | (c >> 6));
-      arr.push(0x8 | (c & 0x3f));
-    }
-    else {
-      arr.push(0xe | (c >> 12));
-      arr.push(0x8 | ((c >> 6) & 0x3f));
-      arr.push(0x8 | (c & 0x3f));
-    }
-  }
-  return allocate(arr, 'i8', ALLOC_STACK);
+function checkBufferRange(args, nbuf, humanlabel) {
+  if (!(args[nbuf] instanceof Uint8Array))
+    throw new Error(humanlabel + " needs to be a buffer");
+  checkUint32(args[nbuf + 1], humanlabel + "_offset");
+  checkUint32(args[nbuf + 2], humanlabel + "_length");
+  if (args[nbuf + 1] + args[nbuf + 2] > args[nbuf].length)
+    throw new Error(humanlabel + " range does not fit in the buffer");
 }
 
-// XXX we really want to expose friendly symbols instead of requiring this
-//  absurdity...
-const SIGN_IMPL = "_edwards25519sha512batch_ref",
-      BOX_IMPL = "_curve25519xsalsa20poly1305_ref",
-      SECRETBOX_IMPL = "_xsalsa20poly1305_ref",
-      AUTH_IMPL = "_hmacsha512256_ref",
-      HASH_IMPL = "_sha512_ref";
-
 ////////////////////////////////////////////////////////////////////////////////
 // Custom Exceptions
 
-function gimmeStack() {
-  try {
-    throw new Error("blah");
-  }
-  catch(ex) {
-    return ex.stack;
-  }
-  return null;
-}
-
 function BadBoxError(msg) {
+  Error.captureStackTrace(this, BadBoxError);
   this.message = msg;
-  this.stack = gimmeStack();
 }
 exports.BadBoxError = BadBoxError;
 BadBoxError.prototype = {
@@ -163,8 +184,8 @@ BadBoxError.prototype = {
 };
 
 function BadSignatureError(msg) {
+  Error.captureStackTrace(this, BadSignatureError);
   this.message = msg;
-  this.stack = gimmeStack();
 }
 exports.BadSignatureError = BadSignatureError;
 BadSignatureError.prototype = {
@@ -173,8 +194,8 @@ BadSignatureError.prototype = {
 };
 
 function BadSecretBoxError(msg) {
+  Error.captureStackTrace(this, BadSecretBoxError);
   this.message = msg;
-  this.stack = gimmeStack();
 }
 exports.BadSecretBoxError = BadSecretBoxError;
 BadSecretBoxError.prototype = {
@@ -183,8 +204,8 @@ BadSecretBoxError.prototype = {
 };
 
 function BadAuthenticatorError(msg) {
+  Error.captureStackTrace(this, BadAuthenticatorError);
   this.message = msg;
-  this.stack = gimmeStack();
 }
 exports.BadAuthenticatorError = BadAuthenticatorError;
 BadAuthenticatorError.prototype = {
@@ -195,119 +216,663 @@ BadAuthenticatorError.prototype = {
 ////////////////////////////////////////////////////////////////////////////////
 // Random Data Support
 
+/** Maximum number of random bytes the user can request in a go. */
+const MAX_RANDOM_BYTES = 256;
+
+// (Nothing here needs the heap, so go straight to node.)
 function random_byte_getter(howmany) {
-  // we can permanently allocate an array for this...
-  var arr = allocate(howmany, 'i8', ALLOC_NORMAL);
   return function() {
-    _randombytes(arr, howmany);
-    return BinStrToJSStr(arr, 0, howmany);
+    checkArgs(arguments, 0, "No arguments required/supported");
+    return $crypto.randomBytes(howmany).toString('binary');
   };
 }
 
+exports.randombytes = function(numbytes) {
+  checkArgs(arguments, 1, "Need 1 numeric arg: number of random bytes");
+  checkUint32(numbytes, "num_random_bytes");
+  if (numbytes >= MAX_RANDOM_BYTES)
+    throw new Error("You want too many random bytes!");
+  return $crypto.randomBytes(numbytes).toString('binary');
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Signing
 
-
 const crypto_sign_SECRETKEYBYTES = 64,
       crypto_sign_PUBLICKEYBYTES = 32,
       crypto_sign_BYTES = 64;
 
-const SignPublicKeyBstr = ustr_t(crypto_sign_PUBLICKEYBYTES),
-      SignSecretKeyBstr = ustr_t(crypto_sign_SECRETKEYBYTES);
-
-var crypto_sign_keypair = NACL.declare("crypto_sign" + SIGN_IMPL + "_keypair");
-
 exports.sign_keypair = function() {
-  var pk = SignPublicKeyBstr(),
-      sk = SignSecretKeyBstr();
-console.log("making keypair");
-  if (crypto_sign_keypair(pk, sk) !== 0)
-    throw new BadSignatureError("inexplicably failed to create keypair");
-console.log("converting keypair");
-  return {
-    sk: BinStrToJSStr(sk, 0, crypto_sign_SECRETKEYBYTES),
-    pk: BinStrToJSStr(pk, 0, crypto_sign_PUBLICKEYBYTES),
-  };
+  Arena.begin(crypto_sign_PUBLICKEYBYTES + crypto_sign_SECRETKEYBYTES);
+  try {
+    var pk = Arena.alloc(crypto_sign_PUBLICKEYBYTES),
+        sk = Arena.alloc(crypto_sign_SECRETKEYBYTES);
+    _emnacl_sign_keypair(pk, sk);
+    return {
+      sk: binOut(sk, crypto_sign_SECRETKEYBYTES),
+      pk: binOut(pk, crypto_sign_PUBLICKEYBYTES),
+    };
+  }
+  finally {
+    Arena.end();
+  }
 };
 
-var crypto_sign = NACL.declare("crypto_sign" + SIGN_IMPL);
-
-exports.sign = function(jsm, sk) {
-  if (sk.length !== crypto_sign_SECRETKEYBYTES)
-    throw new BadSignatureError("incorrect secret-key length");
+function sign(jsm, jssk, utf8) {
+  var m_len = utf8 ? utf8Length(jsm, "message") : binLength(jsm, "message");
+  if (binLength(jssk, "secretkey") !== crypto_sign_SECRETKEYBYTES)
+    throw new Error("incorrect secret-key length");
 
-  var m = JSStrToBinStr(jsm, 0), m_len = m.length;
-  var sm = alloc_ustr(m_len + crypto_sign_BYTES);
+  Arena.begin(2 * m_len + crypto_sign_BYTES + crypto_sign_SECRETKEYBYTES + 4);
+  try {
+    var m = Arena.alloc(m_len),
+        sm = Arena.alloc(m_len + crypto_sign_BYTES),
+        sm_len = Arena.alloc(4),
+        sk = arenaBin(jssk);
+    if (utf8)
+      utf8In(jsm, m, m_len);
+    else
+      binIn(jsm, m);
+    _emnacl_sign(sm, sm_len, m, m_len, sk);
+    return binOut(sm, HEAPU32[sm_len >> 2]);
+  }
+  finally {
+    Arena.end();
+  }
+}
 
-  var sm_len = makeSizey();
-  if (crypto_sign(sm, sm_len, m, m_len, JSStrToBinStr(sk, 0)) !== 0)
-    throw new BadSignatureError("inexplicably failed to sign message");
+exports.sign = function(m, sk) {
+  checkArgs(arguments, 2, "Need 2 string args: message, secretkey");
+  return sign(m, sk, false);
+};
 
-  return BinStrToJSStr(sm, 0, fetchSizey(sm_len));
+exports.sign_utf8 = function(m, sk) {
+  checkArgs(arguments, 2, "Need 2 string args: message, secretkey");
+  return sign(m, sk, true);
 };
 
-exports.sign_utf8 = function(jsm, sk) {
-  if (sk.length !== crypto_sign_SECRETKEYBYTES)
-    throw new BadSignatureError("incorrect secret-key length");
-console.log("CONVERTING");
-  var m = JSStrToUtf8Str(jsm, 0), m_len = m.length - 1; //eat nul
-  var sm = alloc_ustr(m_len + crypto_sign_BYTES);
+function sign_open(js_sm, jspk, utf8) {
+  var sm_len = binLength(js_sm, "signed_message"),
+      pk_len = binLength(jspk, "public_key");
+
+  // IMPORTANT!  nacl does not validate the size of 'sm' itself and is
+  //  vulnerable to a crash-inducing unsigned wraparound.
+  if (sm_len < crypto_sign_BYTES)
+    throw new BadSignatureError(
+      "message is smaller than the minimum signed message size");
+  if (pk_len !== crypto_sign_PUBLICKEYBYTES)
+    throw new BadSignatureError("incorrect public-key length");
 
-  var sm_len = makeSizey();
-console.log("SIGNGING");
-  if (crypto_sign(sm, sm_len, m, m_len, JSStrToBinStr(sk, 0)) !== 0)
-    throw new BadSignatureError("inexplicably failed to sign message");
-console.log("SIGNED");
-  return BinStrToJSStr(sm, 0, fetchSizey(sm_len));
+  Arena.begin(2 * sm_len + pk_len + 4);
+  try {
+    var sm = arenaBin(js_sm),
+        m = Arena.alloc(sm_len),
+        m_len = Arena.alloc(4),
+        pk = arenaBin(jspk);
+    if (_emnacl_sign_open(m, m_len, sm, sm_len, pk) !== 0)
+      throw new BadSignatureError("ciphertext fails verification");
+    return (utf8 ? utf8Out : binOut)(m, HEAPU32[m_len >> 2]);
+  }
+  finally {
+    Arena.end();
+  }
+}
+
+exports.sign_open = function(sm, pk) {
+  checkArgs(arguments, 2, "Need 2 string args: signed_message, public_key");
+  return sign_open(sm, pk, false);
 };
 
-var crypto_sign_open = NACL.declare("crypto_sign" + SIGN_IMPL + "_open");
+exports.sign_open_utf8 = function(sm, pk) {
+  checkArgs(arguments, 2, "Need 2 string args: signed_message, public_key");
+  return sign_open(sm, pk, true);
+};
 
-exports.sign_open = function(js_sm, pk) {
-  if (pk.length !== crypto_sign_PUBLICKEYBYTES)
-    throw new BadSignatureError("incorrect public-key length: " + pk.length);
-  if (js_sm.length < crypto_sign_BYTES)
+function sign_peek(js_sm) {
+  binLength(js_sm, "signed_message");
+  var sm = toBinStr(js_sm);
+  if (sm.length < crypto_sign_BYTES)
     throw new BadSignatureError(
       "message is smaller than the minimum signed message size");
+  return sm.substring(crypto_sign_BYTES / 2,
+                      sm.length - crypto_sign_BYTES / 2);
+}
 
-  var sm = JSStrToBinStr(js_sm, 0), sm_len = sm.length;
+exports.sign_peek = function(sm) {
+  checkArgs(arguments, 1, "Need 1 string arg: signed_message");
+  return sign_peek(sm);
+};
 
-  var m = alloc_ustr(sm_len),
-      m_len = makeSizey();
+exports.sign_peek_utf8 = function(sm) {
+  checkArgs(arguments, 1, "Need 1 string arg: signed_message");
+  return $buf.Buffer.from(sign_peek(sm), 'binary').toString('utf8');
+};
 
-  if (crypto_sign_open(m, m_len, sm, sm_len, JSStrToBinStr(pk, 0)))
-    throw new BadSignatureError("ciphertext fails verification");
+////////////////////////////////////////////////////////////////////////////////
+// Boxing
+
+const crypto_box_PUBLICKEYBYTES = 32,
+      crypto_box_SECRETKEYBYTES = 32,
+      crypto_box_NONCEBYTES = 24,
+      crypto_box_ZEROBYTES = 32,
+      crypto_box_BOXZEROBYTES = 16;
 
-  return BinStrToJSStr(m, 0, fetchSizey(m_len));
+exports.box_PUBLICKEYBYTES = crypto_box_PUBLICKEYBYTES;
+exports.box_SECRETKEYBYTES = crypto_box_SECRETKEYBYTES;
+
+exports.box_keypair = function() {
+  Arena.begin(crypto_box_PUBLICKEYBYTES + crypto_box_SECRETKEYBYTES);
+  try {
+    var pk = Arena.alloc(crypto_box_PUBLICKEYBYTES),
+        sk = Arena.alloc(crypto_box_SECRETKEYBYTES);
+    _emnacl_box_keypair(pk, sk);
+    return {
+      sk: binOut(sk, crypto_box_SECRETKEYBYTES),
+      pk: binOut(pk, crypto_box_PUBLICKEYBYTES),
+    };
+  }
+  finally {
+    Arena.end();
+  }
 };
 
-exports.sign_open_utf8 = function(js_sm, pk) {
-  if (pk.length !== crypto_sign_PUBLICKEYBYTES)
-    throw new BadSignatureError("incorrect public-key length: " + pk.length);
-  if (js_sm.length < crypto_sign_BYTES)
-    throw new BadSignatureError(
-      "message is smaller than the minimum signed message size");
+/**
+ * Check the nonce and keys the way nacl's crypto_box C++ wrapper does,
+ *  throwing `ErrorType`.
+ */
+function checkBoxKeys(jsn, jspk, jssk, ErrorType) {
+  var n_len = binLength(jsn, "nonce"),
+      pk_len = binLength(jspk, "public_key"),
+      sk_len = binLength(jssk, "secret_key");
+  if (pk_len !== crypto_box_PUBLICKEYBYTES)
+    throw new ErrorType("incorrect public-key length");
+  if (sk_len !== crypto_box_SECRETKEYBYTES)
+    throw new ErrorType("incorrect secret-key length");
+  if (n_len !== crypto_box_NONCEBYTES)
+    throw new ErrorType("incorrect nonce length");
+}
+
+function box(jsm, jsn, jspk, jssk, utf8) {
+  var m_len = utf8 ? utf8Length(jsm, "message") : binLength(jsm, "message");
+  checkBoxKeys(jsn, jspk, jssk, Error);
+
+  var padded = crypto_box_ZEROBYTES + m_len;
+  Arena.begin(2 * padded + crypto_box_NONCEBYTES +
+              crypto_box_PUBLICKEYBYTES + crypto_box_SECRETKEYBYTES);
+  try {
+    var m = Arena.alloc(padded),
+        c = Arena.alloc(padded),
+        n = arenaBin(jsn),
+        pk = arenaBin(jspk),
+        sk = arenaBin(jssk);
+    HEAPU8.fill(0, m, m + crypto_box_ZEROBYTES);
+    if (utf8)
+      utf8In(jsm, m + crypto_box_ZEROBYTES, m_len);
+    else
+      binIn(jsm, m + crypto_box_ZEROBYTES);
+    _emnacl_box(c, m, padded, n, pk, sk);
+    return binOut(c + crypto_box_BOXZEROBYTES,
+                  padded - crypto_box_BOXZEROBYTES);
+  }
+  finally {
+    Arena.end();
+  }
+}
+
+exports.box = function(m, n, pk, sk) {
+  checkArgs(arguments, 4, "Need 4 args: message, nonce, pubkey, secretkey");
+  return box(m, n, pk, sk, false);
+};
+
+exports.box_utf8 = function(m, n, pk, sk) {
+  checkArgs(arguments, 4, "Need 4 args: message, nonce, pubkey, secretkey");
+  return box(m, n, pk, sk, true);
+};
+
+function box_open(jsc, jsn, jspk, jssk, utf8) {
+  var c_len = binLength(jsc, "ciphertext_message");
+  checkBoxKeys(jsn, jspk, jssk, BadBoxError);
+  // (the addon lets open() reject these, so the message is the same)
+  if (c_len < crypto_box_BOXZEROBYTES)
+    throw new BadBoxError("ciphertext fails verification");
+
+  var padded = crypto_box_BOXZEROBYTES + c_len;
+  Arena.begin(2 * padded + crypto_box_NONCEBYTES +
+              crypto_box_PUBLICKEYBYTES + crypto_box_SECRETKEYBYTES);
+  try {
+    var c = Arena.alloc(padded),
+        m = Arena.alloc(padded),
+        n = arenaBin(jsn),
+        pk = arenaBin(jspk),
+        sk = arenaBin(jssk);
+    HEAPU8.fill(0, c, c + crypto_box_BOXZEROBYTES);
+    binIn(jsc, c + crypto_box_BOXZEROBYTES);
+    if (_emnacl_box_open(m, c, padded, n, pk, sk) !== 0)
+      throw new BadBoxError("ciphertext fails verification");
+    return (utf8 ? utf8Out : binOut)(m + crypto_box_ZEROBYTES,
+                                     padded - crypto_box_ZEROBYTES);
+  }
+  finally {
+    Arena.end();
+  }
+}
+
+exports.box_open = function(c, n, pk, sk) {
+  checkArgs(arguments, 4,
+            "Need 4 args: ciphertext, nonce, pubkey, secretkey");
+  return box_open(c, n, pk, sk, false);
+};
+
+exports.box_open_utf8 = function(c, n, pk, sk) {
+  checkArgs(arguments, 4,
+            "Need 4 args: ciphertext, nonce, pubkey, secretkey");
+  return box_open(c, n, pk, sk, true);
+};
+
+exports.box_random_nonce = random_byte_getter(crypto_box_NONCEBYTES);
+
+////////////////////////////////////////////////////////////////////////////////
+// Secretbox
+
+const crypto_secretbox_KEYBYTES = 32,
+      crypto_secretbox_NONCEBYTES = 24,
+      crypto_secretbox_ZEROBYTES = 32,
+      crypto_secretbox_BOXZEROBYTES = 16;
+
+exports.secretbox_KEYBYTES = crypto_secretbox_KEYBYTES;
+
+function checkSecretBoxKey(jsn, jsk, ErrorType) {
+  var n_len = binLength(jsn, "nonce"),
+      k_len = binLength(jsk, "key");
+  if (k_len !== crypto_secretbox_KEYBYTES)
+    throw new ErrorType("incorrect key length");
+  if (n_len !== crypto_secretbox_NONCEBYTES)
+    throw new ErrorType("incorrect nonce length");
+}
+
+function secretbox(jsm, jsn, jsk, utf8) {
+  var m_len = utf8 ? utf8Length(jsm, "message") : binLength(jsm, "message");
+  checkSecretBoxKey(jsn, jsk, Error);
+
+  var padded = crypto_secretbox_ZEROBYTES + m_len;
+  Arena.begin(2 * padded + crypto_secretbox_NONCEBYTES +
+              crypto_secretbox_KEYBYTES);
+  try {
+    var m = Arena.alloc(padded),
+        c = Arena.alloc(padded),
+        n = arenaBin(jsn),
+        k = arenaBin(jsk);
+    HEAPU8.fill(0, m, m + crypto_secretbox_ZEROBYTES);
+    if (utf8)
+      utf8In(jsm, m + crypto_secretbox_ZEROBYTES, m_len);
+    else
+      binIn(jsm, m + crypto_secretbox_ZEROBYTES);
+    _emnacl_secretbox(c, m, padded, n, k);
+    return binOut(c + crypto_secretbox_BOXZEROBYTES,
+                  padded - crypto_secretbox_BOXZEROBYTES);
+  }
+  finally {
+    Arena.end();
+  }
+}
+
+exports.secretbox = function(m, n, k) {
+  checkArgs(arguments, 3, "Need 3 args: message, nonce, key");
+  return secretbox(m, n, k, false);
+};
+
+exports.secretbox_utf8 = function(m, n, k) {
+  checkArgs(arguments, 3, "Need 3 args: message, nonce, key");
+  return secretbox(m, n, k, true);
+};
+
+function secretbox_open(jsc, jsn, jsk, utf8) {
+  var c_len = binLength(jsc, "ciphertext_message");
+  checkSecretBoxKey(jsn, jsk, BadSecretBoxError);
+  // (the addon lets open() reject these, so the message is the same)
+  if (c_len < crypto_secretbox_BOXZEROBYTES)
+    throw new BadSecretBoxError("ciphertext fails verification");
+
+  var padded = crypto_secretbox_BOXZEROBYTES + c_len;
+  Arena.begin(2 * padded + crypto_secretbox_NONCEBYTES +
+              crypto_secretbox_KEYBYTES);
+  try {
+    var c = Arena.alloc(padded),
+        m = Arena.alloc(padded),
+        n = arenaBin(jsn),
+        k = arenaBin(jsk);
+    HEAPU8.fill(0, c, c + crypto_secretbox_BOXZEROBYTES);
+    binIn(jsc, c + crypto_secretbox_BOXZEROBYTES);
+    if (_emnacl_secretbox_open(m, c, padded, n, k) !== 0)
+      throw new BadSecretBoxError("ciphertext fails verification");
+    return (utf8 ? utf8Out : binOut)(m + crypto_secretbox_ZEROBYTES,
+                                     padded - crypto_secretbox_ZEROBYTES);
+  }
+  finally {
+    Arena.end();
+  }
+}
 
-  var sm = JSStrToBinStr(js_sm, 0), sm_len = sm.length;
+exports.secretbox_open = function(c, n, k) {
+  checkArgs(arguments, 3, "Need 3 args: ciphertext, nonce, key");
+  return secretbox_open(c, n, k, false);
+};
+
+exports.secretbox_open_utf8 = function(c, n, k) {
+  checkArgs(arguments, 3, "Need 3 args: ciphertext, nonce, key");
+  return secretbox_open(c, n, k, true);
+};
+
+exports.secretbox_random_nonce =
+  random_byte_getter(crypto_secretbox_NONCEBYTES);
+exports.secretbox_random_key = random_byte_getter(crypto_secretbox_KEYBYTES);
+
+////////////////////////////////////////////////////////////////////////////////
+// auth
+
+const crypto_auth_BYTES = 32,
+      crypto_auth_KEYBYTES = 32;
 
-  var m = alloc_ustr(sm_len + 1), // null terminator needs a spot
-      m_len = makeSizey();
+exports.auth_KEYBYTES = crypto_auth_KEYBYTES;
+
+function auth(jsm, jsk, utf8) {
+  var m_len = utf8 ? utf8Length(jsm, "message") : binLength(jsm, "message");
+  if (binLength(jsk, "key") !== crypto_auth_KEYBYTES)
+    throw new Error("incorrect key length");
+
+  Arena.begin(m_len + crypto_auth_BYTES + crypto_auth_KEYBYTES);
+  try {
+    var m = Arena.alloc(m_len),
+        a = Arena.alloc(crypto_auth_BYTES),
+        k = arenaBin(jsk);
+    if (utf8)
+      utf8In(jsm, m, m_len);
+    else
+      binIn(jsm, m);
+    _emnacl_auth(a, m, m_len, k);
+    return binOut(a, crypto_auth_BYTES);
+  }
+  finally {
+    Arena.end();
+  }
+}
 
-  if (crypto_sign_open(m, m_len, sm, sm_len, JSStrToBinStr(pk, 0)))
-    throw new BadSignatureError("ciphertext fails verification");
-  m[m_len] = 0;
+exports.auth = function(m, k) {
+  checkArgs(arguments, 2, "Need 2 args: message, key");
+  return auth(m, k, false);
+};
 
-  return Utf8StrToJSStr(m, 0, fetchSizey(m_len));
+exports.auth_utf8 = function(m, k) {
+  checkArgs(arguments, 2, "Need 2 args: message, key");
+  return auth(m, k, true);
 };
 
-exports.sign_peek = function(js_sm) {
-  return js_sm.substring(crypto_sign_BYTES / 2,
-                         js_sm.length - crypto_sign_BYTES / 2);
+function auth_verify(jsa, jsm, jsk, utf8) {
+  var a_len = binLength(jsa, "authenticator"),
+      m_len = utf8 ? utf8Length(jsm, "message") : binLength(jsm, "message"),
+      k_len = binLength(jsk, "key");
+  if (k_len !== crypto_auth_KEYBYTES)
+    throw new BadAuthenticatorError("incorrect key length");
+  if (a_len !== crypto_auth_BYTES)
+    throw new BadAuthenticatorError("incorrect authenticator length");
+
+  Arena.begin(m_len + crypto_auth_BYTES + crypto_auth_KEYBYTES);
+  try {
+    var m = Arena.alloc(m_len),
+        a = arenaBin(jsa),
+        k = arenaBin(jsk);
+    if (utf8)
+      utf8In(jsm, m, m_len);
+    else
+      binIn(jsm, m);
+    if (_emnacl_auth_verify(a, m, m_len, k) !== 0)
+      throw new BadAuthenticatorError("invalid authenticator");
+  }
+  finally {
+    Arena.end();
+  }
+}
+
+exports.auth_verify = function(a, m, k) {
+  checkArgs(arguments, 3, "Need 3 args: authenticator, message, key");
+  auth_verify(a, m, k, false);
 };
 
-exports.sign_peek_utf8 = function(js_sm) {
-  var binstr = js_sm.substring(crypto_sign_BYTES / 2,
-                               js_sm.length - crypto_sign_BYTES / 2);
-  return JSUtf8StrToJSStr(binstr);
+exports.auth_verify_utf8 = function(a, m, k) {
+  checkArgs(arguments, 3, "Need 3 args: authenticator, message, key");
+  auth_verify(a, m, k, true);
 };
 
+exports.auth_random_key = random_byte_getter(crypto_auth_KEYBYTES);
+
+////////////////////////////////////////////////////////////////////////////////
+// Stream / onetimeauth
+//
+// The native versions work on the caller's Buffer in place; the closest we
+//  can get is one bulk copy of the range in and (for xor) one back out.
+
+const crypto_stream_xsalsa20_KEYBYTES = 32,
+      crypto_stream_xsalsa20_NONCEBYTES = 24,
+      crypto_onetimeauth_BYTES = 16,
+      crypto_onetimeauth_KEYBYTES = 32;
+
+exports.stream_xsalsa20_KEYBYTES = crypto_stream_xsalsa20_KEYBYTES;
+exports.stream_xsalsa20_NONCEBYTES = crypto_stream_xsalsa20_NONCEBYTES;
+// (see MAX_STREAM_BYTES in nacl_node.cc)
+const MAX_STREAM_BYTES = 1 << 20;
+exports.stream_xsalsa20_MAXBYTES = MAX_STREAM_BYTES;
+exports.onetimeauth_BYTES = crypto_onetimeauth_BYTES;
+exports.onetimeauth_KEYBYTES = crypto_onetimeauth_KEYBYTES;
+
+function checkStreamKey(jsn, jsk) {
+  var n_len = binLength(jsn, "nonce"),
+      k_len = binLength(jsk, "key");
+  if (n_len !== crypto_stream_xsalsa20_NONCEBYTES)
+    throw new Error("incorrect nonce length");
+  if (k_len !== crypto_stream_xsalsa20_KEYBYTES)
+    throw new Error("incorrect key length");
+}
+
+exports.stream_xsalsa20 = function(length, jsn, jsk) {
+  checkArgs(arguments, 3, "Need 3 args: length, nonce, key");
+  checkUint32(length, "length");
+  checkStreamKey(jsn, jsk);
+  if (length > MAX_STREAM_BYTES)
+    throw new Error("You want too long a keystream!");
+
+  Arena.begin(length + crypto_stream_xsalsa20_NONCEBYTES +
+              crypto_stream_xsalsa20_KEYBYTES);
+  try {
+    var c = Arena.alloc(length),
+        n = arenaBin(jsn),
+        k = arenaBin(jsk);
+    HEAPU8.fill(0, c, c + length);
+    _emnacl_stream_xsalsa20_xor(c, c, length, n, 0, 0, k);
+    return binOut(c, length);
+  }
+  finally {
+    Arena.end();
+  }
+};
+
+exports.stream_xsalsa20_xor = function(buf, offset, length, jsn, jsk,
+                                       counter) {
+  if (arguments.length !== 5 && arguments.length !== 6)
+    throw new Error(
+      "Need 5 or 6 args: buffer, offset, length, nonce, key[, counter]");
+  checkBufferRange(arguments, 0, "buffer");
+  if (arguments.length === 6) {
+    if (typeof counter !== 'number' || counter < 0 ||
+        counter > 9007199254740991 || Math.floor(counter) !== counter)
+      throw new Error("counter needs to be a non-negative integer");
+  }
+  else {
+    counter = 0;
+  }
+  checkStreamKey(jsn, jsk);
+
+  Arena.begin(length + crypto_stream_xsalsa20_NONCEBYTES +
+              crypto_stream_xsalsa20_KEYBYTES);
+  try {
+    var m = Arena.alloc(length),
+        n = arenaBin(jsn),
+        k = arenaBin(jsk);
+    HEAPU8.set(buf.subarray(offset, offset + length), m);
+    _emnacl_stream_xsalsa20_xor(m, m, length, n,
+                                counter % 0x100000000,
+                                Math.floor(counter / 0x100000000), k);
+    buf.set(HEAPU8.subarray(m, m + length), offset);
+  }
+  finally {
+    Arena.end();
+  }
+};
+
+exports.onetimeauth = function(buf, offset, length, jsk) {
+  checkArgs(arguments, 4, "Need 4 args: buffer, offset, length, key");
+  checkBufferRange(arguments, 0, "buffer");
+  if (binLength(jsk, "key") !== crypto_onetimeauth_KEYBYTES)
+    throw new Error("incorrect key length");
+
+  Arena.begin(length + crypto_onetimeauth_BYTES +
+              crypto_onetimeauth_KEYBYTES);
+  try {
+    var m = Arena.alloc(length),
+        a = Arena.alloc(crypto_onetimeauth_BYTES),
+        k = arenaBin(jsk);
+    HEAPU8.set(buf.subarray(offset, offset + length), m);
+    _emnacl_onetimeauth(a, m, length, k);
+    return binOut(a, crypto_onetimeauth_BYTES);
+  }
+  finally {
+    Arena.end();
+  }
+};
+
+exports.onetimeauth_verify = function(jsa, buf, offset, length, jsk) {
+  checkArgs(arguments, 5,
+            "Need 5 args: authenticator, buffer, offset, length, key");
+  var a_len = binLength(jsa, "authenticator");
+  checkBufferRange(arguments, 1, "buffer");
+  var k_len = binLength(jsk, "key");
+  if (a_len !== crypto_onetimeauth_BYTES)
+    throw new BadAuthenticatorError("incorrect authenticator length");
+  if (k_len !== crypto_onetimeauth_KEYBYTES)
+    throw new BadAuthenticatorError("incorrect key length");
+
+  Arena.begin(length + crypto_onetimeauth_BYTES +
+              crypto_onetimeauth_KEYBYTES);
+  try {
+    var m = Arena.alloc(length),
+        a = arenaBin(jsa),
+        k = arenaBin(jsk);
+    HEAPU8.set(buf.subarray(offset, offset + length), m);
+    if (_emnacl_onetimeauth_verify(a, m, length, k) !== 0)
+      throw new BadAuthenticatorError("invalid authenticator");
+  }
+  finally {
+    Arena.end();
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Hash
+
+/** Bytes of each hash512_256 digest. */
+const HASH512_256_BYTES = 32;
+
+function hash512_256(jsm, utf8) {
+  var m_len = utf8 ? utf8Length(jsm, "message") : binLength(jsm, "message");
+
+  Arena.begin(m_len + HASH512_256_BYTES);
+  try {
+    var m = Arena.alloc(m_len),
+        h = Arena.alloc(HASH512_256_BYTES);
+    if (utf8)
+      utf8In(jsm, m, m_len);
+    else
+      binIn(jsm, m);
+    _emnacl_hash512_256(h, m, m_len);
+    return binOut(h, HASH512_256_BYTES);
+  }
+  finally {
+    Arena.end();
+  }
+}
+
+exports.hash512_256 = function(m) {
+  checkArgs(arguments, 1, "Need 1 arg: message");
+  return hash512_256(m, false);
+};
+
+exports.hash512_256_utf8 = function(m) {
+  checkArgs(arguments, 1, "Need 1 arg: message");
+  return hash512_256(m, true);
+};
+
+/**
+ * Same contract as the native hash512_256_batch: an array of messages, or one
+ *  packed buffer plus the offsets each message starts at.  Everything is
+ *  copied in at once and hashed in one pass over the arena.
+ */
+exports.hash512_256_batch = function(msgs, offsets) {
+  var starts = [], lens = [], total = 0, i;
+
+  if (arguments.length === 1) {
+    if (!Array.isArray(msgs))
+      throw new Error(
+        "messages needs to be an array of binary strings or buffers");
+    for (i = 0; i < msgs.length; i++) {
+      if (typeof msgs[i] !== 'string' && !(msgs[i] instanceof Uint8Array))
+        throw new Error(
+          "messages needs to be an array of binary strings or buffers");
+      starts.push(total);
+      lens.push(msgs[i].length);
+      total += msgs[i].length;
+    }
+  }
+  else if (arguments.length === 2) {
+    if (!(msgs instanceof Uint8Array))
+      throw new Error("packed_messages needs to be a buffer");
+    if (!Array.isArray(offsets))
+      throw new Error("offsets needs to be an array of uint32s");
+    total = msgs.length;
+    for (i = 0; i < offsets.length; i++) {
+      var start = offsets[i],
+          end = i + 1 < offsets.length ? offsets[i + 1] : total;
+      if (typeof start !== 'number' || start < 0 || start > 0xffffffff ||
+          Math.floor(start) !== start || typeof end !== 'number')
+        throw new Error("offsets needs to be an array of uint32s");
+      if (start > end || end > total)
+        throw new Error(
+          "offsets need to be ascending and inside packed_messages");
+      starts.push(start);
+      lens.push(end - start);
+    }
+  }
+  else {
+    throw new Error("Need 1 or 2 args: messages[, offsets]");
+  }
+
+  var count = lens.length;
+  Arena.begin(total + count * HASH512_256_BYTES);
+  try {
+    var data = Arena.alloc(total),
+        out = Arena.alloc(count * HASH512_256_BYTES);
+    if (arguments.length === 1) {
+      for (i = 0; i < count; i++)
+        binIn(msgs[i], data + starts[i]);
+    }
+    else {
+      HEAPU8.set(msgs, data);
+    }
+    for (i = 0; i < count; i++)
+      _emnacl_hash512_256(out + i * HASH512_256_BYTES, data + starts[i],
+                          lens[i]);
+    return $buf.Buffer.from(
+      HEAPU8.slice(out, out + count * HASH512_256_BYTES).buffer);
+  }
+  finally {
+    Arena.end();
+  }
+};
@@ -0,0 +1,41 @@
+// Loads the WebAssembly build of nacl made by tools/build_emnacl.sh, for hosts
+//  that cannot build the native addon.  The API is the same as the addon's;
+//  see emnacl.js.
+//
+// There are two flavours and we take the SIMD-128 one if this engine can
+//  validate SIMD code.  Set EMNACL_FLAVOUR to 'simd' or 'plain' to pick one
+//  yourself; build_emnacl.sh does that to run the tests against both.
+
+// (a function returning i8x16.popcnt(i8x16.splat(0)))
+var SIMD_PROBE = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1,
+  8, 0, 65, 0, 253, 15, 253, 98, 11]);
+
+var FLAVOURS = {
+  simd: './build/emnacl/emnacled_simd',
+  plain: './build/emnacl/emnacled'
+};
+
+var flavour = process.env.EMNACL_FLAVOUR;
+if (!flavour) {
+  flavour = 'plain';
+  try {
+    if (WebAssembly.validate(SIMD_PROBE))
+      flavour = 'simd';
+  }
+  catch(ex) {
+  }
+}
+if (!FLAVOURS.hasOwnProperty(flavour))
+  throw new Error("EMNACL_FLAVOUR needs to be 'simd' or 'plain'");
+
+try {
+  module.exports = require(FLAVOURS[flavour]);
+}
+catch(ex) {
+  if (ex.code !== 'MODULE_NOT_FOUND')
+    throw ex;
+  throw new Error('The ' + flavour + ' WebAssembly build is missing; ' +
+                  'run tools/build_emnacl.sh');
+}
+module.exports.FLAVOUR = flavour;
@@ -0,0 +1,317 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <string.h>
+
+#include "batch_scheduler.h"
+
+/**
+ * Zero all of `s`'s storage, including whatever an erase() or a shrinking
+ *  resize() left behind past its end (resizing up to the capacity never
+ *  reallocates).
+ */
+static void
+wipe(std::string &s)
+{
+  s.resize(s.capacity());
+  if (!s.empty())
+    memset(&s[0], 0, s.size());
+}
+
+BatchOp::~BatchOp()
+{
+  wipe(key);
+  wipe(in);
+  wipe(out);
+}
+
+bool
+BatchScheduler::GroupKey::operator<(const GroupKey &other) const
+{
+  if (large != other.large)
+    return !large;
+  if (kind != other.kind)
+    return kind < other.kind;
+  return *key < *other.key;
+}
+
+BatchScheduler::BatchScheduler(const Kind *kinds, unsigned int nkinds,
+                               DoneFunc done)
+  : m_kinds(kinds), m_nkinds(nkinds), m_done(done),
+    m_handlesReady(false), m_armed(false),
+    m_pendingOps(0), m_oldestPending(0), m_largeRunning(0)
+{
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+const char *
+BatchScheduler::configure(const Options &options)
+{
+  if (!options.maxBatch)
+    return "maxBatch needs to be at least 1";
+  if (!options.largeLaneThreads)
+    return "largeLaneThreads needs to be at least 1";
+  if (!options.poolThreads)
+    return "poolThreads needs to be at least 1";
+  m_options = options;
+  return NULL;
+}
+
+void
+BatchScheduler::submit(BatchOp *op)
+{
+  bool large = op->in.size() > m_options.smallBytes;
+  GroupKey where = { large, op->kind, &op->key };
+
+  Batch *batch;
+  PendingMap::iterator it = m_pending.find(where);
+  if (it != m_pending.end()) {
+    batch = it->second;
+  }
+  else {
+    batch = new Batch();
+    batch->owner = this;
+    batch->kind = op->kind;
+    batch->large = large;
+    m_pending.insert(PendingMap::value_type(where, batch));
+  }
+
+  if (!m_pendingOps)
+    m_oldestPending = uv_hrtime();
+  batch->ops.push_back(op);
+  m_pendingOps++;
+  m_stats.submitted++;
+
+  if (batch->ops.size() >= m_options.maxBatch) {
+    // (the map key points into the batch's first op, so erase by iterator
+    //  before that op could go anywhere)
+    m_pending.erase(m_pending.find(where));
+    m_pendingOps -= batch->ops.size();
+    m_stats.fullFlushes++;
+    dispatch(batch);
+  }
+  else if ((uv_hrtime() - m_oldestPending) / 1000 >=
+           m_options.lateFlushMicros) {
+    m_stats.lateFlushes++;
+    flushAll();
+  }
+
+  if (m_pendingOps)
+    arm();
+}
+
+void
+BatchScheduler::arm()
+{
+  if (m_armed)
+    return;
+  if (!m_handlesReady) {
+    uv_check_init(uv_default_loop(), &m_check);
+    uv_idle_init(uv_default_loop(), &m_idle);
+    m_check.data = m_idle.data = this;
+    m_handlesReady = true;
+  }
+  uv_check_start(&m_check, onCheck);
+  uv_idle_start(&m_idle, onIdle);
+  m_armed = true;
+}
+
+void
+BatchScheduler::onCheck(uv_check_t *handle, int status)
+{
+  BatchScheduler *self = static_cast<BatchScheduler *>(handle->data);
+  uv_check_stop(&self->m_check);
+  uv_idle_stop(&self->m_idle);
+  self->m_armed = false;
+  if (!self->m_undelivered.empty()) {
+    std::vector<BatchOp *> ops;
+    ops.swap(self->m_undelivered);
+    self->deliver(ops);
+  }
+  if (self->m_pendingOps) {
+    self->m_stats.turnFlushes++;
+    self->flushAll();
+  }
+}
+
+void
+BatchScheduler::onIdle(uv_idle_t *handle, int status)
+{
+}
+
+/**
+ * Dispatch every pending batch, small ones first.
+ */
+void
+BatchScheduler::flushAll()
+{
+  // (the map orders the small lane first)
+  std::vector<Batch *> batches;
+  batches.reserve(m_pending.size());
+  for (PendingMap::iterator it = m_pending.begin(); it != m_pending.end();
+       ++it)
+    batches.push_back(it->second);
+  m_pending.clear();
+  m_pendingOps = 0;
+
+  for (size_t i = 0; i < batches.size(); i++)
+    dispatch(batches[i]);
+}
+
+void
+BatchScheduler::dispatch(Batch *batch)
+{
+  m_stats.batches++;
+  if (batch->ops.size() > m_stats.largestBatch)
+    m_stats.largestBatch = batch->ops.size();
+
+  size_t count = batch->ops.size();
+  unsigned int threads = batch->large ? m_options.largeLaneThreads
+                                      : m_options.poolThreads;
+  if (batch->kind >= m_nkinds || m_kinds[batch->kind].sharesWork ||
+      count < 2 || threads < 2) {
+    schedule(batch);
+    return;
+  }
+
+  // Nothing to share, so give every thread an even slice to run in parallel.
+  size_t jobs = threads < count ? threads : count;
+  size_t per = (count + jobs - 1) / jobs;
+  std::vector<Batch *> slices;
+  for (size_t start = per; start < count; start += per) {
+    Batch *slice = new Batch();
+    slice->owner = this;
+    slice->kind = batch->kind;
+    slice->large = batch->large;
+    size_t end = start + per < count ? start + per : count;
+    slice->ops.assign(batch->ops.begin() + start, batch->ops.begin() + end);
+    slices.push_back(slice);
+  }
+  batch->ops.resize(per);
+  schedule(batch);
+  for (size_t i = 0; i < slices.size(); i++)
+    schedule(slices[i]);
+}
+
+void
+BatchScheduler::schedule(Batch *batch)
+{
+  m_stats.jobs++;
+  if (batch->large && m_largeRunning >= m_options.largeLaneThreads)
+    m_largeBacklog.push_back(batch);
+  else
+    queue(batch);
+}
+
+void
+BatchScheduler::queue(Batch *batch)
+{
+  if (batch->large)
+    m_largeRunning++;
+  batch->req.data = batch;
+  uv_queue_work(uv_default_loop(), &batch->req, onWork, onAfterWork);
+}
+
+void
+BatchScheduler::onWork(uv_work_t *req)
+{
+  Batch *batch = static_cast<Batch *>(req->data);
+  BatchScheduler *self = batch->owner;
+  // (kinds come from our own bindings, but still)
+  if (batch->kind < self->m_nkinds) {
+    self->m_kinds[batch->kind].exec(&batch->ops[0], batch->ops.size());
+  }
+  else {
+    for (size_t i = 0; i < batch->ops.size(); i++)
+      batch->ops[i]->error = "unknown operation";
+  }
+}
+
+void
+BatchScheduler::onAfterWork(uv_work_t *req)
+{
+  Batch *batch = static_cast<Batch *>(req->data);
+  BatchScheduler *self = batch->owner;
+
+  if (batch->large) {
+    self->m_largeRunning--;
+    while (!self->m_largeBacklog.empty() &&
+           self->m_largeRunning < self->m_options.largeLaneThreads) {
+      Batch *next = self->m_largeBacklog.front();
+      self->m_largeBacklog.pop_front();
+      self->queue(next);
+    }
+  }
+
+  // (results that are still waiting on a throw go first)
+  if (self->m_undelivered.empty())
+    self->deliver(batch->ops);
+  else
+    self->m_undelivered.insert(self->m_undelivered.end(), batch->ops.begin(),
+                               batch->ops.end());
+  delete batch;
+}
+
+/**
+ * Hand finished operations to m_done in order.  Once one throws, V8 has just
+ *  been through an exception report, so the rest wait for the next turn
+ *  rather than get called straight after it.
+ */
+void
+BatchScheduler::deliver(const std::vector<BatchOp *> &ops)
+{
+  for (size_t i = 0; i < ops.size(); i++) {
+    bool delivered = m_done(ops[i]);
+    delete ops[i];
+    m_stats.completed++;
+    if (!delivered) {
+      m_undelivered.insert(m_undelivered.end(), ops.begin() + i + 1,
+                           ops.end());
+      if (!m_undelivered.empty())
+        arm();
+      return;
+    }
+  }
+}
+
+void
+BatchScheduler::stats(Stats *out) const
+{
+  *out = m_stats;
+  out->pending = m_pendingOps;
+  out->largeQueued = m_largeBacklog.size();
+}
@@ -0,0 +1,238 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NACL_NODE_BATCH_SCHEDULER_H
+#define NACL_NODE_BATCH_SCHEDULER_H
+
+#include <stddef.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <uv.h>
+
+/** Default most operations we will hand a worker in one batch. */
+#define BATCH_DEFAULT_MAX_BATCH 64
+/**
+ * Default wait, in microseconds, after which the next submission flushes
+ *  everything pending rather than waiting for the end of the turn.
+ */
+#define BATCH_DEFAULT_LATE_FLUSH_MICROS 1000
+/** Default biggest input that still counts as small. */
+#define BATCH_DEFAULT_SMALL_BYTES 65536
+/** Default number of threadpool threads big operations may tie up at once. */
+#define BATCH_DEFAULT_LARGE_LANE_THREADS 1
+/** Default size of the threadpool we spread unshared work over (libuv's). */
+#define BATCH_DEFAULT_POOL_THREADS 4
+
+/**
+ * One queued operation.  The binding fills in everything but `out` and
+ *  `error`; the worker fills in those two.
+ */
+struct BatchOp {
+  BatchOp() : kind(0), error(NULL), ctx(NULL) {}
+  /** (key, in and out may all be secret, so they get wiped) */
+  ~BatchOp();
+
+  /** Index into the scheduler's table of ExecFuncs. */
+  unsigned int kind;
+  /** Operations only batch with others of the same kind and key. */
+  std::string key;
+  std::string nonce;
+  std::string in;
+  std::string out;
+  /** Why the operation failed, or NULL if it didn't. */
+  const char *error;
+  /** Whatever the binding needs to deliver the result (a callback). */
+  void *ctx;
+};
+
+/**
+ * Coalesces operations issued during one turn of the event loop into batches
+ *  that run on the libuv threadpool, so that callers each making their own
+ *  little call still get the benefit of batched native work (one
+ *  crypto_box_beforenm per key, the multi-buffer SHA-512 kernel, one thread
+ *  handoff per batch rather than per call).
+ *
+ * Operations are grouped by kind and key.  Kinds whose operations share work
+ *  (a key setup, a multi-buffer kernel) run each batch as one threadpool job.
+ *  Kinds that don't would only serialize a batch on one thread, so their
+ *  batches are cut into one job per threadpool thread instead.  A batch gets
+ *  dispatched when it reaches maxBatch operations, at the end of the loop turn
+ *  (from a check handle), or along with everything else pending when an
+ *  operation is submitted after the oldest pending one has waited
+ *  lateFlushMicros.
+ *
+ * lateFlushMicros is not a latency bound.  Nothing on the main thread can run
+ *  until the JS that is submitting returns to the loop, and the end-of-turn
+ *  check runs as soon as it does (the idle handle keeps poll from blocking
+ *  first), so a timer would never beat it.  All lateFlushMicros does is stop
+ *  a long turn that keeps submitting from holding everything back until it
+ *  is over.
+ *
+ * There are two lanes.  Operations with more than smallBytes of input go in
+ *  the large lane, which may only occupy largeLaneThreads threadpool threads
+ *  at a time; the rest of its batches wait here rather than in the
+ *  threadpool's queue, so small operations never sit behind a pile of
+ *  multi-megabyte hashes.  Small batches are always dispatched first.
+ *
+ * Everything here happens on the main thread except for the ExecFuncs, which
+ *  run on threadpool threads and only touch the operations they are given.
+ */
+class BatchScheduler {
+public:
+  /**
+   * Run `count` operations of the same kind and key, setting each one's
+   *  `out` or `error`.  Called on a threadpool thread.
+   */
+  typedef void (*ExecFunc)(BatchOp *const *ops, size_t count);
+
+  struct Kind {
+    ExecFunc exec;
+    /**
+     * Does running operations together save anything?  If not, a batch gets
+     *  spread over the threadpool rather than run as one job.
+     */
+    bool sharesWork;
+  };
+  /**
+   * Deliver a finished operation's result.  Called on the main thread; the
+   *  scheduler deletes the operation afterwards.  Returns false if delivering
+   *  it threw (and the exception has been reported), in which case the rest
+   *  of the batch waits for the next turn.
+   */
+  typedef bool (*DoneFunc)(BatchOp *op);
+
+  struct Options {
+    Options()
+      : maxBatch(BATCH_DEFAULT_MAX_BATCH),
+        lateFlushMicros(BATCH_DEFAULT_LATE_FLUSH_MICROS),
+        smallBytes(BATCH_DEFAULT_SMALL_BYTES),
+        largeLaneThreads(BATCH_DEFAULT_LARGE_LANE_THREADS),
+        poolThreads(BATCH_DEFAULT_POOL_THREADS) {}
+    unsigned int maxBatch;
+    unsigned int lateFlushMicros;
+    unsigned int smallBytes;
+    unsigned int largeLaneThreads;
+    /** How many jobs to cut a batch of a non-sharing kind into. */
+    unsigned int poolThreads;
+  };
+
+  BatchScheduler(const Kind *kinds, unsigned int nkinds, DoneFunc done);
+
+  /**
+   * Change the tunables; applies to operations submitted from now on.
+   *  Returns an error message if the options make no sense.
+   */
+  const char *configure(const Options &options);
+  const Options &options() const { return m_options; }
+
+  /** Queue an operation, taking ownership of it. */
+  void submit(BatchOp *op);
+
+  struct Stats {
+    unsigned long long submitted, completed, batches;
+    /** Threadpool jobs the batches turned into. */
+    unsigned long long jobs;
+    /** Why batches got dispatched. */
+    unsigned long long fullFlushes, lateFlushes, turnFlushes;
+    unsigned long long largestBatch;
+    /** Operations waiting for the end of the turn, and large-lane backlog. */
+    unsigned int pending, largeQueued;
+  };
+  void stats(Stats *out) const;
+
+private:
+  BatchScheduler(const BatchScheduler &);
+  BatchScheduler &operator=(const BatchScheduler &);
+
+  struct Batch {
+    uv_work_t req;
+    BatchScheduler *owner;
+    unsigned int kind;
+    bool large;
+    std::vector<BatchOp *> ops;
+  };
+
+  /** Where a pending batch gets filed; `key` points into its first op. */
+  struct GroupKey {
+    bool large;
+    unsigned int kind;
+    const std::string *key;
+    bool operator<(const GroupKey &other) const;
+  };
+  typedef std::map<GroupKey, Batch *> PendingMap;
+
+  void arm();
+  void flushAll();
+  void dispatch(Batch *batch);
+  void schedule(Batch *batch);
+  void queue(Batch *batch);
+  void deliver(const std::vector<BatchOp *> &ops);
+
+  static void onCheck(uv_check_t *handle, int status);
+  static void onIdle(uv_idle_t *handle, int status);
+  static void onWork(uv_work_t *req);
+  static void onAfterWork(uv_work_t *req);
+
+  const Kind *m_kinds;
+  unsigned int m_nkinds;
+  DoneFunc m_done;
+  Options m_options;
+
+  bool m_handlesReady, m_armed;
+  uv_check_t m_check;
+  /** Only running so the loop doesn't block in poll before m_check fires. */
+  uv_idle_t m_idle;
+
+  PendingMap m_pending;
+  unsigned int m_pendingOps;
+  /** uv_hrtime() when the oldest pending operation was submitted. */
+  unsigned long long m_oldestPending;
+
+  /** Finished operations left over from a batch whose delivery threw. */
+  std::vector<BatchOp *> m_undelivered;
+
+  std::deque<Batch *> m_largeBacklog;
+  unsigned int m_largeRunning;
+
+  Stats m_stats;
+};
+
+#endif // NACL_NODE_BATCH_SCHEDULER_H
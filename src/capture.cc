@@ -0,0 +1,213 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "capture.h"
+
+const char *const CaptureOpNames[CAPTURE_OP_COUNT] = {
+  "(none)",
+  "randombytes",
+  "sign_keypair",
+  "sign",
+  "sign_utf8",
+  "sign_open",
+  "sign_open_utf8",
+  "sign_peek",
+  "sign_peek_utf8",
+  "box_keypair",
+  "box",
+  "box_utf8",
+  "box_open",
+  "box_open_utf8",
+  "box_random_nonce",
+  "secretbox",
+  "secretbox_utf8",
+  "secretbox_open",
+  "secretbox_open_utf8",
+  "secretbox_random_nonce",
+  "secretbox_random_key",
+  "auth",
+  "auth_utf8",
+  "auth_verify",
+  "auth_verify_utf8",
+  "auth_random_key",
+  "hash512_256",
+  "hash512_256_utf8",
+  "hash512_256_batch",
+  "stream_xsalsa20",
+  "stream_xsalsa20_xor",
+  "onetimeauth",
+  "onetimeauth_verify",
+  "Channel",
+  "Channel.push",
+  "Channel.seal",
+  "Channel.open",
+  "sign_open_async",
+  "box_open_async",
+  "secretbox_open_async",
+  "hash512_256_async",
+};
+
+bool CallCapture::capturing = false;
+CallCapture *CallCapture::current = NULL;
+
+static FILE *traceFile = NULL;
+static unsigned long long lastCallMicros = 0;
+static unsigned long long recordsWritten = 0;
+
+static unsigned long long
+now_micros()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void
+write_varint(FILE *f, unsigned long long v)
+{
+  do {
+    unsigned char b = v & 0x7f;
+    v >>= 7;
+    if (v)
+      b |= 0x80;
+    putc(b, f);
+  } while (v);
+}
+
+static bool
+read_varint(FILE *f, unsigned long long *v)
+{
+  *v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = getc(f);
+    if (c == EOF)
+      return false;
+    *v |= (unsigned long long) (c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool
+capture_start(const char *path)
+{
+  capture_stop();
+
+  traceFile = fopen(path, "wb");
+  if (!traceFile)
+    return false;
+  fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, traceFile);
+  lastCallMicros = now_micros();
+  recordsWritten = 0;
+  CallCapture::capturing = true;
+  return true;
+}
+
+unsigned long long
+capture_stop()
+{
+  CallCapture::capturing = false;
+  if (traceFile) {
+    fclose(traceFile);
+    traceFile = NULL;
+  }
+  return recordsWritten;
+}
+
+bool
+capture_read_header(FILE *f)
+{
+  char magic[CAPTURE_MAGIC_LEN];
+  return fread(magic, 1, CAPTURE_MAGIC_LEN, f) == CAPTURE_MAGIC_LEN &&
+         !memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN);
+}
+
+bool
+capture_read_record(FILE *f, CaptureRecord *rec)
+{
+  int op = getc(f), flags = getc(f), nargs = getc(f);
+  if (op == EOF || flags == EOF || nargs == EOF)
+    return false;
+  if (op <= CAPTURE_OP_NONE || op >= CAPTURE_OP_COUNT ||
+      nargs > CAPTURE_MAX_ARGS)
+    return false;
+
+  memset(rec, 0, sizeof(*rec));
+  rec->op = op;
+  rec->flags = flags;
+  rec->nargs = nargs;
+  if (!read_varint(f, &rec->deltaMicros))
+    return false;
+  for (int i = 0; i < nargs; i++) {
+    if (!read_varint(f, &rec->argSizes[i]))
+      return false;
+  }
+  return true;
+}
+
+void
+CallCapture::begin(CaptureOp op)
+{
+  unsigned long long now = now_micros();
+
+  memset(&m_record, 0, sizeof(m_record));
+  m_record.op = op;
+  m_record.deltaMicros = now > lastCallMicros ? now - lastCallMicros : 0;
+  lastCallMicros = now;
+  current = this;
+}
+
+void
+CallCapture::end()
+{
+  current = NULL;
+  // (capture_stop() may have been called in between; drop the record)
+  if (!traceFile)
+    return;
+
+  putc(m_record.op, traceFile);
+  putc(m_record.flags, traceFile);
+  putc(m_record.nargs, traceFile);
+  write_varint(traceFile, m_record.deltaMicros);
+  for (int i = 0; i < m_record.nargs; i++)
+    write_varint(traceFile, m_record.argSizes[i]);
+  recordsWritten++;
+}
@@ -0,0 +1,210 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NACL_NODE_CAPTURE_H
+#define NACL_NODE_CAPTURE_H
+
+#include <stdio.h>
+
+/**
+ * Workload capture.  While a capture is running every binding call appends a
+ *  compact record to a trace file: which function was called, how big each of
+ *  its arguments were, how long it had been since the previous call, and
+ *  whether it threw.  No key material or payload bytes are ever written; the
+ *  replay driver (tools/nacl_replay.cc) synthesizes inputs of the recorded
+ *  sizes.
+ *
+ * Trace format:
+ *   8-byte magic "NACLTRC1", then a sequence of records:
+ *     u8     op (CaptureOp)
+ *     u8     flags (CAPTURE_FLAG_*)
+ *     u8     nargs
+ *     varint microseconds since the previous record started
+ *     varint size of each argument, nargs of them
+ *   varints are unsigned LEB128.
+ *
+ * Capture only ever happens on the main thread, so none of this is locked.
+ */
+
+#define CAPTURE_MAGIC "NACLTRC1"
+#define CAPTURE_MAGIC_LEN 8
+#define CAPTURE_MAX_ARGS 6
+
+#define CAPTURE_FLAG_THREW 0x1
+
+/**
+ * Never renumber these; traces outlive builds.  Add new ops at the end.
+ */
+enum CaptureOp {
+  CAPTURE_OP_NONE = 0,
+  CAPTURE_OP_RANDOMBYTES,
+  CAPTURE_OP_SIGN_KEYPAIR,
+  CAPTURE_OP_SIGN,
+  CAPTURE_OP_SIGN_UTF8,
+  CAPTURE_OP_SIGN_OPEN,
+  CAPTURE_OP_SIGN_OPEN_UTF8,
+  CAPTURE_OP_SIGN_PEEK,
+  CAPTURE_OP_SIGN_PEEK_UTF8,
+  CAPTURE_OP_BOX_KEYPAIR,
+  CAPTURE_OP_BOX,
+  CAPTURE_OP_BOX_UTF8,
+  CAPTURE_OP_BOX_OPEN,
+  CAPTURE_OP_BOX_OPEN_UTF8,
+  CAPTURE_OP_BOX_RANDOM_NONCE,
+  CAPTURE_OP_SECRETBOX,
+  CAPTURE_OP_SECRETBOX_UTF8,
+  CAPTURE_OP_SECRETBOX_OPEN,
+  CAPTURE_OP_SECRETBOX_OPEN_UTF8,
+  CAPTURE_OP_SECRETBOX_RANDOM_NONCE,
+  CAPTURE_OP_SECRETBOX_RANDOM_KEY,
+  CAPTURE_OP_AUTH,
+  CAPTURE_OP_AUTH_UTF8,
+  CAPTURE_OP_AUTH_VERIFY,
+  CAPTURE_OP_AUTH_VERIFY_UTF8,
+  CAPTURE_OP_AUTH_RANDOM_KEY,
+  CAPTURE_OP_HASH512_256,
+  CAPTURE_OP_HASH512_256_UTF8,
+  /** args: total message bytes, message count */
+  CAPTURE_OP_HASH512_256_BATCH,
+  CAPTURE_OP_STREAM_XSALSA20,
+  /** args: range length, offset, length, nonce, key, counter */
+  CAPTURE_OP_STREAM_XSALSA20_XOR,
+  /** args: range length, offset, length, key */
+  CAPTURE_OP_ONETIMEAUTH,
+  /** args: authenticator, range length, offset, length, key */
+  CAPTURE_OP_ONETIMEAUTH_VERIFY,
+  /** args: secret key, public key */
+  CAPTURE_OP_CHANNEL_NEW,
+  /** args: message */
+  CAPTURE_OP_CHANNEL_PUSH,
+  /** args: message (0 if only the queue was sealed) */
+  CAPTURE_OP_CHANNEL_SEAL,
+  /** args: record */
+  CAPTURE_OP_CHANNEL_OPEN,
+  /**
+   * The batched async calls record their arguments like their synchronous
+   *  counterparts (minus the callback).  Failures reported to the callback
+   *  rather than thrown aren't flagged.
+   */
+  CAPTURE_OP_SIGN_OPEN_ASYNC,
+  CAPTURE_OP_BOX_OPEN_ASYNC,
+  CAPTURE_OP_SECRETBOX_OPEN_ASYNC,
+  CAPTURE_OP_HASH512_256_ASYNC,
+  CAPTURE_OP_COUNT
+};
+
+/** The JS-visible name of each op, for reports. */
+extern const char *const CaptureOpNames[CAPTURE_OP_COUNT];
+
+struct CaptureRecord {
+  unsigned char op;
+  unsigned char flags;
+  unsigned char nargs;
+  unsigned long long deltaMicros;
+  unsigned long long argSizes[CAPTURE_MAX_ARGS];
+};
+
+/**
+ * Start writing a trace to `path`, replacing any capture in progress.
+ *  Returns false if the file could not be opened.
+ */
+bool capture_start(const char *path);
+
+/**
+ * Stop capturing and close the trace.  Returns the number of records written.
+ */
+unsigned long long capture_stop();
+
+/**
+ * Check the magic at the start of a trace.
+ */
+bool capture_read_header(FILE *f);
+
+/**
+ * Read the next record.  Returns false at the end of the trace or if the
+ *  trace is truncated/corrupt.
+ */
+bool capture_read_record(FILE *f, CaptureRecord *rec);
+
+/**
+ * Declared at the top of each binding function; if a capture is running, the
+ *  record for the call gets written when it goes out of scope.  The binding
+ *  layer (nacl_binding.h) reports argument sizes and failures via the static
+ *  helpers, which do nothing when there is no call being captured.
+ */
+class CallCapture {
+public:
+  explicit CallCapture(CaptureOp op)
+    : m_active(capturing && !current) // (nested calls aren't recorded)
+  {
+    if (m_active)
+      begin(op);
+  }
+  ~CallCapture()
+  {
+    if (m_active)
+      end();
+  }
+
+  static void noteArgSize(int narg, unsigned long long size)
+  {
+    if (current && narg < CAPTURE_MAX_ARGS) {
+      current->m_record.argSizes[narg] = size;
+      if (narg >= current->m_record.nargs)
+        current->m_record.nargs = narg + 1;
+    }
+  }
+
+  static void noteFailure()
+  {
+    if (current)
+      current->m_record.flags |= CAPTURE_FLAG_THREW;
+  }
+
+  static bool capturing;
+
+private:
+  void begin(CaptureOp op);
+  void end();
+
+  static CallCapture *current;
+
+  bool m_active;
+  CaptureRecord m_record;
+};
+
+#endif // NACL_NODE_CAPTURE_H
@@ -0,0 +1,556 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <string.h>
+
+#include "crypto_box.h"
+#include "crypto_hash_sha512.h"
+#include "crypto_onetimeauth.h"
+#include "crypto_scalarmult_curve25519.h"
+#include "crypto_stream_xsalsa20.h"
+#include "randombytes.h"
+
+#include "channel.h"
+#include "stream_xsalsa20_ic.h"
+
+#define FRAGMENT_MORE      0x80000000U
+#define FRAGMENT_CONTINUED 0x40000000U
+#define FRAGMENT_LEN_MASK  0x3fffffffU
+
+// hash inputs get one of these in front so the derivations can't collide
+static const unsigned char DIRECTION_LABEL[] = "nacl channel direction keys";
+static const unsigned char RATCHET_LABEL[] = "nacl channel rekey";
+
+static void
+put_u32(unsigned char *p, unsigned int v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static unsigned int
+get_u32(const unsigned char *p)
+{
+  return (static_cast<unsigned int>(p[0]) << 24) |
+         (static_cast<unsigned int>(p[1]) << 16) |
+         (static_cast<unsigned int>(p[2]) << 8) | p[3];
+}
+
+static void
+put_u64(unsigned char *p, unsigned long long v)
+{
+  put_u32(p, static_cast<unsigned int>(v >> 32));
+  put_u32(p + 4, static_cast<unsigned int>(v));
+}
+
+static unsigned long long
+get_u64(const unsigned char *p)
+{
+  return (static_cast<unsigned long long>(get_u32(p)) << 32) | get_u32(p + 4);
+}
+
+/** epoch || sequence number || zeroes; the header bytes, in other words. */
+static void
+make_nonce(unsigned char *n, unsigned int epoch, unsigned long long seq)
+{
+  memset(n, 0, crypto_stream_xsalsa20_NONCEBYTES);
+  put_u32(n, epoch);
+  put_u64(n + 4, seq);
+}
+
+/** Replace `key` with the next key in its chain. */
+static void
+ratchet(unsigned char *key)
+{
+  unsigned char in[sizeof(RATCHET_LABEL) + CHANNEL_KEYBYTES];
+  unsigned char h[crypto_hash_sha512_BYTES];
+
+  memcpy(in, RATCHET_LABEL, sizeof(RATCHET_LABEL));
+  memcpy(in + sizeof(RATCHET_LABEL), key, CHANNEL_KEYBYTES);
+  crypto_hash_sha512(h, in, sizeof(in));
+  memcpy(key, h, CHANNEL_KEYBYTES);
+  memset(in, 0, sizeof(in));
+  memset(h, 0, sizeof(h));
+}
+
+/**
+ * The first keystream block: its first half is the poly1305 key, its second
+ *  half covers the first 32 payload bytes (just like secretbox's padding).
+ */
+static void
+first_block(unsigned char *block, const unsigned char *n,
+            const unsigned char *key)
+{
+  crypto_stream_xsalsa20(block, 64, n, key);
+}
+
+/** XOR the keystream (from byte 32 on) over `len` bytes in place. */
+static void
+xor_payload(unsigned char *p, size_t len, const unsigned char *block,
+            const unsigned char *n, const unsigned char *key)
+{
+  size_t head = len < 32 ? len : 32;
+  for (size_t i = 0; i < head; i++)
+    p[i] ^= block[32 + i];
+  if (len > head)
+    stream_xsalsa20_xor_ic(p + head, p + head, len - head, n, 1, key);
+}
+
+SecureChannel::Options::Options()
+  : maxRecordBytes(16384),
+    rekeyRecords(1 << 20),
+    maxMessageBytes(16 << 20)
+{
+}
+
+SecureChannel::SecureChannel()
+  : m_ready(false), m_haveShared(false),
+    m_sendEpoch(0), m_sendSeq(0), m_sendEpochRecords(0),
+    m_haveRecvPrev(false), m_recvEpoch(0),
+    m_recvAny(false), m_recvHighest(0), m_recvWindow(0),
+    m_partialActive(false), m_partialNextSeq(0),
+    m_queuedBytes(0)
+{
+  memset(m_shared, 0, sizeof(m_shared));
+  memset(m_hello, 0, sizeof(m_hello));
+  memset(m_sendKey, 0, sizeof(m_sendKey));
+  memset(m_recvKey, 0, sizeof(m_recvKey));
+  memset(m_recvPrevKey, 0, sizeof(m_recvPrevKey));
+  memset(&m_stats, 0, sizeof(m_stats));
+}
+
+SecureChannel::~SecureChannel()
+{
+  memset(m_shared, 0, sizeof(m_shared));
+  memset(m_sendKey, 0, sizeof(m_sendKey));
+  memset(m_recvKey, 0, sizeof(m_recvKey));
+  memset(m_recvPrevKey, 0, sizeof(m_recvPrevKey));
+  if (!m_plain.empty())
+    memset(&m_plain[0], 0, m_plain.size());
+}
+
+const char *
+SecureChannel::init(const unsigned char *sk, const unsigned char *theirPk,
+                    const Options &options)
+{
+  if (options.maxRecordBytes < CHANNEL_MIN_RECORD_BYTES ||
+      options.maxRecordBytes > CHANNEL_MAX_RECORD_BYTES)
+    return "maxRecordBytes is out of range";
+  if (m_haveShared || m_ready)
+    return "the channel already has its keys";
+
+  crypto_scalarmult_curve25519_base(m_ourPk, sk);
+  if (!memcmp(m_ourPk, theirPk, crypto_box_PUBLICKEYBYTES))
+    return "a channel needs two different keypairs";
+  memcpy(m_theirPk, theirPk, crypto_box_PUBLICKEYBYTES);
+  crypto_box_beforenm(m_shared, theirPk, sk);
+
+  put_u32(m_hello, CHANNEL_HELLO_BYTES);
+  randombytes(m_hello + 4, CHANNEL_SALT_BYTES);
+
+  m_options = options;
+  m_haveShared = true;
+  return NULL;
+}
+
+const char *
+SecureChannel::accept(const unsigned char *theirHello, size_t len)
+{
+  if (m_ready)
+    return "the channel already has its keys";
+  if (!m_haveShared)
+    return "the channel has no keys";
+  if (len != CHANNEL_HELLO_BYTES || get_u32(theirHello) != len)
+    return "hello is malformed";
+  if (!memcmp(theirHello, m_hello, CHANNEL_HELLO_BYTES))
+    return "hello is our own";
+
+  // sha512(label || shared key || lower public key || higher public key ||
+  //        lower's salt || higher's salt), whose halves are the keys for
+  //  lower->higher and higher->lower
+  int order = memcmp(m_ourPk, m_theirPk, crypto_box_PUBLICKEYBYTES);
+  const unsigned char *ourSalt = m_hello + 4, *theirSalt = theirHello + 4;
+  unsigned char in[sizeof(DIRECTION_LABEL) + crypto_box_BEFORENMBYTES +
+                   2 * crypto_box_PUBLICKEYBYTES + 2 * CHANNEL_SALT_BYTES];
+  unsigned char *p = in;
+  memcpy(p, DIRECTION_LABEL, sizeof(DIRECTION_LABEL));
+  p += sizeof(DIRECTION_LABEL);
+  memcpy(p, m_shared, crypto_box_BEFORENMBYTES);
+  p += crypto_box_BEFORENMBYTES;
+  memcpy(p, order < 0 ? m_ourPk : m_theirPk, crypto_box_PUBLICKEYBYTES);
+  p += crypto_box_PUBLICKEYBYTES;
+  memcpy(p, order < 0 ? m_theirPk : m_ourPk, crypto_box_PUBLICKEYBYTES);
+  p += crypto_box_PUBLICKEYBYTES;
+  memcpy(p, order < 0 ? ourSalt : theirSalt, CHANNEL_SALT_BYTES);
+  p += CHANNEL_SALT_BYTES;
+  memcpy(p, order < 0 ? theirSalt : ourSalt, CHANNEL_SALT_BYTES);
+
+  unsigned char h[crypto_hash_sha512_BYTES];
+  crypto_hash_sha512(h, in, sizeof(in));
+  memcpy(m_sendKey, order < 0 ? h : h + CHANNEL_KEYBYTES, CHANNEL_KEYBYTES);
+  memcpy(m_recvKey, order < 0 ? h + CHANNEL_KEYBYTES : h, CHANNEL_KEYBYTES);
+  memset(in, 0, sizeof(in));
+  memset(h, 0, sizeof(h));
+  memset(m_shared, 0, sizeof(m_shared));
+
+  m_haveShared = false;
+  m_ready = true;
+  return NULL;
+}
+
+void
+SecureChannel::queue(const unsigned char *m, size_t len)
+{
+  m_queue.push_back(std::string(reinterpret_cast<const char *>(m), len));
+  m_queuedBytes += len;
+}
+
+/**
+ * Lay out the next record's payload starting at `cur`, advancing it.  With a
+ *  NULL `payload` this only measures.  Returns the payload length.
+ */
+size_t
+SecureChannel::layout(const std::vector<Span> &msgs, Cursor *cur,
+                      unsigned char *payload) const
+{
+  size_t used = 0;
+  while (cur->msg < msgs.size()) {
+    const Span &msg = msgs[cur->msg];
+    size_t room = m_options.maxRecordBytes - used;
+    size_t left = msg.len - cur->offset;
+    if (room < CHANNEL_FRAGMENT_HEADER_BYTES ||
+        (room == CHANNEL_FRAGMENT_HEADER_BYTES && left))
+      break;
+
+    size_t take = left < room - CHANNEL_FRAGMENT_HEADER_BYTES ?
+                  left : room - CHANNEL_FRAGMENT_HEADER_BYTES;
+    if (payload) {
+      unsigned int header = static_cast<unsigned int>(take);
+      if (take < left)
+        header |= FRAGMENT_MORE;
+      if (cur->offset)
+        header |= FRAGMENT_CONTINUED;
+      put_u32(payload + used, header);
+      memcpy(payload + used + CHANNEL_FRAGMENT_HEADER_BYTES,
+             msg.data + cur->offset, take);
+    }
+    used += CHANNEL_FRAGMENT_HEADER_BYTES + take;
+
+    if (take < left) {
+      // the record is full; the rest of this message goes in the next one
+      cur->offset += take;
+      break;
+    }
+    cur->msg++;
+    cur->offset = 0;
+  }
+  return used;
+}
+
+const char *
+SecureChannel::seal(AllocFunc alloc, void *ctx,
+                    const unsigned char *extra, size_t extraLen)
+{
+  if (!m_ready)
+    return "the channel has not had the peer's hello";
+
+  std::vector<Span> msgs(m_queue.size());
+  for (size_t i = 0; i < m_queue.size(); i++) {
+    msgs[i].data = reinterpret_cast<const unsigned char *>(m_queue[i].data());
+    msgs[i].len = m_queue[i].size();
+  }
+  if (extra) {
+    Span span = { extra, extraLen };
+    msgs.push_back(span);
+  }
+
+  Cursor cur = { 0, 0 };
+  while (cur.msg < msgs.size()) {
+    if (m_sendSeq == ~0ULL)
+      return "the channel has used up its sequence numbers";
+    if (m_options.rekeyRecords &&
+        m_sendEpochRecords >= m_options.rekeyRecords)
+      rekey();
+
+    Cursor next = cur;
+    size_t payloadLen = layout(msgs, &next, NULL);
+    size_t recLen = CHANNEL_RECORD_OVERHEAD + payloadLen;
+    unsigned char *rec = alloc(ctx, recLen);
+    unsigned char *payload = rec + CHANNEL_RECORD_OVERHEAD;
+    layout(msgs, &cur, payload);
+
+    unsigned char n[crypto_stream_xsalsa20_NONCEBYTES];
+    unsigned char block[64];
+    make_nonce(n, m_sendEpoch, m_sendSeq);
+    first_block(block, n, m_sendKey);
+    xor_payload(payload, payloadLen, block, n, m_sendKey);
+    crypto_onetimeauth(rec + CHANNEL_HEADER_BYTES, payload, payloadLen, block);
+    memset(block, 0, sizeof(block));
+
+    put_u32(rec, static_cast<unsigned int>(recLen));
+    put_u32(rec + 4, m_sendEpoch);
+    put_u64(rec + 8, m_sendSeq);
+
+    m_sendSeq++;
+    m_sendEpochRecords++;
+    m_stats.recordsSealed++;
+    m_stats.bytesSealed += payloadLen;
+  }
+
+  m_stats.messagesSealed += msgs.size();
+  m_queue.clear();
+  m_queuedBytes = 0;
+  return NULL;
+}
+
+const char *
+SecureChannel::open(const unsigned char *rec, size_t len,
+                    DeliverFunc deliver, void *ctx)
+{
+  if (!m_ready)
+    return "the channel has not had the peer's hello";
+  if (len < CHANNEL_RECORD_OVERHEAD) {
+    m_stats.failures++;
+    return "record is too short";
+  }
+  if (get_u32(rec) != len) {
+    m_stats.failures++;
+    return "record length does not match its header";
+  }
+  unsigned int epoch = get_u32(rec + 4);
+  unsigned long long seq = get_u64(rec + 8);
+
+  // - replay window (checked again implicitly by the MAC: seq is the nonce)
+  if (m_recvAny) {
+    if (seq <= m_recvHighest &&
+        (m_recvHighest - seq >= CHANNEL_REPLAY_WINDOW ||
+         (m_recvWindow >> (m_recvHighest - seq)) & 1)) {
+      m_stats.replaysRejected++;
+      return "record was replayed or is too old";
+    }
+  }
+
+  // - pick (or ratchet forward to) the key for the record's epoch
+  unsigned char key[CHANNEL_KEYBYTES], prevKey[CHANNEL_KEYBYTES];
+  if (epoch == m_recvEpoch)
+    memcpy(key, m_recvKey, CHANNEL_KEYBYTES);
+  else if (epoch + 1 == m_recvEpoch && m_haveRecvPrev)
+    memcpy(key, m_recvPrevKey, CHANNEL_KEYBYTES);
+  else if (epoch > m_recvEpoch) {
+    if (epoch - m_recvEpoch > CHANNEL_MAX_EPOCH_SKIP) {
+      m_stats.failures++;
+      return "record epoch is too far ahead";
+    }
+    memcpy(key, m_recvKey, CHANNEL_KEYBYTES);
+    for (unsigned int e = m_recvEpoch; e < epoch; e++) {
+      memcpy(prevKey, key, CHANNEL_KEYBYTES);
+      ratchet(key);
+    }
+  }
+  else {
+    m_stats.failures++;
+    return "record epoch has expired";
+  }
+
+  // - authenticate, then decrypt into our scratch
+  size_t payloadLen = len - CHANNEL_RECORD_OVERHEAD;
+  unsigned char n[crypto_stream_xsalsa20_NONCEBYTES];
+  unsigned char block[64];
+  make_nonce(n, epoch, seq);
+  first_block(block, n, key);
+  if (crypto_onetimeauth_verify(rec + CHANNEL_HEADER_BYTES,
+                                rec + CHANNEL_RECORD_OVERHEAD, payloadLen,
+                                block) != 0) {
+    memset(block, 0, sizeof(block));
+    memset(key, 0, sizeof(key));
+    memset(prevKey, 0, sizeof(prevKey));
+    m_stats.failures++;
+    return "record fails verification";
+  }
+
+  if (m_plain.size() < payloadLen)
+    m_plain.resize(payloadLen);
+  unsigned char *plain = payloadLen ? &m_plain[0] : NULL;
+  if (payloadLen)
+    memcpy(plain, rec + CHANNEL_RECORD_OVERHEAD, payloadLen);
+  xor_payload(plain, payloadLen, block, n, key);
+  memset(block, 0, sizeof(block));
+
+  // - it's genuine, but make sure we can take everything in it before we
+  //  commit to having seen it
+  if (const char *err = walkFragments(plain, payloadLen, seq, NULL, NULL)) {
+    memset(plain, 0, payloadLen);
+    memset(key, 0, sizeof(key));
+    memset(prevKey, 0, sizeof(prevKey));
+    m_stats.failures++;
+    return err;
+  }
+
+  // - commit the epoch and the window
+  if (epoch > m_recvEpoch) {
+    memcpy(m_recvPrevKey, prevKey, CHANNEL_KEYBYTES);
+    memcpy(m_recvKey, key, CHANNEL_KEYBYTES);
+    m_haveRecvPrev = true;
+    m_recvEpoch = epoch;
+  }
+  memset(key, 0, sizeof(key));
+  memset(prevKey, 0, sizeof(prevKey));
+
+  if (!m_recvAny) {
+    m_recvAny = true;
+    m_recvHighest = seq;
+    m_recvWindow = 1;
+  }
+  else if (seq > m_recvHighest) {
+    unsigned long long shift = seq - m_recvHighest;
+    m_recvWindow = shift >= CHANNEL_REPLAY_WINDOW ? 0 : m_recvWindow << shift;
+    m_recvWindow |= 1;
+    m_recvHighest = seq;
+  }
+  else {
+    m_recvWindow |= 1ULL << (m_recvHighest - seq);
+  }
+
+  m_stats.recordsOpened++;
+  m_stats.bytesOpened += payloadLen;
+  walkFragments(plain, payloadLen, seq, deliver, ctx);
+  return NULL;
+}
+
+/**
+ * Walk a decrypted payload, handing over each message it completes.  With a
+ *  NULL `deliver` this only checks that the whole payload can be taken,
+ *  touching nothing; open() does that first so that delivering can't fail
+ *  halfway through a record.
+ */
+const char *
+SecureChannel::walkFragments(const unsigned char *p, size_t len,
+                             unsigned long long seq,
+                             DeliverFunc deliver, void *ctx)
+{
+  // (the partial message state, as it would be after each fragment)
+  bool partialActive = m_partialActive;
+  size_t partialLen = m_partial.size();
+
+  size_t at = 0;
+  while (at < len) {
+    if (len - at < CHANNEL_FRAGMENT_HEADER_BYTES)
+      return "record has a malformed fragment";
+    unsigned int header = get_u32(p + at);
+    size_t fragLen = header & FRAGMENT_LEN_MASK;
+    at += CHANNEL_FRAGMENT_HEADER_BYTES;
+    if (fragLen > len - at)
+      return "record has a malformed fragment";
+    const unsigned char *frag = p + at;
+    at += fragLen;
+
+    bool more = header & FRAGMENT_MORE;
+    if (more && at != len)
+      return "record has a malformed fragment";
+
+    bool drop = false;
+    if (header & FRAGMENT_CONTINUED) {
+      // only picks up where we left off if nothing went missing in between
+      drop = !partialActive ||
+             (at - fragLen == CHANNEL_FRAGMENT_HEADER_BYTES &&
+              seq != m_partialNextSeq);
+    }
+    else {
+      // a new message while one was unfinished: the rest of it never came
+      drop = partialActive;
+    }
+    if (drop) {
+      partialActive = false;
+      partialLen = 0;
+      if (deliver)
+        m_partial.clear();
+      if (header & FRAGMENT_CONTINUED)
+        continue;
+    }
+
+    if (!more && !partialActive) {
+      if (deliver) {
+        m_stats.messagesOpened++;
+        deliver(ctx, frag, fragLen);
+      }
+      continue;
+    }
+
+    if (partialLen + fragLen > m_options.maxMessageBytes)
+      return "message is bigger than maxMessageBytes";
+    if (deliver)
+      m_partial.append(reinterpret_cast<const char *>(frag), fragLen);
+    if (more) {
+      partialActive = true;
+      partialLen += fragLen;
+      if (deliver)
+        m_partialNextSeq = seq + 1;
+      continue;
+    }
+
+    partialActive = false;
+    partialLen = 0;
+    if (deliver) {
+      m_stats.messagesOpened++;
+      deliver(ctx, reinterpret_cast<const unsigned char *>(m_partial.data()),
+              m_partial.size());
+      m_partial.clear();
+    }
+  }
+  if (deliver)
+    m_partialActive = partialActive;
+  return NULL;
+}
+
+void
+SecureChannel::rekey()
+{
+  ratchet(m_sendKey);
+  m_sendEpoch++;
+  m_sendEpochRecords = 0;
+}
+
+void
+SecureChannel::stats(Stats *out) const
+{
+  *out = m_stats;
+  out->sendEpoch = m_sendEpoch;
+  out->recvEpoch = m_recvEpoch;
+  out->queuedBytes = m_queuedBytes;
+}
@@ -0,0 +1,230 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NACL_NODE_CHANNEL_H
+#define NACL_NODE_CHANNEL_H
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "crypto_box.h"
+
+/**
+ * A duplex secure channel between two box keypairs, for transports that
+ *  would otherwise box every message under a fresh random nonce.
+ *
+ * Each end starts by sending the other a hello: a u32 length and 32 fresh
+ *  random bytes.  Both ends run crypto_box_beforenm once and hash the shared
+ *  key, both public keys and both hellos into one secretbox key per
+ *  direction.  The same two keypairs therefore get new keys for every
+ *  session, so the counter nonces below never repeat under one key, and
+ *  records from an old session don't open in a new one.  Records are then
+ *  secretboxed under an implicit nonce built from the sender's epoch and a
+ *  64-bit record counter, so there is no randombytes call per record and only
+ *  12 bytes of nonce material on the wire.  The sender ratchets its key
+ *  forward every `rekeyRecords` records (or on request) and wipes the old one.
+ *
+ * Record format (all integers big-endian):
+ *   u32  total record length, this header included
+ *   u32  epoch
+ *   u64  sequence number (never reused, across epochs too)
+ *   16   poly1305 authenticator
+ *   ...  payload, xsalsa20-encrypted
+ *  which is to say a header followed by exactly what crypto_secretbox would
+ *  produce (minus its 16 leading zero bytes) for the payload, key and
+ *  nonce = epoch || sequence number || 12 zero bytes.
+ *
+ * The payload is a run of message fragments, each a u32 header (bit 31: the
+ *  message continues in the next fragment, bit 30: this fragment continues
+ *  the previous one, the rest: length) and that many bytes.  Small messages
+ *  get coalesced into one record; big ones get split over several.  Split
+ *  messages only reassemble if their records are opened in order; anything
+ *  can be reordered within the replay window otherwise.
+ *
+ * Not thread-safe; one channel belongs to one thread.
+ */
+
+/** The record header: length, epoch, sequence number. */
+#define CHANNEL_HEADER_BYTES 16
+/** Everything in front of the payload: the header and the authenticator. */
+#define CHANNEL_RECORD_OVERHEAD 32
+#define CHANNEL_FRAGMENT_HEADER_BYTES 4
+/** How far behind the newest record an older one can still arrive. */
+#define CHANNEL_REPLAY_WINDOW 64
+/** How many epochs a receiver will ratchet forward to catch up. */
+#define CHANNEL_MAX_EPOCH_SKIP 64
+
+#define CHANNEL_KEYBYTES 32
+/** The hello: its length as a u32, then the per-session random bytes. */
+#define CHANNEL_HELLO_BYTES 36
+#define CHANNEL_SALT_BYTES 32
+
+/** Bounds for Options::maxRecordBytes. */
+#define CHANNEL_MIN_RECORD_BYTES 64
+#define CHANNEL_MAX_RECORD_BYTES (1 << 24)
+
+class SecureChannel {
+public:
+  struct Options {
+    Options();
+
+    /** Payload bytes per record, fragment headers included. */
+    unsigned int maxRecordBytes;
+    /** Records to send under one key before ratcheting; 0 never does. */
+    unsigned long long rekeyRecords;
+    /** The largest message a peer may reassemble out of fragments. */
+    unsigned int maxMessageBytes;
+  };
+
+  struct Stats {
+    unsigned long long recordsSealed, messagesSealed, bytesSealed;
+    unsigned long long recordsOpened, messagesOpened, bytesOpened;
+    unsigned long long replaysRejected, failures;
+    unsigned int sendEpoch, recvEpoch;
+    size_t queuedBytes;
+  };
+
+  /** Hands back room for a sealed record of `len` bytes. */
+  typedef unsigned char *(*AllocFunc)(void *ctx, size_t len);
+  /** Receives each complete message as soon as its last fragment is in. */
+  typedef void (*DeliverFunc)(void *ctx, const unsigned char *m, size_t len);
+
+  SecureChannel();
+  ~SecureChannel();
+
+  /**
+   * Work out the shared key from our box secret key and the peer's public
+   *  key, and pick our hello.  The channel can't seal or open anything until
+   *  accept() has the peer's hello.  Returns an error message, or NULL on
+   *  success.
+   */
+  const char *init(const unsigned char *sk, const unsigned char *theirPk,
+                   const Options &options);
+
+  /** Our CHANNEL_HELLO_BYTES of hello, for the peer's accept(). */
+  const unsigned char *hello() const { return m_hello; }
+
+  /**
+   * Take the peer's hello and derive the directional keys.  Only once per
+   *  channel.  Returns an error message, or NULL on success.
+   */
+  const char *accept(const unsigned char *theirHello, size_t len);
+
+  /** Copy a message onto the queue for the next seal(). */
+  void queue(const unsigned char *m, size_t len);
+  size_t queuedBytes() const { return m_queuedBytes; }
+
+  /**
+   * Seal everything queued, followed by `extra` if it's non-NULL (which does
+   *  not get copied first), into as few records as maxRecordBytes allows.
+   *  Each record is written straight into the space `alloc` returns.
+   *  Returns an error message, or NULL on success.
+   */
+  const char *seal(AllocFunc alloc, void *ctx,
+                   const unsigned char *extra = NULL, size_t extraLen = 0);
+
+  /**
+   * Authenticate and decrypt one whole record, passing any messages it
+   *  completes to `deliver`.  Nothing changes (and nothing gets delivered)
+   *  unless the record verifies and all its fragments are acceptable.
+   *  Returns an error message, or NULL on success.
+   */
+  const char *open(const unsigned char *rec, size_t len,
+                   DeliverFunc deliver, void *ctx);
+
+  /** Ratchet the sending key forward before the next record. */
+  void rekey();
+
+  void stats(Stats *out) const;
+
+private:
+  SecureChannel(const SecureChannel &);
+  SecureChannel &operator=(const SecureChannel &);
+
+  struct Span {
+    const unsigned char *data;
+    size_t len;
+  };
+  /** Where seal() has got to: which message, and how far into it. */
+  struct Cursor {
+    size_t msg, offset;
+  };
+
+  size_t layout(const std::vector<Span> &msgs, Cursor *cur,
+                unsigned char *payload) const;
+  const char *walkFragments(const unsigned char *p, size_t len,
+                            unsigned long long seq,
+                            DeliverFunc deliver, void *ctx);
+
+  Options m_options;
+  bool m_ready;
+
+  // what accept() needs; m_shared is wiped once the keys are derived
+  bool m_haveShared;
+  unsigned char m_shared[crypto_box_BEFORENMBYTES];
+  unsigned char m_ourPk[crypto_box_PUBLICKEYBYTES];
+  unsigned char m_theirPk[crypto_box_PUBLICKEYBYTES];
+  unsigned char m_hello[CHANNEL_HELLO_BYTES];
+
+  unsigned char m_sendKey[CHANNEL_KEYBYTES];
+  unsigned int m_sendEpoch;
+  unsigned long long m_sendSeq, m_sendEpochRecords;
+
+  unsigned char m_recvKey[CHANNEL_KEYBYTES];
+  unsigned char m_recvPrevKey[CHANNEL_KEYBYTES];
+  bool m_haveRecvPrev;
+  unsigned int m_recvEpoch;
+
+  // replay window: bit i of m_recvWindow is m_recvHighest - i
+  bool m_recvAny;
+  unsigned long long m_recvHighest, m_recvWindow;
+
+  // a split message being put back together
+  bool m_partialActive;
+  unsigned long long m_partialNextSeq;
+  std::string m_partial;
+
+  std::vector<std::string> m_queue;
+  size_t m_queuedBytes;
+  std::vector<unsigned char> m_plain;
+
+  Stats m_stats;
+};
+
+#endif // NACL_NODE_CHANNEL_H
@@ -0,0 +1,473 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "codec.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSSE3_KERNELS 1
+#include <immintrin.h>
+#endif
+
+static const char HexDigits[] = "0123456789abcdef";
+
+/** What distinguishes the two base64 alphabets. */
+struct Base64Alphabet {
+  char chars[65];
+  bool pad;
+};
+
+static const Base64Alphabet Base64 = {
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/", true
+};
+static const Base64Alphabet Base64Url = {
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_", false
+};
+
+/** Bit 7 set for characters that are not in the alphabet. */
+#define CODEC_INVALID 0xff
+
+/**
+ * Character -> value tables for the scalar decoders, built at load time.
+ */
+static struct DecodeTables {
+  unsigned char hex[256];
+  unsigned char base64[256];
+  unsigned char base64url[256];
+
+  DecodeTables()
+  {
+    memset(hex, CODEC_INVALID, sizeof(hex));
+    memset(base64, CODEC_INVALID, sizeof(base64));
+    memset(base64url, CODEC_INVALID, sizeof(base64url));
+    for (int i = 0; i < 16; i++) {
+      hex[static_cast<unsigned char>(HexDigits[i])] = i;
+      if (i >= 10)
+        hex[static_cast<unsigned char>(HexDigits[i] - 'a' + 'A')] = i;
+    }
+    for (int i = 0; i < 64; i++) {
+      base64[static_cast<unsigned char>(Base64.chars[i])] = i;
+      base64url[static_cast<unsigned char>(Base64Url.chars[i])] = i;
+    }
+  }
+} Tables;
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalar
+
+static void
+hex_encode_scalar(char *out, const unsigned char *in, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    out[2 * i] = HexDigits[in[i] >> 4];
+    out[2 * i + 1] = HexDigits[in[i] & 0xf];
+  }
+}
+
+static bool
+hex_decode_scalar(unsigned char *out, const char *in, size_t len)
+{
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(in);
+  unsigned char bad = 0;
+  for (size_t i = 0; i < len / 2; i++) {
+    unsigned char hi = Tables.hex[s[2 * i]], lo = Tables.hex[s[2 * i + 1]];
+    bad |= hi | lo;
+    out[i] = (hi << 4) | (lo & 0xf);
+  }
+  return !(bad & 0x80);
+}
+
+static void
+base64_encode_scalar(char *out, const unsigned char *in, size_t len,
+                     const Base64Alphabet &alphabet)
+{
+  const char *chars = alphabet.chars;
+  size_t i = 0;
+  for (; i + 3 <= len; i += 3, out += 4) {
+    uint32_t v = in[i] << 16 | in[i + 1] << 8 | in[i + 2];
+    out[0] = chars[v >> 18];
+    out[1] = chars[(v >> 12) & 0x3f];
+    out[2] = chars[(v >> 6) & 0x3f];
+    out[3] = chars[v & 0x3f];
+  }
+  if (i == len)
+    return;
+
+  uint32_t v = in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0);
+  out[0] = chars[v >> 18];
+  out[1] = chars[(v >> 12) & 0x3f];
+  if (i + 1 < len)
+    out[2] = chars[(v >> 6) & 0x3f];
+  else if (alphabet.pad)
+    out[2] = '=';
+  if (alphabet.pad)
+    out[3] = '=';
+}
+
+/**
+ * Decode whole 4-character groups.
+ */
+static bool
+base64_decode_quads_scalar(unsigned char *out, const char *in, size_t len,
+                           const unsigned char *values)
+{
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(in);
+  unsigned char bad = 0;
+  for (size_t i = 0; i + 4 <= len; i += 4, out += 3) {
+    unsigned char a = values[s[i]], b = values[s[i + 1]],
+                  c = values[s[i + 2]], d = values[s[i + 3]];
+    bad |= a | b | c | d;
+    uint32_t v = (a & 0x3f) << 18 | (b & 0x3f) << 12 | (c & 0x3f) << 6 |
+                 (d & 0x3f);
+    out[0] = v >> 16;
+    out[1] = v >> 8;
+    out[2] = v;
+  }
+  return !(bad & 0x80);
+}
+
+#ifdef HAVE_SSSE3_KERNELS
+
+////////////////////////////////////////////////////////////////////////////////
+// SSSE3
+//
+// 16 bytes or characters per step, classifying characters with compares
+//  (everything we accept is ASCII, and anything with the top bit set is
+//  negative as a signed byte, so it falls outside every range) and using
+//  pshufb for the small lookups.
+
+/** Mask of the bytes of `c` that are in [lo, hi]. */
+__attribute__((target("ssse3")))
+static inline __m128i
+in_range(__m128i c, char lo, char hi)
+{
+  return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+                       _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+__attribute__((target("ssse3")))
+static size_t
+hex_encode_ssse3(char *out, const unsigned char *in, size_t len)
+{
+  const __m128i digits = _mm_loadu_si128(
+    reinterpret_cast<const __m128i *>(HexDigits));
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i hi = _mm_shuffle_epi8(
+      digits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+    __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, nibble));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i),
+                     _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i + 16),
+                     _mm_unpackhi_epi8(hi, lo));
+  }
+  return i;
+}
+
+/** 16 hex digits to their values; invalid ones get flagged in `bad`. */
+__attribute__((target("ssse3")))
+static inline __m128i
+hex_values(__m128i c, __m128i *bad)
+{
+  __m128i isDigit = in_range(c, '0', '9');
+  __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+  __m128i isAlpha = in_range(lower, 'a', 'f');
+  *bad = _mm_or_si128(*bad, _mm_andnot_si128(_mm_or_si128(isDigit, isAlpha),
+                                             _mm_set1_epi8(-1)));
+  return _mm_or_si128(
+    _mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+    _mm_and_si128(isAlpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+/**
+ * Decodes 32 characters at a time.  Returns how many bytes it did, or -1 if
+ *  it ran into something that isn't hex.
+ */
+__attribute__((target("ssse3")))
+static ptrdiff_t
+hex_decode_ssse3(unsigned char *out, const char *in, size_t len)
+{
+  // (high nibble * 16 + low nibble, for each pair of bytes)
+  const __m128i weights = _mm_set1_epi16(0x0110);
+  __m128i bad = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m128i a = hex_values(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), &bad);
+    __m128i b = hex_values(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 16)), &bad);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i / 2),
+                     _mm_packus_epi16(_mm_maddubs_epi16(a, weights),
+                                      _mm_maddubs_epi16(b, weights)));
+  }
+  if (_mm_movemask_epi8(bad))
+    return -1;
+  return i / 2;
+}
+
+/**
+ * Encodes 12 bytes to 16 characters at a time (but reads 16 bytes, so it stops
+ *  short of the end).  Returns how many bytes it did.
+ */
+__attribute__((target("ssse3")))
+static size_t
+base64_encode_ssse3(char *out, const unsigned char *in, size_t len,
+                    const Base64Alphabet &alphabet)
+{
+  // spread each 3 bytes over a 32-bit lane, then pull the four 6-bit indices
+  //  apart with multiplies
+  const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+                                       7, 6, 8, 7, 10, 9, 11, 10);
+  // index -> character offset, by range: 0-25 (slot 13), 26-51 (slot 0),
+  //  52-61 (slots 1-10), 62 and 63 (slots 11 and 12)
+  const __m128i offsets = _mm_setr_epi8(
+    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+    '0' - 52, '0' - 52, '0' - 52, '0' - 52, alphabet.chars[62] - 62,
+    alphabet.chars[63] - 63, 'A', 0, 0);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 12, out += 16) {
+    __m128i v = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), spread);
+    __m128i ac = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)),
+                                 _mm_set1_epi32(0x04000040));
+    __m128i bd = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)),
+                                 _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(ac, bd);
+
+    __m128i slot = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i low = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    slot = _mm_or_si128(slot, _mm_and_si128(low, _mm_set1_epi8(13)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     _mm_add_epi8(_mm_shuffle_epi8(offsets, slot), indices));
+  }
+  return i;
+}
+
+/**
+ * Decodes 16 characters to 12 bytes at a time (but writes 16 bytes, so it
+ *  stops short of `outLen`).  Returns how many characters it did, or -1 if it
+ *  ran into something outside the alphabet.
+ */
+__attribute__((target("ssse3")))
+static ptrdiff_t
+base64_decode_ssse3(unsigned char *out, size_t outLen, const char *in,
+                    size_t len, const Base64Alphabet &alphabet)
+{
+  const char c62 = alphabet.chars[62], c63 = alphabet.chars[63];
+  const __m128i gather = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                       14, 13, 12, -1, -1, -1, -1);
+  __m128i bad = _mm_setzero_si128();
+  size_t i = 0, o = 0;
+  for (; i + 16 <= len && o + 16 <= outLen; i += 16, o += 12) {
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i upper = in_range(c, 'A', 'Z');
+    __m128i lower = in_range(c, 'a', 'z');
+    __m128i digit = in_range(c, '0', '9');
+    __m128i is62 = _mm_cmpeq_epi8(c, _mm_set1_epi8(c62));
+    __m128i is63 = _mm_cmpeq_epi8(c, _mm_set1_epi8(c63));
+    __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower),
+                                 _mm_or_si128(digit,
+                                              _mm_or_si128(is62, is63)));
+    bad = _mm_or_si128(bad, _mm_andnot_si128(valid, _mm_set1_epi8(-1)));
+
+    __m128i shift = _mm_or_si128(
+      _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                   _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+      _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                   _mm_or_si128(_mm_and_si128(is62, _mm_set1_epi8(62 - c62)),
+                                _mm_and_si128(is63,
+                                              _mm_set1_epi8(63 - c63)))));
+    __m128i v = _mm_add_epi8(c, shift);
+
+    // 4 x 6 bits -> 2 x 12 bits -> 24 bits per lane, then the 3 bytes of
+    //  each lane in big-endian order
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + o),
+                     _mm_shuffle_epi8(v, gather));
+  }
+  if (_mm_movemask_epi8(bad))
+    return -1;
+  return i;
+}
+
+#endif // HAVE_SSSE3_KERNELS
+
+////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+
+static bool
+use_ssse3()
+{
+#ifdef HAVE_SSSE3_KERNELS
+  static const bool have = __builtin_cpu_supports("ssse3");
+  return have;
+#else
+  return false;
+#endif
+}
+
+static const Base64Alphabet &
+alphabet_for(TextCodec codec)
+{
+  return codec == CODEC_BASE64URL ? Base64Url : Base64;
+}
+
+size_t
+codec_encoded_length(TextCodec codec, size_t len)
+{
+  switch (codec) {
+    case CODEC_HEX:
+      return len * 2;
+    case CODEC_BASE64:
+      return (len + 2) / 3 * 4;
+    case CODEC_BASE64URL:
+    default:
+      return len / 3 * 4 + (len % 3 ? len % 3 + 1 : 0);
+  }
+}
+
+void
+codec_encode(TextCodec codec, char *out, const unsigned char *in, size_t len)
+{
+  size_t done = 0;
+  if (codec == CODEC_HEX) {
+#ifdef HAVE_SSSE3_KERNELS
+    if (len >= 16 && use_ssse3())
+      done = hex_encode_ssse3(out, in, len);
+#endif
+    hex_encode_scalar(out + 2 * done, in + done, len - done);
+    return;
+  }
+
+  const Base64Alphabet &alphabet = alphabet_for(codec);
+#ifdef HAVE_SSSE3_KERNELS
+  if (len >= 16 && use_ssse3())
+    done = base64_encode_ssse3(out, in, len, alphabet);
+#endif
+  base64_encode_scalar(out + done / 3 * 4, in + done, len - done, alphabet);
+}
+
+bool
+codec_decoded_length(TextCodec codec, const char *in, size_t len,
+                     size_t *out)
+{
+  switch (codec) {
+    case CODEC_HEX:
+      if (len % 2)
+        return false;
+      *out = len / 2;
+      return true;
+    case CODEC_BASE64: {
+      if (len % 4)
+        return false;
+      size_t pads = 0;
+      while (pads < 2 && pads < len && in[len - 1 - pads] == '=')
+        pads++;
+      *out = len / 4 * 3 - pads;
+      return true;
+    }
+    case CODEC_BASE64URL:
+    default:
+      if (len % 4 == 1)
+        return false;
+      *out = len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0);
+      return true;
+  }
+}
+
+bool
+codec_decode(TextCodec codec, unsigned char *out, const char *in, size_t len)
+{
+  size_t outLen;
+  if (!codec_decoded_length(codec, in, len, &outLen))
+    return false;
+
+  if (codec == CODEC_HEX) {
+    size_t done = 0;
+#ifdef HAVE_SSSE3_KERNELS
+    if (len >= 32 && use_ssse3()) {
+      ptrdiff_t n = hex_decode_ssse3(out, in, len);
+      if (n < 0)
+        return false;
+      done = n;
+    }
+#endif
+    return hex_decode_scalar(out + done, in + 2 * done, len - 2 * done);
+  }
+
+  const Base64Alphabet &alphabet = alphabet_for(codec);
+  const unsigned char *values = codec == CODEC_BASE64URL ?
+                                  Tables.base64url : Tables.base64;
+  // the whole groups, then whatever is left over: 2 or 3 characters (not
+  //  counting padding) that make 1 or 2 bytes
+  size_t tail = len % 4;
+  if (alphabet.pad && len && in[len - 1] == '=')
+    tail = in[len - 2] == '=' ? 2 : 3;
+  size_t quads = len - (tail ? (alphabet.pad ? 4 : tail) : 0);
+
+  size_t done = 0;
+#ifdef HAVE_SSSE3_KERNELS
+  if (quads >= 16 && use_ssse3()) {
+    ptrdiff_t n = base64_decode_ssse3(out, outLen, in, quads, alphabet);
+    if (n < 0)
+      return false;
+    done = n;
+  }
+#endif
+  if (!base64_decode_quads_scalar(out + done / 4 * 3, in + done,
+                                  quads - done, values))
+    return false;
+  if (!tail)
+    return true;
+
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(in);
+  unsigned char *o = out + quads / 4 * 3;
+  unsigned char a = values[s[quads]], b = values[s[quads + 1]];
+  unsigned char c = tail == 3 ? values[s[quads + 2]] : 0;
+  if ((a | b | c) & 0x80)
+    return false;
+  o[0] = a << 2 | b >> 4;
+  if (tail == 2)
+    return !(b & 0x0f);
+  o[1] = b << 4 | c >> 2;
+  return !(c & 0x03);
+}
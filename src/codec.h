@@ -0,0 +1,84 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NACL_NODE_CODEC_H
+#define NACL_NODE_CODEC_H
+
+#include <stddef.h>
+
+/**
+ * Text encodings for bytes.  base64 is RFC 4648's standard alphabet with '='
+ *  padding; base64url is the URL-safe alphabet without padding (as used in
+ *  JOSE and friends).  Hex comes out lower-case and goes in either case.
+ */
+enum TextCodec {
+  CODEC_HEX,
+  CODEC_BASE64,
+  CODEC_BASE64URL
+};
+
+/** How many characters encoding `len` bytes takes. */
+size_t codec_encoded_length(TextCodec codec, size_t len);
+
+/**
+ * Encode `len` bytes into `out`, which needs codec_encoded_length() bytes of
+ *  room.  No NUL gets written.
+ */
+void codec_encode(TextCodec codec, char *out, const unsigned char *in,
+                  size_t len);
+
+/**
+ * How many bytes `len` characters of `in` decode to.  Only looks at the length
+ *  and any padding, so it can say yes to something codec_decode() rejects.
+ *
+ * @return false if no valid encoding could be that long.
+ */
+bool codec_decoded_length(TextCodec codec, const char *in, size_t len,
+                          size_t *out);
+
+/**
+ * Decode `len` characters into `out`, which needs codec_decoded_length()
+ *  bytes of room.  Strict: no whitespace, no characters from the other base64
+ *  alphabet, and the unused bits of the last base64 character have to be 0,
+ *  so every byte string has exactly one accepted encoding.
+ *
+ * @return false if the input is not valid; `out` is then garbage.
+ */
+bool codec_decode(TextCodec codec, unsigned char *out, const char *in,
+                  size_t len);
+
+#endif // NACL_NODE_CODEC_H
@@ -0,0 +1,190 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * The C entry points emnacl.js calls into the WebAssembly build.  They take
+ *  32-bit lengths so that nothing crossing the JS boundary is an i64 (which
+ *  wasm would either split in two or turn into a BigInt, depending on the
+ *  toolchain), and they have friendly names instead of the
+ *  crypto_sign_edwards25519sha512batch_ref-style implementation names.
+ *
+ * Buffers follow nacl's C conventions: box/secretbox inputs carry their
+ *  ZEROBYTES of padding, which emnacl.js lays out in the heap for us.
+ */
+
+#include <string.h>
+
+#include "crypto_box.h"
+#include "crypto_sign.h"
+#include "crypto_secretbox.h"
+#include "crypto_auth.h"
+#include "crypto_hash.h"
+#include "crypto_onetimeauth.h"
+#include "randombytes.h"
+
+#include "stream_xsalsa20_ic.h"
+
+extern "C" {
+
+/** Provided by tools/emnacl_library.js. */
+void emnacl_fill_random(unsigned char *buf, unsigned int len);
+
+void
+randombytes(unsigned char *x, unsigned long long xlen)
+{
+  while (xlen) {
+    unsigned int chunk = xlen < 65536 ? (unsigned int)xlen : 65536;
+    emnacl_fill_random(x, chunk);
+    x += chunk;
+    xlen -= chunk;
+  }
+}
+
+int
+emnacl_sign_keypair(unsigned char *pk, unsigned char *sk)
+{
+  return crypto_sign_keypair(pk, sk);
+}
+
+int
+emnacl_sign(unsigned char *sm, unsigned int *smlen, const unsigned char *m,
+            unsigned int mlen, const unsigned char *sk)
+{
+  unsigned long long len;
+  int rv = crypto_sign(sm, &len, m, mlen, sk);
+  *smlen = (unsigned int)len;
+  return rv;
+}
+
+int
+emnacl_sign_open(unsigned char *m, unsigned int *mlen, const unsigned char *sm,
+                 unsigned int smlen, const unsigned char *pk)
+{
+  unsigned long long len;
+  int rv = crypto_sign_open(m, &len, sm, smlen, pk);
+  *mlen = (unsigned int)len;
+  return rv;
+}
+
+int
+emnacl_box_keypair(unsigned char *pk, unsigned char *sk)
+{
+  return crypto_box_keypair(pk, sk);
+}
+
+int
+emnacl_box(unsigned char *c, const unsigned char *m, unsigned int mlen,
+           const unsigned char *n, const unsigned char *pk,
+           const unsigned char *sk)
+{
+  return crypto_box(c, m, mlen, n, pk, sk);
+}
+
+int
+emnacl_box_open(unsigned char *m, const unsigned char *c, unsigned int clen,
+                const unsigned char *n, const unsigned char *pk,
+                const unsigned char *sk)
+{
+  return crypto_box_open(m, c, clen, n, pk, sk);
+}
+
+int
+emnacl_secretbox(unsigned char *c, const unsigned char *m, unsigned int mlen,
+                 const unsigned char *n, const unsigned char *k)
+{
+  return crypto_secretbox(c, m, mlen, n, k);
+}
+
+int
+emnacl_secretbox_open(unsigned char *m, const unsigned char *c,
+                      unsigned int clen, const unsigned char *n,
+                      const unsigned char *k)
+{
+  return crypto_secretbox_open(m, c, clen, n, k);
+}
+
+int
+emnacl_auth(unsigned char *a, const unsigned char *m, unsigned int mlen,
+            const unsigned char *k)
+{
+  return crypto_auth(a, m, mlen, k);
+}
+
+int
+emnacl_auth_verify(const unsigned char *a, const unsigned char *m,
+                   unsigned int mlen, const unsigned char *k)
+{
+  return crypto_auth_verify(a, m, mlen, k);
+}
+
+/** sha512 truncated to its first 32 bytes, like nacl_hash512_256. */
+int
+emnacl_hash512_256(unsigned char *h, const unsigned char *m, unsigned int mlen)
+{
+  unsigned char full[crypto_hash_BYTES];
+  int rv = crypto_hash(full, m, mlen);
+  memcpy(h, full, 32);
+  return rv;
+}
+
+/** The counter comes in as two halves; see the top of the file. */
+int
+emnacl_stream_xsalsa20_xor(unsigned char *c, const unsigned char *m,
+                           unsigned int mlen, const unsigned char *n,
+                           unsigned int counter_lo, unsigned int counter_hi,
+                           const unsigned char *k)
+{
+  return stream_xsalsa20_xor_ic(
+    c, m, mlen, n,
+    (static_cast<unsigned long long>(counter_hi) << 32) | counter_lo, k);
+}
+
+int
+emnacl_onetimeauth(unsigned char *a, const unsigned char *m, unsigned int mlen,
+                   const unsigned char *k)
+{
+  return crypto_onetimeauth(a, m, mlen, k);
+}
+
+int
+emnacl_onetimeauth_verify(const unsigned char *a, const unsigned char *m,
+                          unsigned int mlen, const unsigned char *k)
+{
+  return crypto_onetimeauth_verify(a, m, mlen, k);
+}
+
+} // extern "C"
@@ -0,0 +1,183 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Drop-in replacement for nacl's crypto_onetimeauth/poly1305/ref in the
+ *  WebAssembly build (tools/build_emnacl.sh).  The ref code does its
+ *  arithmetic a byte at a time in 17 limbs; this keeps the accumulator in five
+ *  26-bit limbs so each 16-byte block is 25 32x32->64 multiplies, which wasm
+ *  does natively.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "crypto_onetimeauth_poly1305.h"
+#include "crypto_verify_16.h"
+
+static inline uint32_t
+load_le32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void
+store_le32(unsigned char *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+int
+crypto_onetimeauth_poly1305(unsigned char *out, const unsigned char *m,
+                            unsigned long long mlen, const unsigned char *k)
+{
+  uint32_t r0, r1, r2, r3, r4, s1, s2, s3, s4;
+  uint32_t h0 = 0, h1 = 0, h2 = 0, h3 = 0, h4 = 0;
+  uint32_t c, g0, g1, g2, g3, g4, mask;
+  uint64_t d0, d1, d2, d3, d4, f;
+  unsigned char block[16];
+
+  // r is clamped as the spec requires
+  r0 = load_le32(k) & 0x3ffffff;
+  r1 = (load_le32(k + 3) >> 2) & 0x3ffff03;
+  r2 = (load_le32(k + 6) >> 4) & 0x3ffc0ff;
+  r3 = (load_le32(k + 9) >> 6) & 0x3f03fff;
+  r4 = (load_le32(k + 12) >> 8) & 0x00fffff;
+  s1 = r1 * 5;
+  s2 = r2 * 5;
+  s3 = r3 * 5;
+  s4 = r4 * 5;
+
+  while (mlen) {
+    const unsigned char *p = m;
+    uint32_t hibit = 1 << 24;
+
+    if (mlen < 16) {
+      // a short final block gets its 1 appended explicitly instead
+      memset(block, 0, sizeof(block));
+      memcpy(block, m, mlen);
+      block[mlen] = 1;
+      p = block;
+      hibit = 0;
+    }
+
+    h0 += load_le32(p) & 0x3ffffff;
+    h1 += (load_le32(p + 3) >> 2) & 0x3ffffff;
+    h2 += (load_le32(p + 6) >> 4) & 0x3ffffff;
+    h3 += (load_le32(p + 9) >> 6) & 0x3ffffff;
+    h4 += (load_le32(p + 12) >> 8) | hibit;
+
+    d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 +
+         (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+    d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 +
+         (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+    d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 +
+         (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+    d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 +
+         (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+    d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 +
+         (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+    c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+    d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+    d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+    d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+    d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    if (mlen < 16)
+      break;
+    m += 16;
+    mlen -= 16;
+  }
+
+  // fully carry h
+  c = h1 >> 26; h1 &= 0x3ffffff;
+  h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+  h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+  h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+  h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+  h1 += c;
+
+  // g = h - p; keep whichever of h and g is the reduced one, in constant time
+  g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+  g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+  g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+  g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+  g4 = h4 + c - (1 << 26);
+
+  mask = (g4 >> 31) - 1;
+  g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+  mask = ~mask;
+  h0 = (h0 & mask) | g0;
+  h1 = (h1 & mask) | g1;
+  h2 = (h2 & mask) | g2;
+  h3 = (h3 & mask) | g3;
+  h4 = (h4 & mask) | g4;
+
+  // h = (h + s) % 2^128
+  h0 = (h0 | (h1 << 26)) & 0xffffffff;
+  h1 = ((h1 >> 6) | (h2 << 20)) & 0xffffffff;
+  h2 = ((h2 >> 12) | (h3 << 14)) & 0xffffffff;
+  h3 = ((h3 >> 18) | (h4 << 8)) & 0xffffffff;
+
+  f = (uint64_t)h0 + load_le32(k + 16); h0 = (uint32_t)f;
+  f = (uint64_t)h1 + load_le32(k + 20) + (f >> 32); h1 = (uint32_t)f;
+  f = (uint64_t)h2 + load_le32(k + 24) + (f >> 32); h2 = (uint32_t)f;
+  f = (uint64_t)h3 + load_le32(k + 28) + (f >> 32); h3 = (uint32_t)f;
+
+  store_le32(out, h0);
+  store_le32(out + 4, h1);
+  store_le32(out + 8, h2);
+  store_le32(out + 12, h3);
+  return 0;
+}
+
+int
+crypto_onetimeauth_poly1305_verify(const unsigned char *h,
+                                   const unsigned char *m,
+                                   unsigned long long mlen,
+                                   const unsigned char *k)
+{
+  unsigned char correct[16];
+  crypto_onetimeauth_poly1305(correct, m, mlen, k);
+  return crypto_verify_16(h, correct);
+}
@@ -0,0 +1,182 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+/*
+ * Drop-in replacement for nacl's crypto_stream/salsa20/ref in the
+ *  WebAssembly build (tools/build_emnacl.sh), using SIMD-128.  The ref code
+ *  runs crypto_core_salsa20 one 64-byte block at a time; here four blocks run
+ *  side by side with each state word in its own v128 (one lane per block), so
+ *  the rounds are plain lane-wise adds/xors/rotates with no shuffling until
+ *  the final transpose.  xsalsa20, and so secretbox and box, sit on top of
+ *  this.
+ */
+
+#include <string.h>
+#include <wasm_simd128.h>
+
+#include "crypto_stream_salsa20.h"
+
+#define LANES 4
+#define BLOCK_BYTES 64
+
+#define ROTL(v, n) \
+  wasm_v128_or(wasm_i32x4_shl((v), (n)), wasm_u32x4_shr((v), 32 - (n)))
+#define QR(a, b, c, d)                                  \
+  b = wasm_v128_xor(b, ROTL(wasm_i32x4_add(a, d), 7));  \
+  c = wasm_v128_xor(c, ROTL(wasm_i32x4_add(b, a), 9));  \
+  d = wasm_v128_xor(d, ROTL(wasm_i32x4_add(c, b), 13)); \
+  a = wasm_v128_xor(a, ROTL(wasm_i32x4_add(d, c), 18))
+
+static const unsigned char sigma[17] = "expand 32-byte k";
+
+static inline unsigned int
+load_le32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/**
+ * Produce LANES consecutive keystream blocks starting at block `counter` into
+ *  `out` (LANES * 64 bytes), xoring them with `m` when it is not NULL.
+ */
+static void
+salsa20_x4(unsigned char *out, const unsigned char *m,
+           const unsigned int in[16], unsigned long long counter)
+{
+  v128_t j[16], x[16];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    j[i] = wasm_i32x4_splat(in[i]);
+  // words 8 and 9 are the 64-bit block counter, different for every lane
+  j[8] = wasm_i32x4_make(counter, counter + 1, counter + 2, counter + 3);
+  j[9] = wasm_i32x4_make((counter) >> 32, (counter + 1) >> 32,
+                         (counter + 2) >> 32, (counter + 3) >> 32);
+  for (i = 0; i < 16; i++)
+    x[i] = j[i];
+
+  for (i = 0; i < 20; i += 2) {
+    // columns
+    QR(x[0], x[4], x[8], x[12]);
+    QR(x[5], x[9], x[13], x[1]);
+    QR(x[10], x[14], x[2], x[6]);
+    QR(x[15], x[3], x[7], x[11]);
+    // rows
+    QR(x[0], x[1], x[2], x[3]);
+    QR(x[5], x[6], x[7], x[4]);
+    QR(x[10], x[11], x[8], x[9]);
+    QR(x[15], x[12], x[13], x[14]);
+  }
+
+  for (i = 0; i < 16; i++)
+    x[i] = wasm_i32x4_add(x[i], j[i]);
+
+  // transpose each run of four words so that each vector holds 16 contiguous
+  //  output bytes of one block
+  for (i = 0; i < 16; i += 4) {
+    v128_t t0 = wasm_i32x4_shuffle(x[i], x[i + 1], 0, 4, 1, 5);
+    v128_t t1 = wasm_i32x4_shuffle(x[i + 2], x[i + 3], 0, 4, 1, 5);
+    v128_t t2 = wasm_i32x4_shuffle(x[i], x[i + 1], 2, 6, 3, 7);
+    v128_t t3 = wasm_i32x4_shuffle(x[i + 2], x[i + 3], 2, 6, 3, 7);
+    v128_t b[LANES];
+    b[0] = wasm_i32x4_shuffle(t0, t1, 0, 1, 4, 5);
+    b[1] = wasm_i32x4_shuffle(t0, t1, 2, 3, 6, 7);
+    b[2] = wasm_i32x4_shuffle(t2, t3, 0, 1, 4, 5);
+    b[3] = wasm_i32x4_shuffle(t2, t3, 2, 3, 6, 7);
+
+    for (int lane = 0; lane < LANES; lane++) {
+      unsigned char *o = out + lane * BLOCK_BYTES + i * 4;
+      if (m)
+        b[lane] = wasm_v128_xor(
+          b[lane], wasm_v128_load(m + lane * BLOCK_BYTES + i * 4));
+      wasm_v128_store(o, b[lane]);
+    }
+  }
+}
+
+static int
+salsa20_xor(unsigned char *c, const unsigned char *m, unsigned long long mlen,
+            const unsigned char *n, const unsigned char *k)
+{
+  unsigned int in[16];
+  unsigned char tail[LANES * BLOCK_BYTES];
+  unsigned long long counter = 0;
+  unsigned long long i;
+
+  in[0] = load_le32(sigma);
+  in[5] = load_le32(sigma + 4);
+  in[10] = load_le32(sigma + 8);
+  in[15] = load_le32(sigma + 12);
+  for (i = 0; i < 4; i++) {
+    in[1 + i] = load_le32(k + 4 * i);
+    in[11 + i] = load_le32(k + 16 + 4 * i);
+  }
+  in[6] = load_le32(n);
+  in[7] = load_le32(n + 4);
+  in[8] = in[9] = 0;
+
+  while (mlen >= LANES * BLOCK_BYTES) {
+    salsa20_x4(c, m, in, counter);
+    counter += LANES;
+    c += LANES * BLOCK_BYTES;
+    if (m)
+      m += LANES * BLOCK_BYTES;
+    mlen -= LANES * BLOCK_BYTES;
+  }
+  if (mlen) {
+    salsa20_x4(tail, 0, in, counter);
+    for (i = 0; i < mlen; i++)
+      c[i] = m ? m[i] ^ tail[i] : tail[i];
+    memset(tail, 0, sizeof(tail));
+  }
+  return 0;
+}
+
+int
+crypto_stream_salsa20(unsigned char *c, unsigned long long clen,
+                      const unsigned char *n, const unsigned char *k)
+{
+  return salsa20_xor(c, 0, clen, n, k);
+}
+
+int
+crypto_stream_salsa20_xor(unsigned char *c, const unsigned char *m,
+                          unsigned long long mlen, const unsigned char *n,
+                          const unsigned char *k)
+{
+  return salsa20_xor(c, m, mlen, n, k);
+}
@@ -0,0 +1,867 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "randombytes.h"
+#include "crypto_box.h"
+#include "crypto_sign.h"
+#include "crypto_hash_sha512.h"
+#include "crypto_scalarmult_curve25519.h"
+
+#include "fixedbase25519.h"
+
+// The field arithmetic wants 64x64->128 bit multiplies; without them we just
+//  let nacl do everything.
+#if defined(__SIZEOF_INT128__)
+#define HAVE_FIXEDBASE 1
+#endif
+
+#ifdef HAVE_FIXEDBASE
+
+typedef unsigned __int128 uint128_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// GF(2^255 - 19), 5 limbs of 51 bits.
+//
+// Everything is kept weakly reduced (limbs < 2^52) between operations so that
+//  fe_sub can get away with adding 2p and fe_mul never overflows.
+
+typedef uint64_t fe[5];
+
+static const uint64_t MASK51 = (((uint64_t) 1) << 51) - 1;
+
+static uint64_t
+load64_le(const unsigned char *s)
+{
+  uint64_t r = 0;
+  for (int i = 7; i >= 0; i--)
+    r = (r << 8) | s[i];
+  return r;
+}
+
+static void
+store64_le(unsigned char *s, uint64_t v)
+{
+  for (int i = 0; i < 8; i++, v >>= 8)
+    s[i] = v & 0xff;
+}
+
+static void
+fe_0(fe h)
+{
+  h[0] = h[1] = h[2] = h[3] = h[4] = 0;
+}
+
+static void
+fe_1(fe h)
+{
+  fe_0(h);
+  h[0] = 1;
+}
+
+static void
+fe_copy(fe h, const fe f)
+{
+  memcpy(h, f, sizeof(fe));
+}
+
+static void
+fe_carry(fe h)
+{
+  uint64_t c;
+  c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+  c = h[1] >> 51; h[1] &= MASK51; h[2] += c;
+  c = h[2] >> 51; h[2] &= MASK51; h[3] += c;
+  c = h[3] >> 51; h[3] &= MASK51; h[4] += c;
+  c = h[4] >> 51; h[4] &= MASK51; h[0] += 19 * c;
+}
+
+static void
+fe_add(fe h, const fe f, const fe g)
+{
+  for (int i = 0; i < 5; i++)
+    h[i] = f[i] + g[i];
+  fe_carry(h);
+}
+
+static void
+fe_sub(fe h, const fe f, const fe g)
+{
+  // f + 2p - g
+  h[0] = f[0] + 0xfffffffffffdaULL - g[0];
+  h[1] = f[1] + 0xffffffffffffeULL - g[1];
+  h[2] = f[2] + 0xffffffffffffeULL - g[2];
+  h[3] = f[3] + 0xffffffffffffeULL - g[3];
+  h[4] = f[4] + 0xffffffffffffeULL - g[4];
+  fe_carry(h);
+}
+
+static void
+fe_neg(fe h, const fe f)
+{
+  fe zero;
+  fe_0(zero);
+  fe_sub(h, zero, f);
+}
+
+static void
+fe_reduce_products(fe h, uint128_t r0, uint128_t r1, uint128_t r2,
+                   uint128_t r3, uint128_t r4)
+{
+  uint64_t c;
+  c = (uint64_t) (r0 >> 51); r1 += c; h[0] = (uint64_t) r0 & MASK51;
+  c = (uint64_t) (r1 >> 51); r2 += c; h[1] = (uint64_t) r1 & MASK51;
+  c = (uint64_t) (r2 >> 51); r3 += c; h[2] = (uint64_t) r2 & MASK51;
+  c = (uint64_t) (r3 >> 51); r4 += c; h[3] = (uint64_t) r3 & MASK51;
+  c = (uint64_t) (r4 >> 51); h[4] = (uint64_t) r4 & MASK51;
+  h[0] += 19 * c;
+  c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+}
+
+static void
+fe_mul(fe h, const fe f, const fe g)
+{
+  uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+  uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+  uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3,
+           g4_19 = 19 * g4;
+
+  uint128_t r0 = (uint128_t) f0 * g0 + (uint128_t) f1 * g4_19 +
+                 (uint128_t) f2 * g3_19 + (uint128_t) f3 * g2_19 +
+                 (uint128_t) f4 * g1_19;
+  uint128_t r1 = (uint128_t) f0 * g1 + (uint128_t) f1 * g0 +
+                 (uint128_t) f2 * g4_19 + (uint128_t) f3 * g3_19 +
+                 (uint128_t) f4 * g2_19;
+  uint128_t r2 = (uint128_t) f0 * g2 + (uint128_t) f1 * g1 +
+                 (uint128_t) f2 * g0 + (uint128_t) f3 * g4_19 +
+                 (uint128_t) f4 * g3_19;
+  uint128_t r3 = (uint128_t) f0 * g3 + (uint128_t) f1 * g2 +
+                 (uint128_t) f2 * g1 + (uint128_t) f3 * g0 +
+                 (uint128_t) f4 * g4_19;
+  uint128_t r4 = (uint128_t) f0 * g4 + (uint128_t) f1 * g3 +
+                 (uint128_t) f2 * g2 + (uint128_t) f3 * g1 +
+                 (uint128_t) f4 * g0;
+
+  fe_reduce_products(h, r0, r1, r2, r3, r4);
+}
+
+static void
+fe_sq(fe h, const fe f)
+{
+  uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+  uint64_t f0_2 = 2 * f0, f1_2 = 2 * f1;
+  uint64_t f1_38 = 38 * f1, f2_38 = 38 * f2, f3_38 = 38 * f3;
+  uint64_t f3_19 = 19 * f3, f4_19 = 19 * f4;
+
+  uint128_t r0 = (uint128_t) f0 * f0 + (uint128_t) f1_38 * f4 +
+                 (uint128_t) f2_38 * f3;
+  uint128_t r1 = (uint128_t) f0_2 * f1 + (uint128_t) f2_38 * f4 +
+                 (uint128_t) f3_19 * f3;
+  uint128_t r2 = (uint128_t) f0_2 * f2 + (uint128_t) f1 * f1 +
+                 (uint128_t) f3_38 * f4;
+  uint128_t r3 = (uint128_t) f0_2 * f3 + (uint128_t) f1_2 * f2 +
+                 (uint128_t) f4_19 * f4;
+  uint128_t r4 = (uint128_t) f0_2 * f4 + (uint128_t) f1_2 * f3 +
+                 (uint128_t) f2 * f2;
+
+  fe_reduce_products(h, r0, r1, r2, r3, r4);
+}
+
+static void
+fe_sqn(fe h, const fe f, int n)
+{
+  fe_sq(h, f);
+  while (--n)
+    fe_sq(h, h);
+}
+
+/** h = z^(p-2) = 1/z */
+static void
+fe_invert(fe h, const fe z)
+{
+  fe t0, t1, t2, t3;
+
+  fe_sq(t0, z);                               // 2
+  fe_sqn(t1, t0, 2);                          // 8
+  fe_mul(t1, z, t1);                          // 9
+  fe_mul(t0, t0, t1);                         // 11
+  fe_sq(t2, t0);                              // 22
+  fe_mul(t1, t1, t2);                         // 2^5 - 1
+  fe_sqn(t2, t1, 5);  fe_mul(t1, t2, t1);     // 2^10 - 1
+  fe_sqn(t2, t1, 10); fe_mul(t2, t2, t1);     // 2^20 - 1
+  fe_sqn(t3, t2, 20); fe_mul(t2, t3, t2);     // 2^40 - 1
+  fe_sqn(t2, t2, 10); fe_mul(t1, t2, t1);     // 2^50 - 1
+  fe_sqn(t2, t1, 50); fe_mul(t2, t2, t1);     // 2^100 - 1
+  fe_sqn(t3, t2, 100); fe_mul(t2, t3, t2);    // 2^200 - 1
+  fe_sqn(t2, t2, 50); fe_mul(t1, t2, t1);     // 2^250 - 1
+  fe_sqn(t1, t1, 5);  fe_mul(h, t1, t0);      // 2^255 - 21
+}
+
+static void
+fe_frombytes(fe h, const unsigned char *s)
+{
+  h[0] = load64_le(s) & MASK51;
+  h[1] = (load64_le(s + 6) >> 3) & MASK51;
+  h[2] = (load64_le(s + 12) >> 6) & MASK51;
+  h[3] = (load64_le(s + 19) >> 1) & MASK51;
+  h[4] = (load64_le(s + 24) >> 12) & MASK51;
+}
+
+static void
+fe_tobytes(unsigned char *s, const fe f)
+{
+  fe t;
+  fe_copy(t, f);
+  fe_carry(t);
+  fe_carry(t);
+  // t < 2^255 now; add 19 so that anything >= p carries out of the top.
+  t[0] += 19;
+  fe_carry(t);
+  // t + 19 (mod 2^255) is in [19, 2^255), take the 19 back off by adding
+  //  2^255 - 19 and dropping the 2^255.
+  t[0] += 0x8000000000000ULL - 19;
+  t[1] += 0x8000000000000ULL - 1;
+  t[2] += 0x8000000000000ULL - 1;
+  t[3] += 0x8000000000000ULL - 1;
+  t[4] += 0x8000000000000ULL - 1;
+  t[1] += t[0] >> 51; t[0] &= MASK51;
+  t[2] += t[1] >> 51; t[1] &= MASK51;
+  t[3] += t[2] >> 51; t[2] &= MASK51;
+  t[4] += t[3] >> 51; t[3] &= MASK51;
+  t[4] &= MASK51;
+
+  store64_le(s, t[0] | (t[1] << 51));
+  store64_le(s + 8, (t[1] >> 13) | (t[2] << 38));
+  store64_le(s + 16, (t[2] >> 26) | (t[3] << 25));
+  store64_le(s + 24, (t[3] >> 39) | (t[4] << 12));
+}
+
+static int
+fe_isnegative(const fe f)
+{
+  unsigned char s[32];
+  fe_tobytes(s, f);
+  return s[0] & 1;
+}
+
+/** Constant-time h = b ? g : h, b in {0, 1}. */
+static void
+fe_cmov(fe h, const fe g, unsigned int b)
+{
+  uint64_t mask = -(uint64_t) b;
+  for (int i = 0; i < 5; i++)
+    h[i] ^= mask & (h[i] ^ g[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// edwards25519 group, in the representations used by ref10.
+
+struct ge_p2 { fe X, Y, Z; };
+struct ge_p3 { fe X, Y, Z, T; };
+struct ge_p1p1 { fe X, Y, Z, T; };
+struct ge_precomp { fe yplusx, yminusx, xy2d; };
+struct ge_cached { fe YplusX, YminusX, Z, T2d; };
+
+static const unsigned char BASE_X_BYTES[32] = {
+  0x1a, 0xd5, 0x25, 0x8f, 0x60, 0x2d, 0x56, 0xc9, 0xb2, 0xa7, 0x25, 0x95,
+  0x60, 0xc7, 0x2c, 0x69, 0x5c, 0xdc, 0xd6, 0xfd, 0x31, 0xe2, 0xa4, 0xc0,
+  0xfe, 0x53, 0x6e, 0xcd, 0xd3, 0x36, 0x69, 0x21
+};
+static const unsigned char BASE_Y_BYTES[32] = {
+  0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+  0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+  0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66
+};
+/** d = -121665/121666 */
+static const unsigned char D_BYTES[32] = {
+  0xa3, 0x78, 0x59, 0x13, 0xca, 0x4d, 0xeb, 0x75, 0xab, 0xd8, 0x41, 0x41,
+  0x4d, 0x0a, 0x70, 0x00, 0x98, 0xe8, 0x79, 0x77, 0x79, 0x40, 0xc7, 0x8c,
+  0x73, 0xfe, 0x6f, 0x2b, 0xee, 0x6c, 0x03, 0x52
+};
+
+static fe d2;
+
+/**
+ * base[i][j] = (j + 1) * 256^i * B, so a radix-16 signed digit at position k
+ *  can be looked up in base[k / 2] (with odd positions picking up the extra
+ *  factor of 16 from 4 doublings in the middle of scalarmult_base).
+ */
+static ge_precomp base[32][8];
+
+static void
+ge_p3_0(ge_p3 *h)
+{
+  fe_0(h->X);
+  fe_1(h->Y);
+  fe_1(h->Z);
+  fe_0(h->T);
+}
+
+static void
+ge_precomp_0(ge_precomp *h)
+{
+  fe_1(h->yplusx);
+  fe_1(h->yminusx);
+  fe_0(h->xy2d);
+}
+
+static void
+ge_p1p1_to_p2(ge_p2 *r, const ge_p1p1 *p)
+{
+  fe_mul(r->X, p->X, p->T);
+  fe_mul(r->Y, p->Y, p->Z);
+  fe_mul(r->Z, p->Z, p->T);
+}
+
+static void
+ge_p1p1_to_p3(ge_p3 *r, const ge_p1p1 *p)
+{
+  fe_mul(r->X, p->X, p->T);
+  fe_mul(r->Y, p->Y, p->Z);
+  fe_mul(r->Z, p->Z, p->T);
+  fe_mul(r->T, p->X, p->Y);
+}
+
+static void
+ge_p3_to_cached(ge_cached *r, const ge_p3 *p)
+{
+  fe_add(r->YplusX, p->Y, p->X);
+  fe_sub(r->YminusX, p->Y, p->X);
+  fe_copy(r->Z, p->Z);
+  fe_mul(r->T2d, p->T, d2);
+}
+
+static void
+ge_p2_dbl(ge_p1p1 *r, const ge_p2 *p)
+{
+  fe t0;
+
+  fe_sq(r->X, p->X);
+  fe_sq(r->Z, p->Y);
+  fe_sq(r->T, p->Z);
+  fe_add(r->T, r->T, r->T);
+  fe_add(r->Y, p->X, p->Y);
+  fe_sq(t0, r->Y);
+  fe_add(r->Y, r->Z, r->X);
+  fe_sub(r->Z, r->Z, r->X);
+  fe_sub(r->X, t0, r->Y);
+  fe_sub(r->T, r->T, r->Z);
+}
+
+static void
+ge_p3_dbl(ge_p1p1 *r, const ge_p3 *p)
+{
+  ge_p2 q;
+  fe_copy(q.X, p->X);
+  fe_copy(q.Y, p->Y);
+  fe_copy(q.Z, p->Z);
+  ge_p2_dbl(r, &q);
+}
+
+/** r = p + q */
+static void
+ge_add(ge_p1p1 *r, const ge_p3 *p, const ge_cached *q)
+{
+  fe t0;
+
+  fe_add(r->X, p->Y, p->X);
+  fe_sub(r->Y, p->Y, p->X);
+  fe_mul(r->Z, r->X, q->YplusX);
+  fe_mul(r->Y, r->Y, q->YminusX);
+  fe_mul(r->T, q->T2d, p->T);
+  fe_mul(r->X, p->Z, q->Z);
+  fe_add(t0, r->X, r->X);
+  fe_sub(r->X, r->Z, r->Y);
+  fe_add(r->Y, r->Z, r->Y);
+  fe_add(r->Z, t0, r->T);
+  fe_sub(r->T, t0, r->T);
+}
+
+/** r = p + q, q affine */
+static void
+ge_madd(ge_p1p1 *r, const ge_p3 *p, const ge_precomp *q)
+{
+  fe t0;
+
+  fe_add(r->X, p->Y, p->X);
+  fe_sub(r->Y, p->Y, p->X);
+  fe_mul(r->Z, r->X, q->yplusx);
+  fe_mul(r->Y, r->Y, q->yminusx);
+  fe_mul(r->T, q->xy2d, p->T);
+  fe_add(t0, p->Z, p->Z);
+  fe_sub(r->X, r->Z, r->Y);
+  fe_add(r->Y, r->Z, r->Y);
+  fe_add(r->Z, t0, r->T);
+  fe_sub(r->T, t0, r->T);
+}
+
+static void
+ge_p3_to_precomp(ge_precomp *r, const ge_p3 *p)
+{
+  fe recip, x, y;
+
+  fe_invert(recip, p->Z);
+  fe_mul(x, p->X, recip);
+  fe_mul(y, p->Y, recip);
+  fe_add(r->yplusx, y, x);
+  fe_sub(r->yminusx, y, x);
+  fe_mul(r->xy2d, x, y);
+  fe_mul(r->xy2d, r->xy2d, d2);
+}
+
+static void
+ge_p3_tobytes(unsigned char *s, const ge_p3 *h)
+{
+  fe recip, x, y;
+
+  fe_invert(recip, h->Z);
+  fe_mul(x, h->X, recip);
+  fe_mul(y, h->Y, recip);
+  fe_tobytes(s, y);
+  s[31] ^= fe_isnegative(x) << 7;
+}
+
+/** The curve25519 u-coordinate of h: (1 + y) / (1 - y). */
+static void
+ge_p3_to_montgomery_bytes(unsigned char *s, const ge_p3 *h)
+{
+  fe num, den, u;
+
+  fe_add(num, h->Z, h->Y);
+  fe_sub(den, h->Z, h->Y);
+  fe_invert(den, den);
+  fe_mul(u, num, den);
+  fe_tobytes(s, u);
+}
+
+static void
+build_base_table()
+{
+  fe_frombytes(d2, D_BYTES);
+  fe_add(d2, d2, d2);
+
+  ge_p3 p; // 256^i * B
+  fe_frombytes(p.X, BASE_X_BYTES);
+  fe_frombytes(p.Y, BASE_Y_BYTES);
+  fe_1(p.Z);
+  fe_mul(p.T, p.X, p.Y);
+
+  for (int i = 0; i < 32; i++) {
+    ge_cached pc;
+    ge_p3 q = p;
+    ge_p1p1 r;
+
+    ge_p3_to_cached(&pc, &p);
+    ge_p3_to_precomp(&base[i][0], &q);
+    for (int j = 1; j < 8; j++) {
+      ge_add(&r, &q, &pc);
+      ge_p1p1_to_p3(&q, &r);
+      ge_p3_to_precomp(&base[i][j], &q);
+    }
+
+    for (int k = 0; k < 8; k++) {
+      ge_p3_dbl(&r, &p);
+      ge_p1p1_to_p3(&p, &r);
+    }
+  }
+}
+
+static unsigned int
+ct_equal(signed char b, signed char c)
+{
+  uint32_t x = (unsigned char) b ^ (unsigned char) c;
+  x -= 1;
+  return x >> 31;
+}
+
+static unsigned int
+ct_negative(signed char b)
+{
+  return ((uint32_t) (int32_t) b) >> 31;
+}
+
+static void
+ge_precomp_cmov(ge_precomp *t, const ge_precomp *u, unsigned int b)
+{
+  fe_cmov(t->yplusx, u->yplusx, b);
+  fe_cmov(t->yminusx, u->yminusx, b);
+  fe_cmov(t->xy2d, u->xy2d, b);
+}
+
+/** t = b * 256^pos * B for b in [-8, 8], touching every table entry. */
+static void
+ge_select(ge_precomp *t, int pos, signed char b)
+{
+  ge_precomp minust;
+  unsigned int bnegative = ct_negative(b);
+  signed char babs = b - (((-bnegative) & b) << 1);
+
+  ge_precomp_0(t);
+  for (int j = 0; j < 8; j++)
+    ge_precomp_cmov(t, &base[pos][j], ct_equal(babs, j + 1));
+  fe_copy(minust.yplusx, t->yminusx);
+  fe_copy(minust.yminusx, t->yplusx);
+  fe_neg(minust.xy2d, t->xy2d);
+  ge_precomp_cmov(t, &minust, bnegative);
+}
+
+/**
+ * h = a * B, where a[31] <= 127.  Constant time: the scalar is recoded into 64
+ *  signed radix-16 digits, and each digit costs one table scan and one mixed
+ *  addition regardless of its value.
+ */
+static void
+ge_scalarmult_base(ge_p3 *h, const unsigned char *a)
+{
+  signed char e[64];
+  signed char carry;
+  ge_p1p1 r;
+  ge_p2 s;
+  ge_precomp t;
+  int i;
+
+  for (i = 0; i < 32; i++) {
+    e[2 * i] = a[i] & 15;
+    e[2 * i + 1] = (a[i] >> 4) & 15;
+  }
+  carry = 0;
+  for (i = 0; i < 63; i++) {
+    e[i] += carry;
+    carry = (e[i] + 8) >> 4;
+    e[i] -= carry << 4;
+  }
+  e[63] += carry;
+
+  ge_p3_0(h);
+  for (i = 1; i < 64; i += 2) {
+    ge_select(&t, i / 2, e[i]);
+    ge_madd(&r, h, &t);
+    ge_p1p1_to_p3(h, &r);
+  }
+
+  ge_p3_dbl(&r, h);  ge_p1p1_to_p2(&s, &r);
+  ge_p2_dbl(&r, &s); ge_p1p1_to_p2(&s, &r);
+  ge_p2_dbl(&r, &s); ge_p1p1_to_p2(&s, &r);
+  ge_p2_dbl(&r, &s); ge_p1p1_to_p3(h, &r);
+
+  for (i = 0; i < 64; i += 2) {
+    ge_select(&t, i / 2, e[i]);
+    ge_madd(&r, h, &t);
+    ge_p1p1_to_p3(h, &r);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalars mod l = 2^252 + 27742317777372353535851937790883648493
+//
+// Signing only needs a handful of these per call, so we favor obviously
+//  constant-time schoolbook arithmetic over anything clever.
+
+static const uint32_t L[9] = {
+  0x5cf5d3ed, 0x5812631a, 0xa2f79cd6, 0x14def9de,
+  0x00000000, 0x00000000, 0x00000000, 0x10000000, 0x00000000
+};
+
+/**
+ * out = in mod l, for a little-endian `in` of `inlen` bytes.  We feed in a
+ *  byte at a time; after r = 256r + byte, q = floor(r / 2^252) is within one
+ *  of floor(r / l) (l is only barely bigger than 2^252), so r - ql is in
+ *  (-l, l) and a masked add of l finishes the job.
+ */
+static void
+sc_reduce(unsigned char *out, const unsigned char *in, int inlen)
+{
+  uint32_t r[9];
+  int i, k;
+
+  memset(r, 0, sizeof(r));
+  for (i = inlen - 1; i >= 0; i--) {
+    for (k = 8; k > 0; k--)
+      r[k] = (r[k] << 8) | (r[k - 1] >> 24);
+    r[0] = (r[0] << 8) | in[i];
+
+    uint64_t q = (r[7] >> 28) | (r[8] << 4);
+    int64_t carry = 0;
+    for (k = 0; k < 9; k++) {
+      int64_t t = (int64_t) r[k] - (int64_t) (q * L[k]) + carry;
+      r[k] = (uint32_t) t;
+      carry = t >> 32;
+    }
+
+    uint32_t negative = (uint32_t) carry; // all ones if r went negative
+    uint64_t c = 0;
+    for (k = 0; k < 9; k++) {
+      uint64_t t = (uint64_t) r[k] + (L[k] & negative) + c;
+      r[k] = (uint32_t) t;
+      c = t >> 32;
+    }
+  }
+
+  for (k = 0; k < 8; k++) {
+    out[4 * k] = r[k] & 0xff;
+    out[4 * k + 1] = (r[k] >> 8) & 0xff;
+    out[4 * k + 2] = (r[k] >> 16) & 0xff;
+    out[4 * k + 3] = (r[k] >> 24) & 0xff;
+  }
+}
+
+static void
+sc_load(uint32_t *r, const unsigned char *s)
+{
+  for (int k = 0; k < 8; k++)
+    r[k] = s[4 * k] | (s[4 * k + 1] << 8) | (s[4 * k + 2] << 16) |
+           ((uint32_t) s[4 * k + 3] << 24);
+}
+
+/** s = (a * b + c) mod l, with a, b, c < l. */
+static void
+sc_muladd(unsigned char *s, const unsigned char *a, const unsigned char *b,
+          const unsigned char *c)
+{
+  uint32_t al[8], bl[8], cl[8], p[16];
+  unsigned char wide[64];
+  int i, j;
+
+  sc_load(al, a);
+  sc_load(bl, b);
+  sc_load(cl, c);
+
+  memset(p, 0, sizeof(p));
+  for (i = 0; i < 8; i++) {
+    uint64_t carry = 0;
+    for (j = 0; j < 8; j++) {
+      uint64_t t = (uint64_t) al[i] * bl[j] + p[i + j] + carry;
+      p[i + j] = (uint32_t) t;
+      carry = t >> 32;
+    }
+    p[i + 8] = (uint32_t) carry;
+  }
+
+  uint64_t carry = 0;
+  for (i = 0; i < 16; i++) {
+    uint64_t t = (uint64_t) p[i] + (i < 8 ? cl[i] : 0) + carry;
+    p[i] = (uint32_t) t;
+    carry = t >> 32;
+  }
+
+  for (i = 0; i < 16; i++) {
+    wide[4 * i] = p[i] & 0xff;
+    wide[4 * i + 1] = (p[i] >> 8) & 0xff;
+    wide[4 * i + 2] = (p[i] >> 16) & 0xff;
+    wide[4 * i + 3] = (p[i] >> 24) & 0xff;
+  }
+  sc_reduce(s, wide, 64);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The nacl operations
+
+static void
+sign_pk_from_sk(unsigned char *pk, const unsigned char *sk)
+{
+  unsigned char a[32];
+  ge_p3 A;
+
+  sc_reduce(a, sk, 32);
+  ge_scalarmult_base(&A, a);
+  ge_p3_tobytes(pk, &A);
+}
+
+static void
+fast_sign_keypair(unsigned char *pk, unsigned char *sk)
+{
+  randombytes(sk, 32);
+  crypto_hash_sha512(sk, sk, 32);
+  sk[0] &= 248;
+  sk[31] &= 127;
+  sk[31] |= 64;
+
+  sign_pk_from_sk(pk, sk);
+}
+
+/**
+ * edwards25519sha512batch: R = kB with k = H(sk[32..63], m), then
+ *  s = H(R, m) * k + a.  The signed message is R || m || s.
+ */
+static void
+fast_sign(unsigned char *sm, unsigned long long *smlen,
+          const unsigned char *m, unsigned long long mlen,
+          const unsigned char *sk)
+{
+  unsigned char hmg[crypto_hash_sha512_BYTES];
+  unsigned char hmr[crypto_hash_sha512_BYTES];
+  unsigned char k[32], h[32], a[32];
+  ge_p3 R;
+
+  *smlen = mlen + 64;
+  memmove(sm + 32, m, mlen);
+  memcpy(sm, sk + 32, 32);
+  crypto_hash_sha512(hmg, sm, mlen + 32);
+  sc_reduce(k, hmg, 64);
+
+  ge_scalarmult_base(&R, k);
+  ge_p3_tobytes(sm, &R);
+
+  crypto_hash_sha512(hmr, sm, mlen + 32);
+  sc_reduce(h, hmr, 64);
+  sc_reduce(a, sk, 32);
+  sc_muladd(sm + mlen + 32, h, k, a);
+
+  memset(hmg, 0, sizeof(hmg));
+  memset(k, 0, sizeof(k));
+  memset(a, 0, sizeof(a));
+}
+
+static void
+box_pk_from_sk(unsigned char *pk, const unsigned char *sk)
+{
+  unsigned char e[32];
+  ge_p3 A;
+
+  memcpy(e, sk, 32);
+  e[0] &= 248;
+  e[31] &= 127;
+  e[31] |= 64;
+  ge_scalarmult_base(&A, e);
+  ge_p3_to_montgomery_bytes(pk, &A);
+  memset(e, 0, sizeof(e));
+}
+
+/**
+ * Check ourselves against nacl on a few fresh keys: derive the public keys
+ *  nacl gave us and reproduce its (deterministic) signatures byte for byte.
+ */
+static bool
+self_test()
+{
+  unsigned char pk[crypto_sign_PUBLICKEYBYTES], sk[crypto_sign_SECRETKEYBYTES];
+  unsigned char ourpk[crypto_sign_PUBLICKEYBYTES];
+  unsigned char m[77];
+  unsigned char sm[sizeof(m) + crypto_sign_BYTES];
+  unsigned char oursm[sizeof(m) + crypto_sign_BYTES];
+  unsigned long long smlen, oursmlen;
+  unsigned char bpk[crypto_box_PUBLICKEYBYTES], bsk[crypto_box_SECRETKEYBYTES];
+  unsigned char ourbpk[crypto_box_PUBLICKEYBYTES];
+
+  for (int i = 0; i < 4; i++) {
+    crypto_sign_keypair(pk, sk);
+    sign_pk_from_sk(ourpk, sk);
+    if (memcmp(pk, ourpk, sizeof(pk)))
+      return false;
+
+    randombytes(m, sizeof(m));
+    crypto_sign(sm, &smlen, m, sizeof(m), sk);
+    fast_sign(oursm, &oursmlen, m, sizeof(m), sk);
+    if (smlen != oursmlen || memcmp(sm, oursm, smlen))
+      return false;
+
+    crypto_box_keypair(bpk, bsk);
+    box_pk_from_sk(ourbpk, bsk);
+    if (memcmp(bpk, ourbpk, sizeof(bpk)))
+      return false;
+  }
+  return true;
+}
+
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+static bool usable = false;
+
+static void
+init_fixedbase()
+{
+  build_base_table();
+  usable = self_test();
+}
+
+bool
+fixedbase_available()
+{
+  pthread_once(&initOnce, init_fixedbase);
+  return usable;
+}
+
+#else // !HAVE_FIXEDBASE
+
+bool
+fixedbase_available()
+{
+  return false;
+}
+
+#endif // HAVE_FIXEDBASE
+
+int
+fixedbase_sign_keypair(unsigned char *pk, unsigned char *sk)
+{
+#ifdef HAVE_FIXEDBASE
+  if (fixedbase_available()) {
+    fast_sign_keypair(pk, sk);
+    return 0;
+  }
+#endif
+  return crypto_sign_keypair(pk, sk);
+}
+
+int
+fixedbase_sign(unsigned char *sm, unsigned long long *smlen,
+               const unsigned char *m, unsigned long long mlen,
+               const unsigned char *sk)
+{
+#ifdef HAVE_FIXEDBASE
+  if (fixedbase_available()) {
+    fast_sign(sm, smlen, m, mlen, sk);
+    return 0;
+  }
+#endif
+  return crypto_sign(sm, smlen, m, mlen, sk);
+}
+
+int
+fixedbase_box_keypair(unsigned char *pk, unsigned char *sk)
+{
+#ifdef HAVE_FIXEDBASE
+  if (fixedbase_available()) {
+    randombytes(sk, crypto_box_SECRETKEYBYTES);
+    box_pk_from_sk(pk, sk);
+    return 0;
+  }
+#endif
+  return crypto_box_keypair(pk, sk);
+}
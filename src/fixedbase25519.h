@@ -0,0 +1,81 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NACL_NODE_FIXEDBASE25519_H
+#define NACL_NODE_FIXEDBASE25519_H
+
+/**
+ * Fixed-base scalar multiplication for edwards25519 using precomputed
+ *  signed-window tables, plus the keypair/signing operations that spend most
+ *  of their time in it.  The nacl ref implementations we link against do
+ *  their fixed-base multiplications with the generic variable-base ladder,
+ *  which is several times slower than it needs to be.
+ *
+ * Everything here produces byte-identical results to the nacl functions it
+ *  stands in for.  The first call builds the tables and then cross-checks
+ *  a few keypairs and signatures against the linked nacl; if anything
+ *  disagrees (or the compiler can't give us 128-bit multiplies) every
+ *  function here quietly defers to nacl instead.
+ */
+
+/**
+ * Have the tables been built and did the self-test against nacl pass?
+ *  (Calling any of the functions below will trigger this too.)
+ */
+bool fixedbase_available();
+
+/**
+ * Drop-in for crypto_sign_keypair (edwards25519sha512batch).
+ */
+int fixedbase_sign_keypair(unsigned char *pk, unsigned char *sk);
+
+/**
+ * Drop-in for crypto_sign (edwards25519sha512batch).  `sm` must have room for
+ *  mlen + crypto_sign_BYTES bytes.
+ */
+int fixedbase_sign(unsigned char *sm, unsigned long long *smlen,
+                   const unsigned char *m, unsigned long long mlen,
+                   const unsigned char *sk);
+
+/**
+ * Drop-in for crypto_box_keypair (curve25519xsalsa20poly1305); the curve25519
+ *  public key is computed on the birationally equivalent edwards curve and
+ *  mapped across, so it shares the signing tables.
+ */
+int fixedbase_box_keypair(unsigned char *pk, unsigned char *sk);
+
+#endif // NACL_NODE_FIXEDBASE25519_H
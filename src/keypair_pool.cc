@@ -0,0 +1,199 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <string.h>
+
+#include "randombytes.h"
+
+#include "keypair_pool.h"
+
+KeypairPool::KeypairPool(GenerateFunc generate, unsigned int pkBytes,
+                         unsigned int skBytes)
+  : m_generate(generate), m_pkBytes(pkBytes), m_skBytes(skBytes),
+    m_workerStarted(false),
+    m_ring(NULL), m_head(0), m_count(0), m_lowWater(0), m_highWater(0),
+    m_refilling(false), m_hits(0), m_misses(0)
+{
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_wake, NULL);
+}
+
+const char *
+KeypairPool::configure(unsigned int lowWater, unsigned int highWater)
+{
+  if (lowWater > highWater)
+    return "low_water needs to be <= high_water";
+
+  pthread_mutex_lock(&m_lock);
+  resize(highWater);
+  m_lowWater = lowWater;
+  m_refilling = highWater && m_count < highWater &&
+                (m_count < lowWater || m_count == 0);
+
+  bool startWorker = highWater && !m_workerStarted;
+  if (startWorker)
+    m_workerStarted = true;
+  else
+    pthread_cond_signal(&m_wake);
+  pthread_mutex_unlock(&m_lock);
+
+  if (startWorker) {
+    // randombytes lazily opens /dev/urandom the first time it is called and
+    //  that is not thread-safe, so make sure it happens here and not racing
+    //  with the worker.
+    unsigned char prime;
+    randombytes(&prime, 1);
+
+    pthread_t worker;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rv = pthread_create(&worker, &attr, workerMain, this);
+    pthread_attr_destroy(&attr);
+    if (rv) {
+      // Nobody is going to refill us, so don't pretend to be a pool; the next
+      //  configure() gets to try again.
+      pthread_mutex_lock(&m_lock);
+      m_workerStarted = false;
+      resize(0);
+      m_lowWater = 0;
+      m_refilling = false;
+      pthread_mutex_unlock(&m_lock);
+      return "could not start the keypair pool thread";
+    }
+  }
+  return NULL;
+}
+
+void
+KeypairPool::resize(unsigned int highWater)
+{
+  // Move whatever we have into a ring of the new size, dropping (and wiping)
+  //  anything that no longer fits.
+  Slot *ring = highWater ? new Slot[highWater] : NULL;
+  unsigned int kept = 0;
+  for (unsigned int i = 0; i < m_count; i++) {
+    Slot &old = m_ring[(m_head + i) % m_highWater];
+    if (kept < highWater)
+      memcpy(ring[kept++].bytes, old.bytes, sizeof(old.bytes));
+    memset(old.bytes, 0, sizeof(old.bytes));
+  }
+  delete[] m_ring;
+
+  m_ring = ring;
+  m_head = 0;
+  m_count = kept;
+  m_highWater = highWater;
+}
+
+bool
+KeypairPool::take(std::string *pk, std::string *sk)
+{
+  pthread_mutex_lock(&m_lock);
+  if (!m_highWater) {
+    pthread_mutex_unlock(&m_lock);
+    return false;
+  }
+  if (!m_count) {
+    m_misses++;
+    m_refilling = true;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_lock);
+    return false;
+  }
+
+  Slot &slot = m_ring[m_head];
+  pk->assign(reinterpret_cast<char *>(slot.bytes), m_pkBytes);
+  sk->assign(reinterpret_cast<char *>(slot.bytes) + m_pkBytes, m_skBytes);
+  memset(slot.bytes, 0, sizeof(slot.bytes));
+  m_head = (m_head + 1) % m_highWater;
+  m_count--;
+  m_hits++;
+
+  if (m_count < m_lowWater && !m_refilling) {
+    m_refilling = true;
+    pthread_cond_signal(&m_wake);
+  }
+  pthread_mutex_unlock(&m_lock);
+  return true;
+}
+
+void
+KeypairPool::stats(Stats *out)
+{
+  pthread_mutex_lock(&m_lock);
+  out->lowWater = m_lowWater;
+  out->highWater = m_highWater;
+  out->available = m_count;
+  out->hits = m_hits;
+  out->misses = m_misses;
+  pthread_mutex_unlock(&m_lock);
+}
+
+void *
+KeypairPool::workerMain(void *arg)
+{
+  static_cast<KeypairPool *>(arg)->runWorker();
+  return NULL;
+}
+
+void
+KeypairPool::runWorker()
+{
+  Slot fresh;
+
+  pthread_mutex_lock(&m_lock);
+  for (;;) {
+    while (!m_refilling || m_count >= m_highWater) {
+      m_refilling = false;
+      pthread_cond_wait(&m_wake, &m_lock);
+    }
+
+    // Generate without holding the lock so take() never waits on us.
+    pthread_mutex_unlock(&m_lock);
+    m_generate(fresh.bytes, fresh.bytes + m_pkBytes);
+    pthread_mutex_lock(&m_lock);
+
+    // (configure() may have shrunk or disabled us while we were busy.)
+    if (m_count < m_highWater) {
+      memcpy(m_ring[(m_head + m_count) % m_highWater].bytes, fresh.bytes,
+             sizeof(fresh.bytes));
+      m_count++;
+    }
+    memset(fresh.bytes, 0, sizeof(fresh.bytes));
+  }
+}
@@ -0,0 +1,119 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NACL_NODE_KEYPAIR_POOL_H
+#define NACL_NODE_KEYPAIR_POOL_H
+
+#include <pthread.h>
+
+#include <string>
+
+/** Large enough for any of the public/secret keypairs we pool. */
+#define KEYPAIR_POOL_MAX_BYTES 128
+
+/**
+ * A bounded ring buffer of pre-generated keypairs that a background thread
+ *  keeps topped up.  Keypair generation is a fixed-base scalar multiplication
+ *  plus a trip to randombytes, which is not something we want to be doing on
+ *  the event loop for every ephemeral key.
+ *
+ * The worker thread starts refilling once the pool drops below `lowWater` and
+ *  keeps going until it hits `highWater`.  Taking a keypair is O(1) and never
+ *  blocks on generation; if the pool is empty the caller gets told to go
+ *  generate its own keypair synchronously.
+ *
+ * The pool is disabled (and empty) until someone calls configure() with a
+ *  non-zero high watermark.
+ */
+class KeypairPool {
+public:
+  typedef int (*GenerateFunc)(unsigned char *pk, unsigned char *sk);
+
+  KeypairPool(GenerateFunc generate, unsigned int pkBytes,
+              unsigned int skBytes);
+
+  /**
+   * (Re)configure the watermarks, starting the worker thread if this is the
+   *  first time we are enabled.  A highWater of 0 disables the pool and
+   *  discards any keypairs it was holding.
+   *
+   * @return NULL on success, otherwise what went wrong: the watermarks make no
+   *  sense or the worker thread could not be started.  In the latter case the
+   *  pool is left disabled, just as if highWater had been 0.
+   */
+  const char *configure(unsigned int lowWater, unsigned int highWater);
+
+  /**
+   * Pop a keypair out of the pool if there is one.  Returns false on a miss,
+   *  in which case pk/sk are left untouched.
+   */
+  bool take(std::string *pk, std::string *sk);
+
+  struct Stats {
+    unsigned int lowWater, highWater, available;
+    unsigned long long hits, misses;
+  };
+  void stats(Stats *out);
+
+private:
+  struct Slot {
+    unsigned char bytes[KEYPAIR_POOL_MAX_BYTES];
+  };
+
+  /** Swap in a ring of `highWater` slots; called with m_lock held. */
+  void resize(unsigned int highWater);
+
+  static void *workerMain(void *arg);
+  void runWorker();
+
+  GenerateFunc m_generate;
+  unsigned int m_pkBytes, m_skBytes;
+
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_wake;
+  bool m_workerStarted;
+
+  // everything below here is protected by m_lock
+  Slot *m_ring;
+  unsigned int m_head, m_count;
+  unsigned int m_lowWater, m_highWater;
+  /** Has the worker been told to fill all the way up to the high watermark? */
+  bool m_refilling;
+  unsigned long long m_hits, m_misses;
+};
+
+#endif // NACL_NODE_KEYPAIR_POOL_H
@@ -0,0 +1,988 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NACL_NODE_BINDING_H
+#define NACL_NODE_BINDING_H
+
+#include <string.h>
+
+#include <string>
+
+#include <v8.h>
+
+#include <node.h>
+#include <node_buffer.h>
+
+#include "capture.h"
+#include "codec.h"
+
+/**
+ * The binding layer.  Every nacl_* function used to be a hand-copied variant
+ *  built from macros that turned each argument into a std::string; this header
+ *  replaces those with argument classes that know their own size and encoding,
+ *  plus templated bindings ("shapes") parameterized on a primitive's traits.
+ *  nacl_node.cc describes each primitive once and instantiates the shapes.
+ *
+ * The argument classes take Buffers in place (a monomorphic pointer + length,
+ *  no copying) and only run the string decoding when they actually get a
+ *  string.  Keys and nonces have a compile-time size and live on the stack;
+ *  messages and results live on the stack too unless they are big.
+ *
+ * Error messages and the order in which things get checked match the nacl
+ *  C++ API we used to call, so nothing JS-visible changed.
+ *
+ * Most bindings also take an optional trailing `encoding` argument; see
+ *  ArgReader::readFormats.
+ */
+
+/** Bytes a ScratchBuffer holds inline before it goes to the heap. */
+#define BINDING_INLINE_BYTES 256
+
+/**
+ * Scratch space for a decoded argument or a result: on the stack when it is
+ *  small, which is almost always, and on the heap otherwise.
+ */
+class ScratchBuffer {
+public:
+  explicit ScratchBuffer(size_t size = 0)
+    : m_data(m_inline), m_size(0)
+  {
+    if (size)
+      allocate(size);
+  }
+  ~ScratchBuffer()
+  {
+    if (m_data != m_inline)
+      delete[] m_data;
+  }
+
+  /**
+   * Make room for `size` bytes, discarding whatever was there before.
+   */
+  unsigned char *allocate(size_t size)
+  {
+    if (m_data != m_inline)
+      delete[] m_data;
+    m_data = size > sizeof(m_inline) ? new unsigned char[size] : m_inline;
+    m_size = size;
+    return m_data;
+  }
+
+  unsigned char *data() { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  ScratchBuffer(const ScratchBuffer &);
+  ScratchBuffer &operator=(const ScratchBuffer &);
+
+  unsigned char m_inline[BINDING_INLINE_BYTES];
+  unsigned char *m_data;
+  size_t m_size;
+};
+
+/** Results at least this long get encoded straight into an external string. */
+#define BINDING_EXTERNAL_TEXT_BYTES 1024
+
+////////////////////////////////////////////////////////////////////////////////
+// Formats
+
+/**
+ * How binary strings are encoded, going in and coming out.  Buffers always go
+ *  in as raw bytes whatever the format; FORMAT_BUFFER means results come out
+ *  as Buffers (and strings go in as binary).
+ */
+enum ByteFormat {
+  FORMAT_BINARY,
+  FORMAT_BUFFER,
+  FORMAT_HEX,
+  FORMAT_BASE64,
+  FORMAT_BASE64URL
+};
+
+inline bool
+format_is_text(ByteFormat format)
+{
+  return format >= FORMAT_HEX;
+}
+
+inline TextCodec
+format_codec(ByteFormat format)
+{
+  switch (format) {
+    case FORMAT_HEX:
+      return CODEC_HEX;
+    case FORMAT_BASE64:
+      return CODEC_BASE64;
+    default:
+      return CODEC_BASE64URL;
+  }
+}
+
+/**
+ * The characters of a hex/base64 string argument, pulled out for decoding.
+ *  They are as secret as what they decode to (FixedBinArg keys come through
+ *  here), so they get wiped on the way out.
+ */
+class EncodedString {
+public:
+  EncodedString() : m_size(0) {}
+  ~EncodedString()
+  {
+    if (m_chars.size())
+      memset(m_chars.data(), 0, m_chars.size());
+  }
+
+  /**
+   * Returns false if the string has anything but ASCII in it; no valid
+   *  encoding does, and we must not let a wide character get truncated into
+   *  something that looks valid.
+   */
+  bool read(v8::Handle<v8::Value> v)
+  {
+    v8::Local<v8::String> s = v->ToString();
+    m_size = s->Length();
+    if (static_cast<size_t>(s->Utf8Length()) != m_size)
+      return false;
+    char *p = reinterpret_cast<char *>(m_chars.allocate(m_size + 1));
+    s->WriteAscii(p, 0, m_size + 1);
+    return true;
+  }
+
+  bool decodedLength(ByteFormat format, size_t *len) const
+  {
+    return codec_decoded_length(format_codec(format), chars(), m_size, len);
+  }
+  /** `out` needs decodedLength() bytes of room. */
+  bool decode(ByteFormat format, unsigned char *out) const
+  {
+    return codec_decode(format_codec(format), out, chars(), m_size);
+  }
+
+private:
+  EncodedString(const EncodedString &);
+  EncodedString &operator=(const EncodedString &);
+
+  const char *chars() const
+  {
+    return reinterpret_cast<const char *>(
+             const_cast<ScratchBuffer &>(m_chars).data());
+  }
+
+  ScratchBuffer m_chars;
+  size_t m_size;
+};
+
+/**
+ * The tail of the type error for a binary argument, which depends on what
+ *  format strings were supposed to be in.
+ */
+inline const char *
+expected_binary(ByteFormat format)
+{
+  switch (format) {
+    case FORMAT_HEX:
+      return " needs to be a hex string or buffer";
+    case FORMAT_BASE64:
+      return " needs to be a base64 string or buffer";
+    case FORMAT_BASE64URL:
+      return " needs to be a base64url string or buffer";
+    default:
+      return " needs to be a binary string or buffer";
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Argument kinds
+//
+// Each one has coerce(value, format), which returns false if the value is the
+//  wrong type (or, for binary arguments, a string that isn't valid in
+//  `format`); expected(format), the tail of the message for when it was; and
+//  captureSize(), what gets recorded for the workload capture.  Kinds that
+//  aren't binary ignore the format.
+
+/**
+ * A binary string or Buffer of any length, such as a message.  `PAD` zero
+ *  bytes are laid out in front of the data for the primitives that want their
+ *  input padded (box and secretbox); with no padding a Buffer is used in place.
+ */
+template <size_t PAD = 0>
+class BinArg {
+public:
+  BinArg() : m_data(NULL), m_size(0) {}
+
+  bool coerce(v8::Handle<v8::Value> v, ByteFormat format)
+  {
+    if (node::Buffer::HasInstance(v)) {
+      v8::Local<v8::Object> buf = v->ToObject();
+      const unsigned char *bytes =
+        reinterpret_cast<const unsigned char *>(node::Buffer::Data(buf));
+      m_size = node::Buffer::Length(buf);
+      if (!PAD) {
+        m_data = bytes;
+        return true;
+      }
+      unsigned char *p = m_storage.allocate(PAD + m_size);
+      memset(p, 0, PAD);
+      if (m_size)
+        memcpy(p + PAD, bytes, m_size);
+      m_data = p + PAD;
+      return true;
+    }
+    if (v->IsString() && format_is_text(format)) {
+      // (decoded straight into place behind the padding)
+      EncodedString text;
+      if (!text.read(v) || !text.decodedLength(format, &m_size))
+        return false;
+      unsigned char *p = m_storage.allocate(PAD + m_size);
+      memset(p, 0, PAD);
+      m_data = p + PAD;
+      return text.decode(format, p + PAD);
+    }
+    if (v->IsString()) {
+      m_size = node::DecodeBytes(v, node::BINARY);
+      unsigned char *p = m_storage.allocate(PAD + m_size);
+      memset(p, 0, PAD);
+      node::DecodeWrite(reinterpret_cast<char *>(p + PAD), m_size, v,
+                        node::BINARY);
+      m_data = p + PAD;
+      return true;
+    }
+    return false;
+  }
+  static const char *expected(ByteFormat format)
+  {
+    return expected_binary(format);
+  }
+  unsigned long long captureSize() const { return m_size; }
+
+  const unsigned char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  /** The data including the PAD zero bytes in front of it. */
+  const unsigned char *padded() const { return m_data - PAD; }
+  size_t paddedSize() const { return m_size + PAD; }
+
+private:
+  const unsigned char *m_data;
+  size_t m_size;
+  ScratchBuffer m_storage;
+};
+
+/**
+ * A JS string, utf8-encoded, for messages that are more than just ASCII.  Like
+ *  the std::string conversion we used to do, it stops at the first NUL.
+ *  Padded the same way as BinArg.
+ */
+template <size_t PAD = 0>
+class Utf8Arg {
+public:
+  Utf8Arg() : m_data(NULL), m_size(0) {}
+
+  bool coerce(v8::Handle<v8::Value> v, ByteFormat)
+  {
+    if (!v->IsString())
+      return false;
+    v8::Local<v8::String> s = v->ToString();
+    size_t nbytes = s->Utf8Length();
+    unsigned char *p = m_storage.allocate(PAD + nbytes + 1);
+    memset(p, 0, PAD);
+    char *dest = reinterpret_cast<char *>(p + PAD);
+    s->WriteUtf8(dest, nbytes + 1);
+    dest[nbytes] = '\0';
+    m_data = p + PAD;
+    m_size = strlen(dest);
+    return true;
+  }
+  static const char *expected(ByteFormat) { return " needs to be a string"; }
+  unsigned long long captureSize() const { return m_size; }
+
+  const unsigned char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  /** Always NUL-terminated. */
+  const char *c_str() const { return reinterpret_cast<const char *>(m_data); }
+  const unsigned char *padded() const { return m_data - PAD; }
+  size_t paddedSize() const { return m_size + PAD; }
+
+private:
+  const unsigned char *m_data;
+  size_t m_size;
+  ScratchBuffer m_storage;
+};
+
+/**
+ * A binary string or Buffer that has to be exactly N bytes, like a key or a
+ *  nonce.  A wrong length is not a coercion failure; the binding checks
+ *  rightSize() itself so the length errors come out in the order nacl raises
+ *  them.  Strings get decoded onto the stack and wiped afterwards.
+ */
+template <size_t N>
+class FixedBinArg {
+public:
+  FixedBinArg() : m_data(NULL), m_size(0) {}
+  ~FixedBinArg()
+  {
+    if (m_data == m_bytes)
+      memset(m_bytes, 0, N);
+  }
+
+  bool coerce(v8::Handle<v8::Value> v, ByteFormat format)
+  {
+    if (node::Buffer::HasInstance(v)) {
+      v8::Local<v8::Object> buf = v->ToObject();
+      m_size = node::Buffer::Length(buf);
+      if (m_size == N)
+        m_data = reinterpret_cast<const unsigned char *>(
+                   node::Buffer::Data(buf));
+      return true;
+    }
+    if (v->IsString() && format_is_text(format)) {
+      // (a well-formed string of the wrong length is a length error, like it
+      //  would be in binary)
+      EncodedString text;
+      if (!text.read(v) || !text.decodedLength(format, &m_size))
+        return false;
+      if (m_size != N)
+        return true;
+      m_data = m_bytes;
+      if (!text.decode(format, m_bytes)) {
+        m_size = 0;
+        return false;
+      }
+      return true;
+    }
+    if (v->IsString()) {
+      m_size = node::DecodeBytes(v, node::BINARY);
+      if (m_size == N) {
+        node::DecodeWrite(reinterpret_cast<char *>(m_bytes), N, v,
+                          node::BINARY);
+        m_data = m_bytes;
+      }
+      return true;
+    }
+    return false;
+  }
+  static const char *expected(ByteFormat format)
+  {
+    return expected_binary(format);
+  }
+  unsigned long long captureSize() const { return m_size; }
+
+  bool rightSize() const { return m_size == N; }
+  /** Only valid when rightSize(). */
+  const unsigned char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  FixedBinArg(const FixedBinArg &);
+  FixedBinArg &operator=(const FixedBinArg &);
+
+  const unsigned char *m_data;
+  size_t m_size;
+  unsigned char m_bytes[N];
+};
+
+/**
+ * A count or length.  Because we are not fancy and don't actually need the
+ *  expressive range, we require it to be a uint32.
+ */
+class Uint32Arg {
+public:
+  Uint32Arg() : m_value(0) {}
+
+  bool coerce(v8::Handle<v8::Value> v, ByteFormat)
+  {
+    if (!v->IsUint32())
+      return false;
+    m_value = v->Uint32Value();
+    return true;
+  }
+  static const char *expected(ByteFormat) { return " needs to be a uint32"; }
+  unsigned long long captureSize() const { return m_value; }
+
+  unsigned long long value() const { return m_value; }
+
+private:
+  unsigned long long m_value;
+};
+
+/**
+ * Like Uint32Arg, but for the rare value that can legitimately outgrow a
+ *  uint32 (like a block counter into a huge stream), so we take any
+ *  non-negative integer a JS number can hold exactly.
+ */
+class U53Arg {
+public:
+  U53Arg() : m_value(0) {}
+
+  bool coerce(v8::Handle<v8::Value> v, ByteFormat)
+  {
+    if (!v->IsNumber())
+      return false;
+    double d = v->NumberValue();
+    if (d < 0 || d > 9007199254740991.0 ||
+        d != static_cast<double>(v->IntegerValue()))
+      return false;
+    m_value = v->IntegerValue();
+    return true;
+  }
+  static const char *expected(ByteFormat)
+  {
+    return " needs to be a non-negative integer";
+  }
+  unsigned long long captureSize() const { return m_value; }
+
+  unsigned long long value() const { return m_value; }
+
+private:
+  unsigned long long m_value;
+};
+
+/**
+ * A (buffer, offset, length) run of arguments resolved to a pointer into the
+ *  buffer's own memory, for operations that work in place.  Read with
+ *  ArgReader::readRange.
+ */
+class BufferRangeArg {
+public:
+  BufferRangeArg() : m_data(NULL), m_size(0) {}
+
+  unsigned char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  friend class ArgReader;
+
+  unsigned char *m_data;
+  size_t m_size;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Errors and results
+
+/**
+ * How a binding reports failure: raise(msg) notes the failure for the capture
+ *  and throws, handing back the value for the binding to return.  make(msg)
+ *  just builds the error, for handing to a callback.
+ */
+struct PlainError {
+  static v8::Local<v8::Value> make(const char *msg)
+  {
+    return v8::Exception::Error(v8::String::New(msg));
+  }
+  static v8::Handle<v8::Value> raise(const char *msg)
+  {
+    CallCapture::noteFailure();
+    return v8::ThrowException(make(msg));
+  }
+};
+
+/** PlainError, but a TypeError, for when `this` is not what we wanted. */
+struct PlainTypeError {
+  static v8::Local<v8::Value> make(const char *msg)
+  {
+    return v8::Exception::TypeError(v8::String::New(msg));
+  }
+  static v8::Handle<v8::Value> raise(const char *msg)
+  {
+    CallCapture::noteFailure();
+    return v8::ThrowException(make(msg));
+  }
+};
+
+/**
+ * For our own error classes; `Class::func()` returns the constructor.
+ */
+template <class Class>
+struct CustomError {
+  static v8::Local<v8::Value> make(const char *msg)
+  {
+    v8::Local<v8::Value> argv[] = { v8::String::New(msg) };
+    return Class::func()->NewInstance(1, argv);
+  }
+  static v8::Handle<v8::Value> raise(const char *msg)
+  {
+    v8::Local<v8::Value> err = make(msg);
+    CallCapture::noteFailure();
+    return v8::ThrowException(err);
+  }
+};
+
+/**
+ * A string V8 reads straight out of our memory, so a big hex/base64 result
+ *  gets encoded exactly once, into the string itself.  V8 deletes it when the
+ *  string goes away.
+ */
+class ExternalText : public v8::String::ExternalAsciiStringResource {
+public:
+  explicit ExternalText(size_t length)
+    : m_data(new char[length]), m_length(length)
+  {
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(static_cast<int>(length));
+  }
+  ~ExternalText()
+  {
+    delete[] m_data;
+    v8::V8::AdjustAmountOfExternalAllocatedMemory(
+      -static_cast<int>(m_length));
+  }
+
+  const char *data() const { return m_data; }
+  size_t length() const { return m_length; }
+  char *buffer() { return m_data; }
+
+private:
+  char *m_data;
+  size_t m_length;
+};
+
+/**
+ * The encodings.  In<PAD>::Arg is the argument kind for a message in that
+ *  encoding and out() turns result bytes into a JS value.  Keys, nonces and
+ *  ciphertexts are always Binary.
+ */
+struct Binary {
+  template <size_t PAD> struct In { typedef BinArg<PAD> Arg; };
+
+  static v8::Local<v8::Value> out(const unsigned char *p, size_t len,
+                                  ByteFormat format = FORMAT_BINARY)
+  {
+    if (format == FORMAT_BUFFER) {
+      node::Buffer *buf = node::Buffer::New(
+        reinterpret_cast<char *>(const_cast<unsigned char *>(p)), len);
+      return v8::Local<v8::Value>::New(buf->handle_);
+    }
+    if (!format_is_text(format))
+      return node::Encode(p, len, node::BINARY);
+
+    TextCodec codec = format_codec(format);
+    size_t textLen = codec_encoded_length(codec, len);
+    if (textLen < BINDING_EXTERNAL_TEXT_BYTES) {
+      ScratchBuffer text(textLen);
+      codec_encode(codec, reinterpret_cast<char *>(text.data()), p, len);
+      return v8::String::New(reinterpret_cast<char *>(text.data()),
+                             static_cast<int>(textLen));
+    }
+    ExternalText *text = new ExternalText(textLen);
+    codec_encode(codec, text->buffer(), p, len);
+    return v8::String::NewExternal(text);
+  }
+  static v8::Local<v8::Value> out(const std::string &s,
+                                  ByteFormat format = FORMAT_BINARY)
+  {
+    return out(reinterpret_cast<const unsigned char *>(s.data()), s.length(),
+               format);
+  }
+};
+
+struct Utf8 {
+  template <size_t PAD> struct In { typedef Utf8Arg<PAD> Arg; };
+
+  /** (Text comes out as text whatever the format.) */
+  static v8::Local<v8::Value> out(const unsigned char *p, size_t len,
+                                  ByteFormat = FORMAT_BINARY)
+  {
+    return node::Encode(p, len, node::UTF8);
+  }
+};
+
+/**
+ * Walks the arguments in order, coercing each into its argument class and
+ *  noting its size for the capture.  On a type error read() returns false
+ *  and failure() holds the exception to return.
+ */
+class ArgReader {
+public:
+  explicit ArgReader(const v8::Arguments &args)
+    : m_args(args), m_next(0), m_input(FORMAT_BINARY), m_output(FORMAT_BINARY)
+  {}
+
+  /**
+   * Pick up the optional `encoding` argument at position `n`, if there is
+   *  one, before reading anything else.  It is 'binary' (the default),
+   *  'buffer', 'hex', 'base64' or 'base64url' for both directions, or
+   *  {input: ..., output: ...} to choose separately (either can be left out).
+   *  The input format applies to every binary string argument and the output
+   *  format to every binary result.
+   */
+  bool readFormats(int n)
+  {
+    if (m_args.Length() <= n)
+      return true;
+    v8::Local<v8::Value> v = m_args[n];
+    bool ok;
+    if (v->IsString()) {
+      ok = parseFormat(v, &m_input);
+      m_output = m_input;
+    }
+    else if (v->IsObject() && !v->IsArray()) {
+      v8::Local<v8::Object> obj = v->ToObject();
+      v8::Local<v8::Value> input = obj->Get(v8::String::NewSymbol("input"));
+      v8::Local<v8::Value> output = obj->Get(v8::String::NewSymbol("output"));
+      ok = (input->IsUndefined() || parseFormat(input, &m_input)) &&
+           (output->IsUndefined() || parseFormat(output, &m_output));
+    }
+    else {
+      ok = false;
+    }
+    if (!ok)
+      return fail("encoding", " needs to be 'binary', 'buffer', 'hex', "
+                              "'base64' or 'base64url'");
+    return true;
+  }
+
+  ByteFormat input() const { return m_input; }
+  ByteFormat output() const { return m_output; }
+
+  template <class Arg>
+  bool read(Arg &arg, const char *label)
+  {
+    int narg = m_next++;
+    if (!arg.coerce(m_args[narg], m_input))
+      return fail(label, Arg::expected(m_input));
+    CallCapture::noteArgSize(narg, arg.captureSize());
+    return true;
+  }
+
+  /**
+   * Read a buffer and the offset and length that follow it.  The capture
+   *  records the length of the range in the buffer's slot.
+   */
+  bool readRange(BufferRangeArg &arg, const char *label)
+  {
+    int nbuf = m_next++;
+    if (!node::Buffer::HasInstance(m_args[nbuf]))
+      return fail(label, " needs to be a buffer");
+    Uint32Arg offset, length;
+    if (!read(offset, (std::string(label) + "_offset").c_str()) ||
+        !read(length, (std::string(label) + "_length").c_str()))
+      return false;
+    v8::Local<v8::Object> buf = m_args[nbuf]->ToObject();
+    if (offset.value() + length.value() > node::Buffer::Length(buf))
+      return fail(label, " range does not fit in the buffer");
+    CallCapture::noteArgSize(nbuf, length.value());
+    arg.m_data = reinterpret_cast<unsigned char *>(node::Buffer::Data(buf)) +
+                 offset.value();
+    arg.m_size = length.value();
+    return true;
+  }
+
+  v8::Handle<v8::Value> failure() const { return m_failure; }
+
+private:
+  static bool parseFormat(v8::Handle<v8::Value> v, ByteFormat *format)
+  {
+    static const struct {
+      const char *name;
+      ByteFormat format;
+    } names[] = {
+      { "binary", FORMAT_BINARY },
+      { "buffer", FORMAT_BUFFER },
+      { "hex", FORMAT_HEX },
+      { "base64", FORMAT_BASE64 },
+      { "base64url", FORMAT_BASE64URL }
+    };
+    if (!v->IsString())
+      return false;
+    v8::String::AsciiValue name(v);
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+      if (!strcmp(*name, names[i].name)) {
+        *format = names[i].format;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool fail(const char *label, const char *what)
+  {
+    m_failure = PlainError::raise((std::string(label) + what).c_str());
+    return false;
+  }
+
+  const v8::Arguments &m_args;
+  int m_next;
+  ByteFormat m_input, m_output;
+  v8::Handle<v8::Value> m_failure;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Shapes
+//
+// Each shape is a whole binding, instantiated per primitive, encoding and
+//  capture op.  The primitive traits it expects are described above each one;
+//  see nacl_node.cc for the instances.  Key arguments come as a `Keys` struct
+//  with read(ArgReader &) and check(), which returns the message for the first
+//  key of the wrong length, or NULL.
+
+/**
+ * Authenticated encryption with a nonce (box, secretbox).  Wants:
+ *  NONCEBYTES, ZEROBYTES, BOXZEROBYTES, Keys, sealUsage(), openUsage(),
+ *  seal(c, m, mlen, n, keys) and open(m, c, clen, n, keys) on padded data,
+ *  and OpenError.
+ */
+template <class P, class Enc, CaptureOp OP>
+v8::Handle<v8::Value>
+bind_seal(const v8::Arguments &args)
+{
+  v8::HandleScope scope;
+  CallCapture capture_(OP);
+
+  const int nargs = 2 + P::Keys::COUNT;
+  if (args.Length() != nargs && args.Length() != nargs + 1)
+    return PlainError::raise(P::sealUsage());
+  typename Enc::template In<P::ZEROBYTES>::Arg m;
+  FixedBinArg<P::NONCEBYTES> n;
+  typename P::Keys keys;
+  ArgReader in(args);
+  if (!in.readFormats(nargs) || !in.read(m, "message") ||
+      !in.read(n, "nonce") || !keys.read(in))
+    return in.failure();
+
+  const char *bad = keys.check();
+  if (!bad && !n.rightSize())
+    bad = "incorrect nonce length";
+  if (bad)
+    return PlainError::raise(bad);
+
+  ScratchBuffer c(m.paddedSize());
+  P::seal(c.data(), m.padded(), m.paddedSize(), n.data(), keys);
+  return scope.Close(Binary::out(c.data() + P::BOXZEROBYTES,
+                                 c.size() - P::BOXZEROBYTES, in.output()));
+}
+
+template <class P, class Enc, CaptureOp OP>
+v8::Handle<v8::Value>
+bind_open(const v8::Arguments &args)
+{
+  v8::HandleScope scope;
+  CallCapture capture_(OP);
+
+  const int nargs = 2 + P::Keys::COUNT;
+  if (args.Length() != nargs && args.Length() != nargs + 1)
+    return PlainError::raise(P::openUsage());
+  BinArg<P::BOXZEROBYTES> c;
+  FixedBinArg<P::NONCEBYTES> n;
+  typename P::Keys keys;
+  ArgReader in(args);
+  if (!in.readFormats(nargs) || !in.read(c, "ciphertext_message") ||
+      !in.read(n, "nonce") || !keys.read(in))
+    return in.failure();
+
+  const char *bad = keys.check();
+  if (!bad && !n.rightSize())
+    bad = "incorrect nonce length";
+  if (bad)
+    return P::OpenError::raise(bad);
+
+  ScratchBuffer m(c.paddedSize());
+  if (P::open(m.data(), c.padded(), c.paddedSize(), n.data(), keys) != 0)
+    return P::OpenError::raise("ciphertext fails verification");
+  // (open fails first, but this is what the nacl C++ API would say)
+  if (m.size() < P::ZEROBYTES)
+    return P::OpenError::raise("ciphertext too short");
+  return scope.Close(Enc::out(m.data() + P::ZEROBYTES,
+                              m.size() - P::ZEROBYTES, in.output()));
+}
+
+/**
+ * Signatures.  Wants: BYTES, SignKeys, OpenKeys, sign(sm, &smlen, m, mlen,
+ *  keys), open(m, &mlen, sm, smlen, keys), payload(sm) for the message inside
+ *  a signed blob, and OpenError.
+ */
+template <class P, class Enc, CaptureOp OP>
+v8::Handle<v8::Value>
+bind_sign(const v8::Arguments &args)
+{
+  v8::HandleScope scope;
+  CallCapture capture_(OP);
+
+  const int nargs = 1 + P::SignKeys::COUNT;
+  if (args.Length() != nargs && args.Length() != nargs + 1)
+    return PlainError::raise("Need 2 string args: message, secretkey");
+  typename Enc::template In<0>::Arg m;
+  typename P::SignKeys keys;
+  ArgReader in(args);
+  if (!in.readFormats(nargs) || !in.read(m, "message") || !keys.read(in))
+    return in.failure();
+
+  if (const char *bad = keys.check())
+    return PlainError::raise(bad);
+
+  ScratchBuffer sm(m.size() + P::BYTES);
+  unsigned long long smlen;
+  P::sign(sm.data(), &smlen, m.data(), m.size(), keys);
+  return scope.Close(Binary::out(sm.data(), smlen, in.output()));
+}
+
+template <class P, class Enc, CaptureOp OP>
+v8::Handle<v8::Value>
+bind_sign_open(const v8::Arguments &args)
+{
+  v8::HandleScope scope;
+  CallCapture capture_(OP);
+
+  const int nargs = 1 + P::OpenKeys::COUNT;
+  if (args.Length() != nargs && args.Length() != nargs + 1)
+    return PlainError::raise("Need 2 string args: signed_message, public_key");
+  BinArg<> sm;
+  typename P::OpenKeys keys;
+  ArgReader in(args);
+  if (!in.readFormats(nargs) || !in.read(sm, "signed_message") ||
+      !keys.read(in))
+    return in.failure();
+
+  // IMPORTANT!  nacl does not validate the size of 'sm' itself and is
+  //  vulnerable to a crash-inducing unsigned wraparound.  So we explode
+  //  for any input that is less than the minimum message size.
+  if (sm.size() < P::BYTES)
+    return P::OpenError::raise(
+      "message is smaller than the minimum signed message size");
+  if (const char *bad = keys.check())
+    return P::OpenError::raise(bad);
+
+  ScratchBuffer m(sm.size());
+  unsigned long long mlen;
+  if (P::open(m.data(), &mlen, sm.data(), sm.size(), keys) != 0)
+    return P::OpenError::raise("ciphertext fails verification");
+  return scope.Close(Enc::out(m.data(), mlen, in.output()));
+}
+
+/**
+ * Let us see the payload of the signed blob before authenticating it.  This
+ *  allows us to use the contents to figure out what public key we should be
+ *  using to authenticate the blob, etc.  Obviously, for a malformed message
+ *  what you may get is gibberish.
+ */
+template <class P, class Enc, CaptureOp OP>
+v8::Handle<v8::Value>
+bind_sign_peek(const v8::Arguments &args)
+{
+  v8::HandleScope scope;
+  CallCapture capture_(OP);
+
+  if (args.Length() != 1 && args.Length() != 2)
+    return PlainError::raise("Need 1 string arg: signed_message");
+  BinArg<> sm;
+  ArgReader in(args);
+  if (!in.readFormats(1) || !in.read(sm, "signed_message"))
+    return in.failure();
+
+  if (sm.size() < P::BYTES)
+    return P::OpenError::raise(
+      "message is smaller than the minimum signed message size");
+  return scope.Close(Enc::out(P::payload(sm.data()), sm.size() - P::BYTES,
+                              in.output()));
+}
+
+/**
+ * Authenticators.  Wants: BYTES, Keys, mac(a, m, mlen, keys),
+ *  verify(a, m, mlen, keys) and VerifyError.
+ */
+template <class P, class Enc, CaptureOp OP>
+v8::Handle<v8::Value>
+bind_mac(const v8::Arguments &args)
+{
+  v8::HandleScope scope;
+  CallCapture capture_(OP);
+
+  const int nargs = 1 + P::Keys::COUNT;
+  if (args.Length() != nargs && args.Length() != nargs + 1)
+    return PlainError::raise("Need 2 args: message, key");
+  typename Enc::template In<0>::Arg m;
+  typename P::Keys keys;
+  ArgReader in(args);
+  if (!in.readFormats(nargs) || !in.read(m, "message") || !keys.read(in))
+    return in.failure();
+
+  if (const char *bad = keys.check())
+    return PlainError::raise(bad);
+
+  unsigned char a[P::BYTES];
+  P::mac(a, m.data(), m.size(), keys);
+  return scope.Close(Binary::out(a, sizeof(a), in.output()));
+}
+
+template <class P, class Enc, CaptureOp OP>
+v8::Handle<v8::Value>
+bind_mac_verify(const v8::Arguments &args)
+{
+  v8::HandleScope scope;
+  CallCapture capture_(OP);
+
+  const int nargs = 2 + P::Keys::COUNT;
+  if (args.Length() != nargs && args.Length() != nargs + 1)
+    return PlainError::raise("Need 3 args: authenticator, message, key");
+  FixedBinArg<P::BYTES> a;
+  typename Enc::template In<0>::Arg m;
+  typename P::Keys keys;
+  ArgReader in(args);
+  if (!in.readFormats(nargs) || !in.read(a, "authenticator") ||
+      !in.read(m, "message") || !keys.read(in))
+    return in.failure();
+
+  const char *bad = keys.check();
+  if (!bad && !a.rightSize())
+    bad = "incorrect authenticator length";
+  if (bad)
+    return P::VerifyError::raise(bad);
+  if (P::verify(a.data(), m.data(), m.size(), keys) != 0)
+    return P::VerifyError::raise("invalid authenticator");
+  return scope.Close(v8::Undefined());
+}
+
+/**
+ * Hashes.  Wants: BYTES and hash(h, m, mlen).
+ */
+template <class P, class Enc, CaptureOp OP>
+v8::Handle<v8::Value>
+bind_hash(const v8::Arguments &args)
+{
+  v8::HandleScope scope;
+  CallCapture capture_(OP);
+
+  if (args.Length() != 1 && args.Length() != 2)
+    return PlainError::raise("Need 1 arg: message");
+  typename Enc::template In<0>::Arg m;
+  ArgReader in(args);
+  if (!in.readFormats(1) || !in.read(m, "message"))
+    return in.failure();
+
+  unsigned char h[P::BYTES];
+  P::hash(h, m.data(), m.size());
+  return scope.Close(Binary::out(h, sizeof(h), in.output()));
+}
+
+#endif // NACL_NODE_BINDING_H
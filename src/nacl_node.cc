@@ -37,6 +37,8 @@
 
 #include <string.h>
 
+#include <vector>
+
 #include <v8.h>
 
 #include <node.h>
@@ -48,8 +50,19 @@
 #include "crypto_secretbox.h"
 #include "crypto_auth.h"
 #include "crypto_hash.h"
+#include "crypto_stream_xsalsa20.h"
+#include "crypto_onetimeauth.h"
 
 #include "nacl_node.h"
+#include "keypair_pool.h"
+#include "fixedbase25519.h"
+#include "sha512_multibuf.h"
+#include "capture.h"
+#include "stream_xsalsa20_ic.h"
+#include "nacl_binding.h"
+#include "channel.h"
+#include "verify_cache.h"
+#include "batch_scheduler.h"
 
 using namespace v8;
 using namespace node;
@@ -59,695 +72,1585 @@ static Persistent<Function> BadSignatureErrorFunc;
 static Persistent<Function> BadSecretBoxErrorFunc;
 static Persistent<Function> BadAuthenticatorErrorFunc;
 
-// Evil macrology 
+// Evil macrology (what is left of it; see nacl_binding.h for the rest)
 
 #define LEAVE_VIA_EXCEPTION(msg) \
- return ThrowException(Exception::Error(String::New(msg)));
+ return PlainError::raise(msg);
 
-#define LEAVE_VIA_CUSTOM_EXCEPTION(errorFunc, msg)      \
-  {  Local<Value> argv[] = {String::New(msg)};          \
-  Local<Value> Err = (errorFunc)->NewInstance(1, argv); \
-  return ThrowException(Err);  }
+/**
+ * Record the call for the workload capture if one is running; see capture.h.
+ *  The binding layer reports argument sizes to it on its own.
+ */
+#define CAPTURE_CALL(op) \
+  CallCapture capture_(op)
 
 #define BAIL_IF_NOT_N_ARGS(nargs,msg) \
  if (args.Length() != nargs) \
    LEAVE_VIA_EXCEPTION(msg);
 
 /**
- * Convert a JS string used for message bytes (like an English or CJK message,
- *  meaning more than just ASCII) to a std::string holding utf8-encoded data.
- *
- * Defines a variable `varname` as a byproduct.
- *
- * @param narg The index of the argument.
- * @param varname The name of the variable to define and which to place the
- *                result value in.
- * @param humanlabel The name to use for the variable when throwing an exception
- *                   if the provided value is no good.
+ * Like BAIL_IF_NOT_N_ARGS, but also allow the optional trailing encoding
+ *  argument; see ArgReader::readFormats.
  */
-#define COERCE_OR_BAIL_STR_ARG(narg,varname,humanlabel)      \
-  if (!args[narg]->IsString())                               \
-    LEAVE_VIA_EXCEPTION(humanlabel " needs to be a string"); \
-  String::Utf8Value utf8_##varname(args[narg]);              \
-  std::string varname(*utf8_##varname);
+#define BAIL_IF_NOT_N_ARGS_OR_ENCODING(nargs,msg) \
+ if (args.Length() != nargs && args.Length() != nargs + 1) \
+   LEAVE_VIA_EXCEPTION(msg);
 
 /**
- * Convert a JS string/buffer used for binary bytes (such as random bytes,
- *  crypto keys, and signed/encrypted messages) to a std::string holding
- *  binary-encoded data.
- *
- * Defines a variable `varname` as a byproduct.
- *
- * @param narg The index of the argument.
- * @param varname The name of the variable to define and which to place the
- *                result value in.
- * @param humanlabel The name to use for the variable when throwing an exception
- *                   if the provided value is no good.
+ * For the keypair and random key/nonce calls, whose only argument is the
+ *  optional encoding.  They never used to look at their arguments, so
+ *  anything that isn't shaped like an encoding (a string or a plain object),
+ *  and anything after the first argument, still gets ignored.
  */
-#define COERCE_OR_BAIL_BIN_STR_ARG(narg,varname,humanlabel)     \
-  std::string varname;                                          \
-  if (Buffer::HasInstance(args[narg])) {                        \
-    v8::Handle<v8::Object> t##varname = args[narg]->ToObject(); \
-    varname.replace(0, 0, Buffer::Data(t##varname),             \
-                    Buffer::Length(t##varname));                \
-  }                                                             \
-  else if (args[narg]->IsString()) {                            \
-    unsigned long nbytes = DecodeBytes(args[narg], BINARY);     \
-    char *bytes = new char[nbytes];                             \
-    DecodeWrite(bytes, nbytes, args[narg], BINARY);             \
-    varname.replace(0, 0, bytes, nbytes);                       \
-    delete[] bytes;                                             \
-  }                                                             \
-  else                                                          \
-    LEAVE_VIA_EXCEPTION(humanlabel " needs to be a binary string or buffer")
+static bool
+read_optional_encoding(ArgReader &in, const Arguments &args)
+{
+  if (!args.Length())
+    return true;
+  Local<Value> v = args[0];
+  if (!v->IsString() &&
+      (!v->IsObject() || v->IsArray() || v->IsFunction()))
+    return true;
+  return in.readFormats(0);
+}
 
-/**
- * Converts a JS numeric argument to an unsigned long long.  Because we are not
- *  fancy and don't actually need the expressive range, we require that the
- *  argument needs to be a uint32.
- *
- * Defines a variable `varname` as a byproduct.
- *
- * @param narg The index of the argument.
- * @param varname The name of the variable to define and which to place the
- *                result value in.
- * @param humanlabel The name to use for the variable when throwing an exception
- *                   if the provided value is no good.
- */
-#define COERCE_OR_BAIL_ULL_ARG(narg,varname,humanlabel) \
- if (!args[narg]->IsUint32()) \
-   LEAVE_VIA_EXCEPTION(humanlabel " needs to be a uint32"); \
- unsigned long long varname(args[narg]->Uint32Value())
+struct BadBoxErrorClass {
+  static Handle<Function> func() { return BadBoxErrorFunc; }
+};
+struct BadSignatureErrorClass {
+  static Handle<Function> func() { return BadSignatureErrorFunc; }
+};
+struct BadSecretBoxErrorClass {
+  static Handle<Function> func() { return BadSecretBoxErrorFunc; }
+};
+struct BadAuthenticatorErrorClass {
+  static Handle<Function> func() { return BadAuthenticatorErrorFunc; }
+};
 
-/**
- * Expression to return binary bytes from the std::string `strvar`.
- */
-#define PREP_BIN_STR(strvar) \
-  Encode(strvar.data(), strvar.length(), BINARY)
+typedef CustomError<BadBoxErrorClass> BadBoxError;
+typedef CustomError<BadSignatureErrorClass> BadSignatureError;
+typedef CustomError<BadSecretBoxErrorClass> BadSecretBoxError;
+typedef CustomError<BadAuthenticatorErrorClass> BadAuthenticatorError;
+
+/** Maximum number of keypairs we are willing to hold in a pool. */
+#define MAX_POOLED_KEYPAIRS 65536
+/** Largest memory budget we will give the verification cache. */
+#define MAX_VERIFY_CACHE_BYTES (1 << 30)
+
+////////////////////////////////////////////////////////////////////////////////
+// Keypair pools
+
+static KeypairPool SignKeypairPool(fixedbase_sign_keypair,
+                                   crypto_sign_PUBLICKEYBYTES,
+                                   crypto_sign_SECRETKEYBYTES);
+static KeypairPool BoxKeypairPool(fixedbase_box_keypair,
+                                  crypto_box_PUBLICKEYBYTES,
+                                  crypto_box_SECRETKEYBYTES);
+
+static KeypairPool *
+pool_for_kind(const std::string &kind)
+{
+  if (kind == "sign")
+    return &SignKeypairPool;
+  if (kind == "box")
+    return &BoxKeypairPool;
+  return NULL;
+}
 
 /**
- * Define a local `ret` to hold binary bytes from the std::string strvar.
+ * Turn on (or reconfigure, or with a high watermark of 0, turn off) the
+ *  background pre-generation of keypairs for sign_keypair() or box_keypair().
  */
-#define PREP_UTF8_STR_FOR_RETURN(strvar) \
-  Local<Value> ret = Encode(strvar.data(), strvar.length(), UTF8)
-#define PREP_BIN_STR_FOR_RETURN(strvar) \
-  Local<Value> ret = Encode(strvar.data(), strvar.length(), BINARY)
+Handle<Value>
+nacl_keypair_pool_configure(const Arguments &args)
+{
+  HandleScope scope;
+
+  BAIL_IF_NOT_N_ARGS(3, "Need 3 args: kind, low_water, high_water");
+  Utf8Arg<> kind;
+  Uint32Arg lowWater, highWater;
+  ArgReader in(args);
+  if (!in.read(kind, "kind") || !in.read(lowWater, "low_water") ||
+      !in.read(highWater, "high_water"))
+    return in.failure();
+
+  KeypairPool *pool = pool_for_kind(kind.c_str());
+  if (!pool)
+    LEAVE_VIA_EXCEPTION("kind needs to be 'sign' or 'box'");
+  if (highWater.value() > MAX_POOLED_KEYPAIRS)
+    LEAVE_VIA_EXCEPTION("You want too many pooled keypairs!");
+  if (const char *err = pool->configure(lowWater.value(), highWater.value()))
+    LEAVE_VIA_EXCEPTION(err);
 
-#define PREP_TRUNCATED_BIN_STR_FOR_RETURN(strvar, truncateTo)           \
-  Local<Value> ret = Encode(strvar.data(), truncateTo, BINARY)
+  return scope.Close(Undefined());
+}
 
+static Local<Object>
+pool_stats_object(KeypairPool &pool)
+{
+  KeypairPool::Stats stats;
+  pool.stats(&stats);
 
-#define PREP_BIN_CHARS_FOR_RETURN(cbuf, clen) \
-  Local<Value> ret = Encode(cbuf, clen)
+  Local<Object> ret = Object::New();
+  ret->Set(String::New("lowWater"), Integer::NewFromUnsigned(stats.lowWater));
+  ret->Set(String::New("highWater"),
+           Integer::NewFromUnsigned(stats.highWater));
+  ret->Set(String::New("available"),
+           Integer::NewFromUnsigned(stats.available));
+  ret->Set(String::New("hits"), Number::New(stats.hits));
+  ret->Set(String::New("misses"), Number::New(stats.misses));
+  return ret;
+}
 
 Handle<Value>
-nacl_sign_keypair(const Arguments &args)
+nacl_keypair_pool_stats(const Arguments &args)
 {
   HandleScope scope;
 
-  std::string pk, sk;
-  pk = crypto_sign_keypair(&sk);
+  BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
 
   Local<Object> ret = Object::New();
-  ret->Set(String::New("sk"), PREP_BIN_STR(sk));
-  ret->Set(String::New("pk"), PREP_BIN_STR(pk));
+  ret->Set(String::New("sign"), pool_stats_object(SignKeypairPool));
+  ret->Set(String::New("box"), pool_stats_object(BoxKeypairPool));
   return scope.Close(ret);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Verification cache
+
+static VerifyCache VerifiedCache;
+
+/**
+ * Give the cache of successful sign_open/auth_verify results a memory budget
+ *  in bytes, dropping whatever it held.  A budget of 0 (the default) turns it
+ *  off.
+ */
 Handle<Value>
-nacl_sign(const Arguments &args)
+nacl_verify_cache_configure(const Arguments &args)
 {
   HandleScope scope;
 
-  BAIL_IF_NOT_N_ARGS(2, "Need 2 string args: message, secretkey");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, sk, "secretkey");
+  BAIL_IF_NOT_N_ARGS(1, "Need 1 arg: budget_bytes");
+  Uint32Arg budget;
+  ArgReader in(args);
+  if (!in.read(budget, "budget_bytes"))
+    return in.failure();
 
-  std::string sm;
+  if (budget.value() > MAX_VERIFY_CACHE_BYTES)
+    LEAVE_VIA_EXCEPTION("You want too big a verification cache!");
+  VerifiedCache.configure(budget.value());
 
-  try {
-    sm = crypto_sign(m, sk);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
-  }
-
-  PREP_BIN_STR_FOR_RETURN(sm);
-  return scope.Close(ret);
+  return scope.Close(Undefined());
 }
 
 Handle<Value>
-nacl_sign_utf8(const Arguments &args)
+nacl_verify_cache_stats(const Arguments &args)
 {
   HandleScope scope;
 
-  BAIL_IF_NOT_N_ARGS(2, "Need 2 string args: message, secretkey");
-  COERCE_OR_BAIL_STR_ARG(0, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, sk, "secretkey");
-
-  std::string sm;
+  BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
 
-  try {
-    sm = crypto_sign(m, sk);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
-  }
+  VerifyCache::Stats stats;
+  VerifiedCache.stats(&stats);
 
-  PREP_BIN_STR_FOR_RETURN(sm);
+  Local<Object> ret = Object::New();
+  ret->Set(String::New("budgetBytes"),
+           Integer::NewFromUnsigned(stats.budgetBytes));
+  ret->Set(String::New("capacity"), Integer::NewFromUnsigned(stats.capacity));
+  ret->Set(String::New("entries"), Integer::NewFromUnsigned(stats.entries));
+  ret->Set(String::New("hits"), Number::New(stats.hits));
+  ret->Set(String::New("misses"), Number::New(stats.misses));
+  ret->Set(String::New("evictions"), Number::New(stats.evictions));
   return scope.Close(ret);
 }
 
-Handle<Value>
-nacl_sign_open(const Arguments &args)
+/**
+ * crypto_sign_open that checks the verification cache first; a signed message
+ *  we have already seen verify under this key just has its payload copied
+ *  out.  (smlen has to be at least crypto_sign_BYTES.)
+ */
+static int
+cached_sign_open(unsigned char *m, unsigned long long *mlen,
+                 const unsigned char *sm, unsigned long long smlen,
+                 const unsigned char *pk)
 {
-  HandleScope scope;
+  if (!VerifiedCache.enabled())
+    return crypto_sign_open(m, mlen, sm, smlen, pk);
+
+  unsigned char digest[VERIFY_CACHE_DIGESTBYTES];
+  VerifyCache::digest(digest, VerifyCache::SIGN_OPEN,
+                      pk, crypto_sign_PUBLICKEYBYTES, sm, smlen, NULL, 0);
+  if (VerifiedCache.lookup(digest)) {
+    // (the signature is split around the message)
+    *mlen = smlen - crypto_sign_BYTES;
+    memcpy(m, sm + crypto_sign_BYTES/2, *mlen);
+    return 0;
+  }
+  int rc = crypto_sign_open(m, mlen, sm, smlen, pk);
+  if (rc == 0)
+    VerifiedCache.insert(digest);
+  return rc;
+}
 
-  BAIL_IF_NOT_N_ARGS(2, "Need 2 string args: signed_message, public_key");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, sm, "signed_message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, pk, "public_key");
+////////////////////////////////////////////////////////////////////////////////
+// Fixed-base stand-ins for the nacl std::string API
 
-  // IMPORTANT!  nacl does not validate the size of 'sm' itself and is
-  //  vulnerable to a crash-inducing unsigned wraparound.  So we explode
-  //  for any input that is less than the minimum message size.
-  if (sm.length() < crypto_sign_BYTES)
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadSignatureErrorFunc,
-      "message is smaller than the minimum signed message size");
+static std::string
+fixedbase_keypair_str(KeypairPool::GenerateFunc generate, std::string *sk,
+                      size_t pkBytes, size_t skBytes)
+{
+  // (signing keys are at least as big as boxing keys)
+  unsigned char pk[crypto_sign_PUBLICKEYBYTES];
+  unsigned char skbuf[crypto_sign_SECRETKEYBYTES];
+
+  generate(pk, skbuf);
+  sk->assign(reinterpret_cast<char *>(skbuf), skBytes);
+  memset(skbuf, 0, sizeof(skbuf));
+  return std::string(reinterpret_cast<char *>(pk), pkBytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Primitives
+//
+// The traits the binding-layer shapes get instantiated with.  Adding a
+//  primitive means describing it here and instantiating the shapes below.
+
+struct SecretBoxKeys {
+  enum { COUNT = 1 };
+  FixedBinArg<crypto_secretbox_KEYBYTES> k;
+
+  bool read(ArgReader &in) { return in.read(k, "key"); }
+  const char *check() const
+  {
+    return k.rightSize() ? NULL : "incorrect key length";
+  }
+};
+
+struct BoxKeys {
+  enum { COUNT = 2 };
+  FixedBinArg<crypto_box_PUBLICKEYBYTES> pk;
+  FixedBinArg<crypto_box_SECRETKEYBYTES> sk;
 
-  std::string m;
-  try {
-    m = crypto_sign_open(sm, pk);
+  bool read(ArgReader &in)
+  {
+    return in.read(pk, "public_key") && in.read(sk, "secret_key");
   }
-  catch(const char *s) {
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadSignatureErrorFunc, s);
+  const char *check() const
+  {
+    if (!pk.rightSize())
+      return "incorrect public-key length";
+    if (!sk.rightSize())
+      return "incorrect secret-key length";
+    return NULL;
   }
+};
 
-  PREP_BIN_STR_FOR_RETURN(m);
-  return scope.Close(ret);
-}
+struct SignSecretKey {
+  enum { COUNT = 1 };
+  FixedBinArg<crypto_sign_SECRETKEYBYTES> sk;
 
-Handle<Value>
-nacl_sign_open_utf8(const Arguments &args)
-{
-  HandleScope scope;
+  bool read(ArgReader &in) { return in.read(sk, "secretkey"); }
+  const char *check() const
+  {
+    return sk.rightSize() ? NULL : "incorrect secret-key length";
+  }
+};
 
-  BAIL_IF_NOT_N_ARGS(2, "Need 2 string args: signed_message, public_key");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, sm, "signed_message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, pk, "public_key");
+struct SignPublicKey {
+  enum { COUNT = 1 };
+  FixedBinArg<crypto_sign_PUBLICKEYBYTES> pk;
 
-  // IMPORTANT!  nacl does not validate the size of 'sm' itself and is
-  //  vulnerable to a crash-inducing unsigned wraparound.  So we explode
-  //  for any input that is less than the minimum message size.
-  if (sm.length() < crypto_sign_BYTES)
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadSignatureErrorFunc,
-      "message is smaller than the minimum signed message size");
+  bool read(ArgReader &in) { return in.read(pk, "public_key"); }
+  const char *check() const
+  {
+    return pk.rightSize() ? NULL : "incorrect public-key length";
+  }
+};
 
-  std::string m;
-  try {
-    m = crypto_sign_open(sm, pk);
+struct AuthKeys {
+  enum { COUNT = 1 };
+  FixedBinArg<crypto_auth_KEYBYTES> k;
+
+  bool read(ArgReader &in) { return in.read(k, "key"); }
+  const char *check() const
+  {
+    return k.rightSize() ? NULL : "incorrect key length";
   }
-  catch(const char *s) {
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadSignatureErrorFunc, s);
+};
+
+struct SignPrimitive {
+  enum { BYTES = crypto_sign_BYTES };
+  typedef SignSecretKey SignKeys;
+  typedef SignPublicKey OpenKeys;
+  typedef BadSignatureError OpenError;
+
+  static int sign(unsigned char *sm, unsigned long long *smlen,
+                  const unsigned char *m, unsigned long long mlen,
+                  const SignKeys &keys)
+  {
+    return fixedbase_sign(sm, smlen, m, mlen, keys.sk.data());
   }
+  static int open(unsigned char *m, unsigned long long *mlen,
+                  const unsigned char *sm, unsigned long long smlen,
+                  const OpenKeys &keys)
+  {
+    return cached_sign_open(m, mlen, sm, smlen, keys.pk.data());
+  }
+  /** The signature is split around the message. */
+  static const unsigned char *payload(const unsigned char *sm)
+  {
+    return sm + crypto_sign_BYTES/2;
+  }
+};
 
-  PREP_UTF8_STR_FOR_RETURN(m);
-  return scope.Close(ret);
-}
+struct BoxPrimitive {
+  enum {
+    NONCEBYTES = crypto_box_NONCEBYTES,
+    ZEROBYTES = crypto_box_ZEROBYTES,
+    BOXZEROBYTES = crypto_box_BOXZEROBYTES
+  };
+  typedef BoxKeys Keys;
+  typedef BadBoxError OpenError;
+
+  static const char *sealUsage()
+  {
+    return "Need 4 args: message, nonce, pubkey, secretkey";
+  }
+  static const char *openUsage()
+  {
+    return "Need 4 args: ciphertext, nonce, pubkey, secretkey";
+  }
+  static int seal(unsigned char *c, const unsigned char *m,
+                  unsigned long long mlen, const unsigned char *n,
+                  const Keys &keys)
+  {
+    return crypto_box(c, m, mlen, n, keys.pk.data(), keys.sk.data());
+  }
+  static int open(unsigned char *m, const unsigned char *c,
+                  unsigned long long clen, const unsigned char *n,
+                  const Keys &keys)
+  {
+    return crypto_box_open(m, c, clen, n, keys.pk.data(), keys.sk.data());
+  }
+};
+
+struct SecretBoxPrimitive {
+  enum {
+    NONCEBYTES = crypto_secretbox_NONCEBYTES,
+    ZEROBYTES = crypto_secretbox_ZEROBYTES,
+    BOXZEROBYTES = crypto_secretbox_BOXZEROBYTES
+  };
+  typedef SecretBoxKeys Keys;
+  typedef BadSecretBoxError OpenError;
+
+  static const char *sealUsage() { return "Need 3 args: message, nonce, key"; }
+  static const char *openUsage()
+  {
+    return "Need 3 args: ciphertext, nonce, key";
+  }
+  static int seal(unsigned char *c, const unsigned char *m,
+                  unsigned long long mlen, const unsigned char *n,
+                  const Keys &keys)
+  {
+    return crypto_secretbox(c, m, mlen, n, keys.k.data());
+  }
+  static int open(unsigned char *m, const unsigned char *c,
+                  unsigned long long clen, const unsigned char *n,
+                  const Keys &keys)
+  {
+    return crypto_secretbox_open(m, c, clen, n, keys.k.data());
+  }
+};
+
+struct AuthPrimitive {
+  enum { BYTES = crypto_auth_BYTES };
+  typedef AuthKeys Keys;
+  typedef BadAuthenticatorError VerifyError;
 
+  static int mac(unsigned char *a, const unsigned char *m,
+                 unsigned long long mlen, const Keys &keys)
+  {
+    return crypto_auth(a, m, mlen, keys.k.data());
+  }
+  /** Checks the verification cache first, like cached_sign_open. */
+  static int verify(const unsigned char *a, const unsigned char *m,
+                    unsigned long long mlen, const Keys &keys)
+  {
+    if (!VerifiedCache.enabled())
+      return crypto_auth_verify(a, m, mlen, keys.k.data());
+
+    unsigned char digest[VERIFY_CACHE_DIGESTBYTES];
+    VerifyCache::digest(digest, VerifyCache::AUTH_VERIFY,
+                        keys.k.data(), crypto_auth_KEYBYTES,
+                        a, crypto_auth_BYTES, m, mlen);
+    if (VerifiedCache.lookup(digest))
+      return 0;
+    int rc = crypto_auth_verify(a, m, mlen, keys.k.data());
+    if (rc == 0)
+      VerifiedCache.insert(digest);
+    return rc;
+  }
+};
 
 /**
- * Let us see the payload of the signed blob before authenticating it.  This
- *  allows us to use the contents to figure out what public key we should be
- *  using to authenticate the blob, etc.  Obviously, for a malformed message
- *  what you may get is gibberish.
+ * sha512 truncated to 256 bits; see the comment in init() for why.
  */
+struct Hash512_256Primitive {
+  enum { BYTES = 32 };
+
+  static int hash(unsigned char *h, const unsigned char *m,
+                  unsigned long long mlen)
+  {
+    unsigned char full[crypto_hash_BYTES];
+    crypto_hash(full, m, mlen);
+    memcpy(h, full, BYTES);
+    return 0;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Signing
+
 Handle<Value>
-nacl_sign_peek(const Arguments &args)
+nacl_sign_keypair(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_SIGN_KEYPAIR);
 
-  BAIL_IF_NOT_N_ARGS(1, "Need 1 string arg: signed_message");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, sm, "signed_message");
+  ArgReader in(args);
+  if (!read_optional_encoding(in, args))
+    return in.failure();
 
-  if (sm.length() < crypto_sign_BYTES)
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadSignatureErrorFunc,
-      "message is smaller than the minimum signed message size");
+  std::string pk, sk;
+  if (!SignKeypairPool.take(&pk, &sk))
+    pk = fixedbase_keypair_str(fixedbase_sign_keypair, &sk,
+                               crypto_sign_PUBLICKEYBYTES,
+                               crypto_sign_SECRETKEYBYTES);
 
-  // (We could just have sliced the input string without going to std::string
-  //  too.)
-  Local<Value> ret = Encode(sm.data() + crypto_sign_BYTES/2,
-                            sm.length() - crypto_sign_BYTES,
-                            BINARY);
+  Local<Object> ret = Object::New();
+  ret->Set(String::New("sk"), Binary::out(sk, in.output()));
+  ret->Set(String::New("pk"), Binary::out(pk, in.output()));
   return scope.Close(ret);
 }
 
+static const InvocationCallback nacl_sign =
+  bind_sign<SignPrimitive, Binary, CAPTURE_OP_SIGN>;
+static const InvocationCallback nacl_sign_utf8 =
+  bind_sign<SignPrimitive, Utf8, CAPTURE_OP_SIGN_UTF8>;
+static const InvocationCallback nacl_sign_open =
+  bind_sign_open<SignPrimitive, Binary, CAPTURE_OP_SIGN_OPEN>;
+static const InvocationCallback nacl_sign_open_utf8 =
+  bind_sign_open<SignPrimitive, Utf8, CAPTURE_OP_SIGN_OPEN_UTF8>;
+static const InvocationCallback nacl_sign_peek =
+  bind_sign_peek<SignPrimitive, Binary, CAPTURE_OP_SIGN_PEEK>;
+static const InvocationCallback nacl_sign_peek_utf8 =
+  bind_sign_peek<SignPrimitive, Utf8, CAPTURE_OP_SIGN_PEEK_UTF8>;
+
+////////////////////////////////////////////////////////////////////////////////
+// Box
+
 Handle<Value>
-nacl_sign_peek_utf8(const Arguments &args)
+nacl_box_keypair(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_BOX_KEYPAIR);
 
-  BAIL_IF_NOT_N_ARGS(1, "Need 1 string arg: signed_message");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, sm, "signed_message");
+  ArgReader in(args);
+  if (!read_optional_encoding(in, args))
+    return in.failure();
 
-  if (sm.length() < crypto_sign_BYTES)
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadSignatureErrorFunc,
-      "message is smaller than the minimum signed message size");
+  std::string pk, sk;
+  if (!BoxKeypairPool.take(&pk, &sk))
+    pk = fixedbase_keypair_str(fixedbase_box_keypair, &sk,
+                               crypto_box_PUBLICKEYBYTES,
+                               crypto_box_SECRETKEYBYTES);
 
-  // (We could just have sliced the input string without going to std::string
-  //  too.)
-  Local<Value> ret = Encode(sm.data() + crypto_sign_BYTES/2,
-                            sm.length() - crypto_sign_BYTES,
-                            UTF8);
+  Local<Object> ret = Object::New();
+  ret->Set(String::New("sk"), Binary::out(sk, in.output()));
+  ret->Set(String::New("pk"), Binary::out(pk, in.output()));
   return scope.Close(ret);
 }
 
+static const InvocationCallback nacl_box =
+  bind_seal<BoxPrimitive, Binary, CAPTURE_OP_BOX>;
+static const InvocationCallback nacl_box_utf8 =
+  bind_seal<BoxPrimitive, Utf8, CAPTURE_OP_BOX_UTF8>;
+static const InvocationCallback nacl_box_open =
+  bind_open<BoxPrimitive, Binary, CAPTURE_OP_BOX_OPEN>;
+static const InvocationCallback nacl_box_open_utf8 =
+  bind_open<BoxPrimitive, Utf8, CAPTURE_OP_BOX_OPEN_UTF8>;
+
+////////////////////////////////////////////////////////////////////////////////
+// Secretbox
+
+static const InvocationCallback nacl_secretbox =
+  bind_seal<SecretBoxPrimitive, Binary, CAPTURE_OP_SECRETBOX>;
+static const InvocationCallback nacl_secretbox_utf8 =
+  bind_seal<SecretBoxPrimitive, Utf8, CAPTURE_OP_SECRETBOX_UTF8>;
+static const InvocationCallback nacl_secretbox_open =
+  bind_open<SecretBoxPrimitive, Binary, CAPTURE_OP_SECRETBOX_OPEN>;
+static const InvocationCallback nacl_secretbox_open_utf8 =
+  bind_open<SecretBoxPrimitive, Utf8, CAPTURE_OP_SECRETBOX_OPEN_UTF8>;
+
+////////////////////////////////////////////////////////////////////////////////
+// auth
+
+static const InvocationCallback nacl_auth =
+  bind_mac<AuthPrimitive, Binary, CAPTURE_OP_AUTH>;
+static const InvocationCallback nacl_auth_utf8 =
+  bind_mac<AuthPrimitive, Utf8, CAPTURE_OP_AUTH_UTF8>;
+static const InvocationCallback nacl_auth_verify =
+  bind_mac_verify<AuthPrimitive, Binary, CAPTURE_OP_AUTH_VERIFY>;
+static const InvocationCallback nacl_auth_verify_utf8 =
+  bind_mac_verify<AuthPrimitive, Utf8, CAPTURE_OP_AUTH_VERIFY_UTF8>;
+
+////////////////////////////////////////////////////////////////////////////////
+// Stream / onetimeauth
+//
+// The raw primitives underneath secretbox.  Unlike everything above, the
+//  bulk data goes in as a (buffer, offset, length) and is worked on in place,
+//  so nothing gets padded or copied.
+
+/**
+ * Longest keystream stream_xsalsa20() will hand back as a string, exported as
+ *  stream_xsalsa20_MAXBYTES.  Anything bigger should be XORed in place with
+ *  stream_xsalsa20_xor() instead.
+ */
+#define MAX_STREAM_BYTES (1 << 20)
 
 Handle<Value>
-nacl_box_keypair(const Arguments &args)
+nacl_stream_xsalsa20(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_STREAM_XSALSA20);
+
+  BAIL_IF_NOT_N_ARGS(3, "Need 3 args: length, nonce, key");
+  Uint32Arg clen;
+  FixedBinArg<crypto_stream_xsalsa20_NONCEBYTES> n;
+  FixedBinArg<crypto_stream_xsalsa20_KEYBYTES> k;
+  ArgReader in(args);
+  if (!in.read(clen, "length") || !in.read(n, "nonce") || !in.read(k, "key"))
+    return in.failure();
+
+  if (!n.rightSize())
+    LEAVE_VIA_EXCEPTION("incorrect nonce length");
+  if (!k.rightSize())
+    LEAVE_VIA_EXCEPTION("incorrect key length");
+  if (clen.value() > MAX_STREAM_BYTES)
+    LEAVE_VIA_EXCEPTION("You want too long a keystream!");
+
+  ScratchBuffer c(clen.value());
+  crypto_stream_xsalsa20(c.data(), c.size(), n.data(), k.data());
+
+  return scope.Close(Binary::out(c.data(), c.size()));
+}
 
-  std::string pk, sk;
-  pk = crypto_box_keypair(&sk);
+/**
+ * XOR the keystream into buffer[offset, offset + length) in place, starting
+ *  `counter` 64-byte blocks into the keystream (default 0).  Encryption and
+ *  decryption are the same operation.
+ */
+Handle<Value>
+nacl_stream_xsalsa20_xor(const Arguments &args)
+{
+  HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_STREAM_XSALSA20_XOR);
+
+  if (args.Length() != 5 && args.Length() != 6)
+    LEAVE_VIA_EXCEPTION(
+      "Need 5 or 6 args: buffer, offset, length, nonce, key[, counter]");
+  BufferRangeArg m;
+  FixedBinArg<crypto_stream_xsalsa20_NONCEBYTES> n;
+  FixedBinArg<crypto_stream_xsalsa20_KEYBYTES> k;
+  U53Arg counter;
+  ArgReader in(args);
+  if (!in.readRange(m, "buffer") || !in.read(n, "nonce") ||
+      !in.read(k, "key") ||
+      (args.Length() == 6 && !in.read(counter, "counter")))
+    return in.failure();
+
+  if (!n.rightSize())
+    LEAVE_VIA_EXCEPTION("incorrect nonce length");
+  if (!k.rightSize())
+    LEAVE_VIA_EXCEPTION("incorrect key length");
+
+  stream_xsalsa20_xor_ic(m.data(), m.data(), m.size(), n.data(),
+                         counter.value(), k.data());
 
-  Local<Object> ret = Object::New();
-  ret->Set(String::New("sk"), PREP_BIN_STR(sk));
-  ret->Set(String::New("pk"), PREP_BIN_STR(pk));
-  return scope.Close(ret);
+  return scope.Close(Undefined());
 }
 
 Handle<Value>
-nacl_box(const Arguments &args)
+nacl_onetimeauth(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_ONETIMEAUTH);
 
-  BAIL_IF_NOT_N_ARGS(4, "Need 4 args: message, nonce, pubkey, secretkey");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, n, "nonce");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, pk, "public_key");
-  COERCE_OR_BAIL_BIN_STR_ARG(3, sk, "secret_key");
+  BAIL_IF_NOT_N_ARGS(4, "Need 4 args: buffer, offset, length, key");
+  BufferRangeArg m;
+  FixedBinArg<crypto_onetimeauth_KEYBYTES> k;
+  ArgReader in(args);
+  if (!in.readRange(m, "buffer") || !in.read(k, "key"))
+    return in.failure();
 
-  std::string c;
+  if (!k.rightSize())
+    LEAVE_VIA_EXCEPTION("incorrect key length");
 
-  try {
-    c = crypto_box(m, n, pk, sk);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
-  }
+  unsigned char a[crypto_onetimeauth_BYTES];
+  crypto_onetimeauth(a, m.data(), m.size(), k.data());
 
-  PREP_BIN_STR_FOR_RETURN(c);
-  return scope.Close(ret);
+  return scope.Close(Binary::out(a, sizeof(a)));
 }
 
 Handle<Value>
-nacl_box_utf8(const Arguments &args)
+nacl_onetimeauth_verify(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_ONETIMEAUTH_VERIFY);
+
+  BAIL_IF_NOT_N_ARGS(5,
+                     "Need 5 args: authenticator, buffer, offset, length, key");
+  FixedBinArg<crypto_onetimeauth_BYTES> a;
+  BufferRangeArg m;
+  FixedBinArg<crypto_onetimeauth_KEYBYTES> k;
+  ArgReader in(args);
+  if (!in.read(a, "authenticator") || !in.readRange(m, "buffer") ||
+      !in.read(k, "key"))
+    return in.failure();
+
+  if (!a.rightSize())
+    return BadAuthenticatorError::raise("incorrect authenticator length");
+  if (!k.rightSize())
+    return BadAuthenticatorError::raise("incorrect key length");
+  if (crypto_onetimeauth_verify(a.data(), m.data(), m.size(), k.data()))
+    return BadAuthenticatorError::raise("invalid authenticator");
 
-  BAIL_IF_NOT_N_ARGS(4, "Need 4 args: message, nonce, pubkey, secretkey");
-  COERCE_OR_BAIL_STR_ARG(0, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, n, "nonce");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, pk, "public_key");
-  COERCE_OR_BAIL_BIN_STR_ARG(3, sk, "secret_key");
+  return scope.Close(Undefined());
+}
 
-  std::string c;
+////////////////////////////////////////////////////////////////////////////////
+// Hash
 
-  try {
-    c = crypto_box(m, n, pk, sk);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
-  }
+static const InvocationCallback nacl_hash512_256 =
+  bind_hash<Hash512_256Primitive, Binary, CAPTURE_OP_HASH512_256>;
+static const InvocationCallback nacl_hash512_256_utf8 =
+  bind_hash<Hash512_256Primitive, Utf8, CAPTURE_OP_HASH512_256_UTF8>;
 
-  PREP_BIN_STR_FOR_RETURN(c);
-  return scope.Close(ret);
-}
+/** Bytes of each hash512_256_batch digest. */
+#define HASH512_256_BYTES 32
 
+/**
+ * Hash a whole batch of messages in one native call, returning a Buffer that
+ *  holds each message's hash512_256 back to back.  Either pass an array of
+ *  binary strings/buffers, or one buffer with all the messages packed into it
+ *  plus an array of the offsets at which each message starts (each one runs
+ *  up to the start of the next, the last one to the end of the buffer).
+ */
 Handle<Value>
-nacl_box_open(const Arguments &args)
+nacl_hash512_256_batch(const Arguments &args)
 {
   HandleScope scope;
-
-  BAIL_IF_NOT_N_ARGS(4,
-                     "Need 4 args: ciphertext, nonce, pubkey, secretkey");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, c, "ciphertext_message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, n, "nonce");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, pk, "public_key");
-  COERCE_OR_BAIL_BIN_STR_ARG(3, sk, "secret_key");
-
-  std::string m;
-  try {
-    m = crypto_box_open(c, n, pk, sk);
+  CAPTURE_CALL(CAPTURE_OP_HASH512_256_BATCH);
+
+  if (args.Length() != 1 && args.Length() != 2)
+    LEAVE_VIA_EXCEPTION("Need 1 or 2 args: messages[, offsets]");
+
+  std::vector<const unsigned char *> msgs;
+  std::vector<unsigned long long> lens;
+  // binary strings get decoded into here; the pointers get filled in at the
+  //  end so nothing moves out from under us
+  std::vector<std::string> decoded;
+
+  if (args.Length() == 1) {
+    if (!args[0]->IsArray())
+      LEAVE_VIA_EXCEPTION(
+        "messages needs to be an array of binary strings or buffers");
+    Local<Array> arr = Local<Array>::Cast(args[0]);
+    uint32_t count = arr->Length();
+    msgs.resize(count);
+    lens.resize(count);
+    decoded.resize(count);
+
+    for (uint32_t i = 0; i < count; i++) {
+      Local<Value> v = arr->Get(i);
+      if (Buffer::HasInstance(v)) {
+        Local<Object> buf = v->ToObject();
+        msgs[i] = reinterpret_cast<const unsigned char *>(Buffer::Data(buf));
+        lens[i] = Buffer::Length(buf);
+      }
+      else if (v->IsString()) {
+        unsigned long nbytes = DecodeBytes(v, BINARY);
+        decoded[i].resize(nbytes);
+        if (nbytes)
+          DecodeWrite(&decoded[i][0], nbytes, v, BINARY);
+        msgs[i] = NULL;
+        lens[i] = nbytes;
+      }
+      else
+        LEAVE_VIA_EXCEPTION(
+          "messages needs to be an array of binary strings or buffers");
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      if (!msgs[i])
+        msgs[i] = reinterpret_cast<const unsigned char *>(decoded[i].data());
+    }
   }
-  catch(const char *s) {
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadBoxErrorFunc, s);
+  else {
+    if (!Buffer::HasInstance(args[0]))
+      LEAVE_VIA_EXCEPTION("packed_messages needs to be a buffer");
+    if (!args[1]->IsArray())
+      LEAVE_VIA_EXCEPTION("offsets needs to be an array of uint32s");
+    Local<Object> packed = args[0]->ToObject();
+    const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(Buffer::Data(packed));
+    size_t total = Buffer::Length(packed);
+    Local<Array> offsets = Local<Array>::Cast(args[1]);
+    uint32_t count = offsets->Length();
+    msgs.resize(count);
+    lens.resize(count);
+
+    for (uint32_t i = 0; i < count; i++) {
+      Local<Value> startVal = offsets->Get(i);
+      Local<Value> endVal = i + 1 < count ? offsets->Get(i + 1) : startVal;
+      if (!startVal->IsUint32() || !endVal->IsUint32())
+        LEAVE_VIA_EXCEPTION("offsets needs to be an array of uint32s");
+      size_t start = startVal->Uint32Value();
+      size_t end = i + 1 < count ? endVal->Uint32Value() : total;
+      if (start > end || end > total)
+        LEAVE_VIA_EXCEPTION(
+          "offsets need to be ascending and inside packed_messages");
+      msgs[i] = data + start;
+      lens[i] = end - start;
+    }
   }
 
-  PREP_BIN_STR_FOR_RETURN(m);
-  return scope.Close(ret);
+  size_t count = msgs.size();
+  unsigned long long totalBytes = 0;
+  for (size_t i = 0; i < count; i++)
+    totalBytes += lens[i];
+  CallCapture::noteArgSize(0, totalBytes);
+  CallCapture::noteArgSize(1, count);
+
+  Buffer *out = Buffer::New(count * HASH512_256_BYTES);
+  if (count)
+    sha512_multibuf(
+      reinterpret_cast<unsigned char *>(Buffer::Data(out->handle_)),
+      HASH512_256_BYTES, &msgs[0], &lens[0], count);
+  return scope.Close(out->handle_);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Random bytes / nonces
+
+/** Maximum number of random bytes the user can request in a go. */
+#define MAX_RANDOM_BYTES 256
+
 Handle<Value>
-nacl_box_open_utf8(const Arguments &args)
+nacl_randombytes(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_RANDOMBYTES);
+  unsigned char buf[MAX_RANDOM_BYTES];
 
-  BAIL_IF_NOT_N_ARGS(4,
-                     "Need 4 args: ciphertext, nonce, pubkey, secretkey");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, c, "ciphertext_message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, n, "nonce");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, pk, "public_key");
-  COERCE_OR_BAIL_BIN_STR_ARG(3, sk, "secret_key");
+  BAIL_IF_NOT_N_ARGS_OR_ENCODING(1,
+    "Need 1 numeric arg: number of random bytes");
+  Uint32Arg numbytes;
+  ArgReader in(args);
+  if (!in.readFormats(1) || !in.read(numbytes, "num_random_bytes"))
+    return in.failure();
 
-  std::string m;
-  try {
-    m = crypto_box_open(c, n, pk, sk);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadBoxErrorFunc, s);
-  }
+  if (numbytes.value() >= MAX_RANDOM_BYTES)
+    LEAVE_VIA_EXCEPTION("You want too many random bytes!");
 
-  PREP_UTF8_STR_FOR_RETURN(m);
-  return scope.Close(ret);
-}
+  randombytes(buf, numbytes.value());
 
-////////////////////////////////////////////////////////////////////////////////
-// Secretbox
+  return scope.Close(Binary::out(buf, numbytes.value(), in.output()));
+}
 
 Handle<Value>
-nacl_secretbox(const Arguments &args)
+nacl_box_random_nonce(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_BOX_RANDOM_NONCE);
+  unsigned char buf[crypto_box_NONCEBYTES];
 
-  BAIL_IF_NOT_N_ARGS(3, "Need 3 args: message, nonce, key");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, n, "nonce");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, k, "key");
-
-  std::string c;
+  ArgReader in(args);
+  if (!read_optional_encoding(in, args))
+    return in.failure();
 
-  try {
-    c = crypto_secretbox(m, n, k);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
-  }
+  randombytes(buf, crypto_box_NONCEBYTES);
 
-  PREP_BIN_STR_FOR_RETURN(c);
-  return scope.Close(ret);
+  return scope.Close(Binary::out(buf, sizeof(buf), in.output()));
 }
 
 Handle<Value>
-nacl_secretbox_utf8(const Arguments &args)
+nacl_secretbox_random_nonce(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_SECRETBOX_RANDOM_NONCE);
+  unsigned char buf[crypto_secretbox_NONCEBYTES];
 
-  BAIL_IF_NOT_N_ARGS(3, "Need 3 args: message, nonce, key");
-  COERCE_OR_BAIL_STR_ARG(0, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, n, "nonce");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, k, "key");
+  ArgReader in(args);
+  if (!read_optional_encoding(in, args))
+    return in.failure();
 
-  std::string c;
+  randombytes(buf, crypto_secretbox_NONCEBYTES);
 
-  try {
-    c = crypto_secretbox(m, n, k);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
-  }
-
-  PREP_BIN_STR_FOR_RETURN(c);
-  return scope.Close(ret);
+  return scope.Close(Binary::out(buf, sizeof(buf), in.output()));
 }
 
 Handle<Value>
-nacl_secretbox_open(const Arguments &args)
+nacl_secretbox_random_key(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_SECRETBOX_RANDOM_KEY);
+  unsigned char buf[crypto_secretbox_KEYBYTES];
 
-  BAIL_IF_NOT_N_ARGS(3,
-                     "Need 3 args: ciphertext, nonce, key");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, c, "ciphertext_message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, n, "nonce");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, k, "key");
+  ArgReader in(args);
+  if (!read_optional_encoding(in, args))
+    return in.failure();
 
-  std::string m;
-  try {
-    m = crypto_secretbox_open(c, n, k);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadSecretBoxErrorFunc, s);
-  }
+  randombytes(buf, crypto_secretbox_KEYBYTES);
 
-  PREP_BIN_STR_FOR_RETURN(m);
-  return scope.Close(ret);
+  return scope.Close(Binary::out(buf, sizeof(buf), in.output()));
 }
 
 Handle<Value>
-nacl_secretbox_open_utf8(const Arguments &args)
+nacl_auth_random_key(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_AUTH_RANDOM_KEY);
+  unsigned char buf[crypto_auth_KEYBYTES];
 
-  BAIL_IF_NOT_N_ARGS(3,
-                     "Need 3 args: ciphertext, nonce, key");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, c, "ciphertext_message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, n, "nonce");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, k, "key");
+  ArgReader in(args);
+  if (!read_optional_encoding(in, args))
+    return in.failure();
 
-  std::string m;
-  try {
-    m = crypto_secretbox_open(c, n, k);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadSecretBoxErrorFunc, s);
-  }
+  randombytes(buf, crypto_auth_KEYBYTES);
 
-  PREP_UTF8_STR_FOR_RETURN(m);
-  return scope.Close(ret);
+  return scope.Close(Binary::out(buf, sizeof(buf), in.output()));
 }
 
+
 ////////////////////////////////////////////////////////////////////////////////
-// auth
+// Channel
 
-Handle<Value>
-nacl_auth(const Arguments &args)
-{
-  HandleScope scope;
+/**
+ * The JS face of SecureChannel (see channel.h for the protocol):
+ *
+ *   var ch = new nacl.Channel(our_secret_key, their_public_key[, options]);
+ *   ch.hello()                 // -> Buffer to send the peer first
+ *   ch.accept(their_hello);    // then nothing works until we have theirs
+ *   ch.push(message);          // queue a message for the next seal()
+ *   ch.seal([message])         // -> Buffers, one per record, for writev
+ *   ch.open(record)            // -> Buffers, one per completed message
+ *   ch.rekey();                // ratchet the sending key now
+ *   ch.stats();
+ *
+ * options: maxRecordBytes, rekeyRecords, maxMessageBytes.  Every record (and
+ *  the hello) starts with its own length as a big-endian uint32, for stream
+ *  framing.  Every Channel says a new hello, so keys are never reused across
+ *  sessions between the same two keypairs.
+ */
+class ChannelWrap : public ObjectWrap {
+public:
+  static void Init(Handle<Object> target);
+
+private:
+  static Handle<Value> New(const Arguments &args);
+  static Handle<Value> Hello(const Arguments &args);
+  static Handle<Value> Accept(const Arguments &args);
+  static Handle<Value> Push(const Arguments &args);
+  static Handle<Value> Seal(const Arguments &args);
+  static Handle<Value> Open(const Arguments &args);
+  static Handle<Value> Rekey(const Arguments &args);
+  static Handle<Value> Stats(const Arguments &args);
+
+  static ChannelWrap *Receiver(const Arguments &args);
+  static unsigned char *AllocRecord(void *ctx, size_t len);
+  static void DeliverMessage(void *ctx, const unsigned char *m, size_t len);
+
+  static Persistent<FunctionTemplate> s_template;
+
+  SecureChannel m_channel;
+};
 
-  BAIL_IF_NOT_N_ARGS(2, "Need 2 args: message, key");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, k, "key");
+Persistent<FunctionTemplate> ChannelWrap::s_template;
 
-  std::string a;
+/**
+ * Declare `wrap` as the Channel the method got called on, throwing a
+ *  TypeError if it got .call()ed on anything else.
+ */
+#define CHANNEL_RECEIVER(wrap) \
+ ChannelWrap *wrap = Receiver(args); \
+ if (!wrap) \
+   return PlainTypeError::raise("this needs to be a Channel");
+
+/** Where AllocRecord/DeliverMessage put the Buffers they make. */
+struct ChannelOutput {
+  Local<Array> buffers;
+  uint32_t count;
+};
 
-  try {
-    a = crypto_auth(m, k);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
-  }
+/**
+ * Read an optional uint32 option, leaving `out` alone if it is not there.
+ */
+static bool
+uint32_option(Handle<Object> options, const char *name, unsigned int *out)
+{
+  Local<Value> v = options->Get(String::NewSymbol(name));
+  if (v->IsUndefined())
+    return true;
+  if (!v->IsUint32())
+    return false;
+  *out = v->Uint32Value();
+  return true;
+}
 
-  PREP_BIN_STR_FOR_RETURN(a);
-  return scope.Close(ret);
+/**
+ * The ChannelWrap behind `this`, or NULL if `this` is not a finished Channel.
+ *  Unwrap on its own would take any object's internal field on trust.
+ */
+ChannelWrap *
+ChannelWrap::Receiver(const Arguments &args)
+{
+  Local<Object> self = args.This();
+  if (!s_template->HasInstance(self))
+    return NULL;
+  return static_cast<ChannelWrap *>(self->GetPointerFromInternalField(0));
 }
 
 Handle<Value>
-nacl_auth_utf8(const Arguments &args)
+ChannelWrap::New(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_CHANNEL_NEW);
+
+  if (!args.IsConstructCall())
+    LEAVE_VIA_EXCEPTION("Use new to make a Channel");
+  if (args.Length() != 2 && args.Length() != 3)
+    LEAVE_VIA_EXCEPTION(
+      "Need 2 or 3 args: secret_key, public_key[, options]");
+  FixedBinArg<crypto_box_SECRETKEYBYTES> sk;
+  FixedBinArg<crypto_box_PUBLICKEYBYTES> pk;
+  ArgReader in(args);
+  if (!in.read(sk, "secret_key") || !in.read(pk, "public_key"))
+    return in.failure();
+  if (!sk.rightSize())
+    LEAVE_VIA_EXCEPTION("incorrect secret-key length");
+  if (!pk.rightSize())
+    LEAVE_VIA_EXCEPTION("incorrect public-key length");
+
+  SecureChannel::Options options;
+  if (args.Length() == 3) {
+    if (!args[2]->IsObject())
+      LEAVE_VIA_EXCEPTION("options needs to be an object");
+    Local<Object> opts = args[2]->ToObject();
+    unsigned int rekeyRecords = options.rekeyRecords;
+    if (!uint32_option(opts, "maxRecordBytes", &options.maxRecordBytes))
+      LEAVE_VIA_EXCEPTION("maxRecordBytes needs to be a uint32");
+    if (!uint32_option(opts, "rekeyRecords", &rekeyRecords))
+      LEAVE_VIA_EXCEPTION("rekeyRecords needs to be a uint32");
+    if (!uint32_option(opts, "maxMessageBytes", &options.maxMessageBytes))
+      LEAVE_VIA_EXCEPTION("maxMessageBytes needs to be a uint32");
+    options.rekeyRecords = rekeyRecords;
+  }
 
-  BAIL_IF_NOT_N_ARGS(2, "Need 2 args: message, key");
-  COERCE_OR_BAIL_STR_ARG(0, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, k, "key");
+  ChannelWrap *wrap = new ChannelWrap();
+  if (const char *err = wrap->m_channel.init(sk.data(), pk.data(), options)) {
+    delete wrap;
+    LEAVE_VIA_EXCEPTION(err);
+  }
+  wrap->Wrap(args.This());
+  return args.This();
+}
 
-  std::string a;
+Handle<Value>
+ChannelWrap::Hello(const Arguments &args)
+{
+  HandleScope scope;
+  CHANNEL_RECEIVER(wrap);
 
-  try {
-    a = crypto_auth(m, k);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
-  }
+  BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
 
-  PREP_BIN_STR_FOR_RETURN(a);
-  return scope.Close(ret);
+  return scope.Close(Binary::out(wrap->m_channel.hello(), CHANNEL_HELLO_BYTES,
+                                 FORMAT_BUFFER));
 }
 
 Handle<Value>
-nacl_auth_verify(const Arguments &args)
+ChannelWrap::Accept(const Arguments &args)
 {
   HandleScope scope;
+  CHANNEL_RECEIVER(wrap);
 
-  BAIL_IF_NOT_N_ARGS(3,
-                     "Need 3 args: authenticator, message, key");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, a, "authenticator");
-  COERCE_OR_BAIL_BIN_STR_ARG(1, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, k, "key");
-
-  try {
-    crypto_auth_verify(a, m, k);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadAuthenticatorErrorFunc, s);
-  }
+  BAIL_IF_NOT_N_ARGS(1, "Need 1 arg: hello");
+  BinArg<> hello;
+  ArgReader in(args);
+  if (!in.read(hello, "hello"))
+    return in.failure();
 
+  if (const char *err = wrap->m_channel.accept(hello.data(), hello.size()))
+    return BadBoxError::raise(err);
   return scope.Close(Undefined());
 }
 
 Handle<Value>
-nacl_auth_verify_utf8(const Arguments &args)
+ChannelWrap::Push(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_CHANNEL_PUSH);
+  CHANNEL_RECEIVER(wrap);
 
-  BAIL_IF_NOT_N_ARGS(3,
-                     "Need 3 args: authenticator, message, key");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, a, "authenticator");
-  COERCE_OR_BAIL_STR_ARG(1, m, "message");
-  COERCE_OR_BAIL_BIN_STR_ARG(2, k, "key");
+  BAIL_IF_NOT_N_ARGS(1, "Need 1 arg: message");
+  BinArg<> m;
+  ArgReader in(args);
+  if (!in.read(m, "message"))
+    return in.failure();
 
-  try {
-    crypto_auth_verify(a, m, k);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_CUSTOM_EXCEPTION(BadAuthenticatorErrorFunc, s);
-  }
+  wrap->m_channel.queue(m.data(), m.size());
+  return scope.Close(Number::New(wrap->m_channel.queuedBytes()));
+}
 
-  return scope.Close(Undefined());
+unsigned char *
+ChannelWrap::AllocRecord(void *ctx, size_t len)
+{
+  ChannelOutput *out = static_cast<ChannelOutput *>(ctx);
+  Buffer *buf = Buffer::New(len);
+  out->buffers->Set(out->count++, buf->handle_);
+  return reinterpret_cast<unsigned char *>(Buffer::Data(buf->handle_));
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Hash
+void
+ChannelWrap::DeliverMessage(void *ctx, const unsigned char *m, size_t len)
+{
+  ChannelOutput *out = static_cast<ChannelOutput *>(ctx);
+  Buffer *buf = Buffer::New(reinterpret_cast<char *>(
+                              const_cast<unsigned char *>(m)), len);
+  out->buffers->Set(out->count++, buf->handle_);
+}
 
 Handle<Value>
-nacl_hash512_256(const Arguments &args)
+ChannelWrap::Seal(const Arguments &args)
 {
   HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_CHANNEL_SEAL);
+  CHANNEL_RECEIVER(wrap);
+
+  if (args.Length() > 1)
+    LEAVE_VIA_EXCEPTION("Need 0 or 1 args: [message]");
+  BinArg<> m;
+  ArgReader in(args);
+  if (args.Length() == 1 && !in.read(m, "message"))
+    return in.failure();
+
+  ChannelOutput out = { Array::New(), 0 };
+  if (const char *err = wrap->m_channel.seal(
+        AllocRecord, &out, args.Length() == 1 ? m.data() : NULL, m.size()))
+    LEAVE_VIA_EXCEPTION(err);
+  return scope.Close(out.buffers);
+}
 
-  BAIL_IF_NOT_N_ARGS(1,
-                     "Need 1 arg: message");
-  COERCE_OR_BAIL_BIN_STR_ARG(0, m, "message");
+Handle<Value>
+ChannelWrap::Open(const Arguments &args)
+{
+  HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_CHANNEL_OPEN);
+  CHANNEL_RECEIVER(wrap);
+
+  BAIL_IF_NOT_N_ARGS(1, "Need 1 arg: record");
+  BinArg<> rec;
+  ArgReader in(args);
+  if (!in.read(rec, "record"))
+    return in.failure();
+
+  ChannelOutput out = { Array::New(), 0 };
+  if (const char *err = wrap->m_channel.open(rec.data(), rec.size(),
+                                             DeliverMessage, &out))
+    return BadBoxError::raise(err);
+  return scope.Close(out.buffers);
+}
 
-  std::string h;
+Handle<Value>
+ChannelWrap::Rekey(const Arguments &args)
+{
+  HandleScope scope;
+  CHANNEL_RECEIVER(wrap);
 
-  try {
-    h = crypto_hash(m);
-  }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
-  }
+  BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
 
-  PREP_TRUNCATED_BIN_STR_FOR_RETURN(h, 32);
-  return scope.Close(ret);
+  wrap->m_channel.rekey();
+  return scope.Close(Undefined());
 }
 
 Handle<Value>
-nacl_hash512_256_utf8(const Arguments &args)
+ChannelWrap::Stats(const Arguments &args)
 {
   HandleScope scope;
+  CHANNEL_RECEIVER(wrap);
+
+  BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
+
+  SecureChannel::Stats stats;
+  wrap->m_channel.stats(&stats);
 
-  BAIL_IF_NOT_N_ARGS(1,
-                     "Need 1 arg: message");
-  COERCE_OR_BAIL_STR_ARG(0, m, "message");
+  Local<Object> ret = Object::New();
+  ret->Set(String::New("recordsSealed"), Number::New(stats.recordsSealed));
+  ret->Set(String::New("messagesSealed"), Number::New(stats.messagesSealed));
+  ret->Set(String::New("bytesSealed"), Number::New(stats.bytesSealed));
+  ret->Set(String::New("recordsOpened"), Number::New(stats.recordsOpened));
+  ret->Set(String::New("messagesOpened"), Number::New(stats.messagesOpened));
+  ret->Set(String::New("bytesOpened"), Number::New(stats.bytesOpened));
+  ret->Set(String::New("replaysRejected"),
+           Number::New(stats.replaysRejected));
+  ret->Set(String::New("failures"), Number::New(stats.failures));
+  ret->Set(String::New("sendEpoch"), Integer::NewFromUnsigned(stats.sendEpoch));
+  ret->Set(String::New("recvEpoch"), Integer::NewFromUnsigned(stats.recvEpoch));
+  ret->Set(String::New("queuedBytes"), Number::New(stats.queuedBytes));
+  return scope.Close(ret);
+}
 
-  std::string h;
+void
+ChannelWrap::Init(Handle<Object> target)
+{
+  Local<FunctionTemplate> t = FunctionTemplate::New(New);
+  t->InstanceTemplate()->SetInternalFieldCount(1);
+  t->SetClassName(String::NewSymbol("Channel"));
+
+  NODE_SET_PROTOTYPE_METHOD(t, "hello", Hello);
+  NODE_SET_PROTOTYPE_METHOD(t, "accept", Accept);
+  NODE_SET_PROTOTYPE_METHOD(t, "push", Push);
+  NODE_SET_PROTOTYPE_METHOD(t, "seal", Seal);
+  NODE_SET_PROTOTYPE_METHOD(t, "open", Open);
+  NODE_SET_PROTOTYPE_METHOD(t, "rekey", Rekey);
+  NODE_SET_PROTOTYPE_METHOD(t, "stats", Stats);
+
+  s_template = Persistent<FunctionTemplate>::New(t);
+  target->Set(String::NewSymbol("Channel"), t->GetFunction());
+}
 
-  try {
-    h = crypto_hash(m);
+////////////////////////////////////////////////////////////////////////////////
+// Batched async operations
+//
+// Callback flavors of the open/verify/hash calls that go through the batch
+//  scheduler (see batch_scheduler.h) instead of running on the spot:
+//
+//   nacl.sign_open_async(signed_message, public_key, function(err, m) {});
+//
+// Argument problems still throw; failed verifications go to the callback as
+//  the same errors the synchronous versions would throw.
+
+enum AsyncKind {
+  ASYNC_SIGN_OPEN,
+  ASYNC_BOX_OPEN,
+  ASYNC_SECRETBOX_OPEN,
+  ASYNC_HASH512_256,
+  ASYNC_KIND_COUNT
+};
+
+static void
+exec_sign_open(BatchOp *const *ops, size_t count)
+{
+  const unsigned char *pk =
+    reinterpret_cast<const unsigned char *>(ops[0]->key.data());
+  for (size_t i = 0; i < count; i++) {
+    BatchOp *op = ops[i];
+    const unsigned char *sm =
+      reinterpret_cast<const unsigned char *>(op->in.data());
+    unsigned long long mlen;
+    op->out.resize(op->in.size());
+    if (cached_sign_open(reinterpret_cast<unsigned char *>(&op->out[0]),
+                         &mlen, sm, op->in.size(), pk) != 0)
+      op->error = "ciphertext fails verification";
+    else
+      op->out.resize(mlen);
   }
-  catch(const char *s) {
-    LEAVE_VIA_EXCEPTION(s);
+}
+
+/**
+ * Every op in the batch is between the same two keys, so the curve25519 part
+ *  only happens once.
+ */
+static void
+exec_box_open(BatchOp *const *ops, size_t count)
+{
+  const unsigned char *keys =
+    reinterpret_cast<const unsigned char *>(ops[0]->key.data());
+  unsigned char k[crypto_box_BEFORENMBYTES];
+  crypto_box_beforenm(k, keys, keys + crypto_box_PUBLICKEYBYTES);
+
+  for (size_t i = 0; i < count; i++) {
+    BatchOp *op = ops[i];
+    op->out.resize(op->in.size());
+    if (crypto_box_open_afternm(
+          reinterpret_cast<unsigned char *>(&op->out[0]),
+          reinterpret_cast<const unsigned char *>(op->in.data()),
+          op->in.size(),
+          reinterpret_cast<const unsigned char *>(op->nonce.data()), k) != 0)
+      op->error = "ciphertext fails verification";
+    else if (op->out.size() < crypto_box_ZEROBYTES)
+      op->error = "ciphertext too short";
+    else
+      op->out.erase(0, crypto_box_ZEROBYTES);
   }
+  memset(k, 0, sizeof(k));
+}
 
-  PREP_TRUNCATED_BIN_STR_FOR_RETURN(h, 32);
-  return scope.Close(ret);
+static void
+exec_secretbox_open(BatchOp *const *ops, size_t count)
+{
+  const unsigned char *k =
+    reinterpret_cast<const unsigned char *>(ops[0]->key.data());
+  for (size_t i = 0; i < count; i++) {
+    BatchOp *op = ops[i];
+    op->out.resize(op->in.size());
+    if (crypto_secretbox_open(
+          reinterpret_cast<unsigned char *>(&op->out[0]),
+          reinterpret_cast<const unsigned char *>(op->in.data()),
+          op->in.size(),
+          reinterpret_cast<const unsigned char *>(op->nonce.data()), k) != 0)
+      op->error = "ciphertext fails verification";
+    else if (op->out.size() < crypto_secretbox_ZEROBYTES)
+      op->error = "ciphertext too short";
+    else
+      op->out.erase(0, crypto_secretbox_ZEROBYTES);
+  }
 }
 
+/** The whole batch goes through the multi-buffer kernel at once. */
+static void
+exec_hash512_256(BatchOp *const *ops, size_t count)
+{
+  std::vector<const unsigned char *> msgs(count);
+  std::vector<unsigned long long> lens(count);
+  for (size_t i = 0; i < count; i++) {
+    msgs[i] = reinterpret_cast<const unsigned char *>(ops[i]->in.data());
+    lens[i] = ops[i]->in.size();
+  }
+  std::vector<unsigned char> digests(count * HASH512_256_BYTES);
+  sha512_multibuf(&digests[0], HASH512_256_BYTES, &msgs[0], &lens[0], count);
+  for (size_t i = 0; i < count; i++)
+    ops[i]->out.assign(reinterpret_cast<char *>(&digests[0]) +
+                       i * HASH512_256_BYTES, HASH512_256_BYTES);
+}
 
+/**
+ * box_open shares its beforenm and hashing shares the multi-buffer kernel;
+ *  signatures and secretboxes have nothing to share (there's no batch verify
+ *  for edwards25519sha512batch), so those get spread over the threadpool.
+ */
+static const BatchScheduler::Kind AsyncKinds[ASYNC_KIND_COUNT] = {
+  { exec_sign_open, false },
+  { exec_box_open, true },
+  { exec_secretbox_open, false },
+  { exec_hash512_256, true }
+};
 
-////////////////////////////////////////////////////////////////////////////////
-// Random bytes / nonces
+/** What each kind's failures look like to JS. */
+static Local<Value> (*const AsyncErrors[ASYNC_KIND_COUNT])(const char *) = {
+  BadSignatureError::make,
+  BadBoxError::make,
+  BadSecretBoxError::make,
+  PlainError::make
+};
 
-/** Maximum number of random bytes the user can request in a go. */
-#define MAX_RANDOM_BYTES 256
+/**
+ * What an op carries back to the main thread in its ctx.
+ */
+struct AsyncCall {
+  Persistent<Function> callback;
+  ByteFormat format;
+};
 
-Handle<Value>
-nacl_randombytes(const Arguments &args)
+static bool
+async_done(BatchOp *op)
 {
   HandleScope scope;
-  char buf[MAX_RANDOM_BYTES];
+  AsyncCall *call = static_cast<AsyncCall *>(op->ctx);
 
-  BAIL_IF_NOT_N_ARGS(1, "Need 1 numeric arg: number of random bytes");
-  COERCE_OR_BAIL_ULL_ARG(0, numbytes, "num_random_bytes");
+  Handle<Value> argv[2];
+  if (op->error) {
+    argv[0] = AsyncErrors[op->kind](op->error);
+    argv[1] = Undefined();
+  }
+  else {
+    argv[0] = Null();
+    argv[1] = Binary::out(op->out, call->format);
+  }
 
-  if (numbytes >= MAX_RANDOM_BYTES)
-    LEAVE_VIA_EXCEPTION("You want too many random bytes!");
+  TryCatch tryCatch;
+  call->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+  call->callback.Dispose();
+  delete call;
+  if (!tryCatch.HasCaught())
+    return true;
+  // (the scheduler holds the rest of the batch until the next turn)
+  FatalException(tryCatch);
+  return false;
+}
 
-  randombytes(reinterpret_cast<unsigned char *>(&buf), numbytes);
+static BatchScheduler AsyncScheduler(AsyncKinds, ASYNC_KIND_COUNT,
+                                     async_done);
 
-  PREP_BIN_CHARS_FOR_RETURN(buf, numbytes);
-  return scope.Close(ret);
+/**
+ * The async calls take their optional encoding just before the callback, so
+ *  only look for one at `n` when the callback isn't sitting there.
+ */
+static bool
+async_read_formats(ArgReader &in, const Arguments &args, int n)
+{
+  return args.Length() == n + 1 || in.readFormats(n);
+}
+
+/**
+ * Hang on to the callback and the output format and hand the op to the
+ *  scheduler.
+ */
+static void
+async_submit(BatchOp *op, Handle<Value> callback, ByteFormat format)
+{
+  AsyncCall *call = new AsyncCall();
+  call->callback = Persistent<Function>::New(Handle<Function>::Cast(callback));
+  call->format = format;
+  op->ctx = call;
+  AsyncScheduler.submit(op);
 }
 
 Handle<Value>
-nacl_box_random_nonce(const Arguments &args)
+nacl_sign_open_async(const Arguments &args)
 {
   HandleScope scope;
-  char buf[crypto_box_NONCEBYTES];
-
-  BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
+  CAPTURE_CALL(CAPTURE_OP_SIGN_OPEN_ASYNC);
+
+  BAIL_IF_NOT_N_ARGS_OR_ENCODING(3,
+    "Need 3 args: signed_message, public_key, callback");
+  Handle<Value> callback = args[args.Length() - 1];
+  BinArg<> sm;
+  SignPublicKey keys;
+  ArgReader in(args);
+  if (!async_read_formats(in, args, 2) || !in.read(sm, "signed_message") ||
+      !keys.read(in))
+    return in.failure();
+  if (!callback->IsFunction())
+    LEAVE_VIA_EXCEPTION("callback needs to be a function");
+
+  // (see bind_sign_open)
+  if (sm.size() < crypto_sign_BYTES)
+    return BadSignatureError::raise(
+      "message is smaller than the minimum signed message size");
+  if (const char *bad = keys.check())
+    return BadSignatureError::raise(bad);
+
+  BatchOp *op = new BatchOp();
+  op->kind = ASYNC_SIGN_OPEN;
+  op->key.assign(reinterpret_cast<const char *>(keys.pk.data()),
+                 crypto_sign_PUBLICKEYBYTES);
+  op->in.assign(reinterpret_cast<const char *>(sm.data()), sm.size());
+  async_submit(op, callback, in.output());
+  return scope.Close(Undefined());
+}
 
-  randombytes(reinterpret_cast<unsigned char *>(&buf), crypto_box_NONCEBYTES);
+Handle<Value>
+nacl_box_open_async(const Arguments &args)
+{
+  HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_BOX_OPEN_ASYNC);
+
+  BAIL_IF_NOT_N_ARGS_OR_ENCODING(5,
+    "Need 5 args: ciphertext, nonce, pubkey, secretkey, callback");
+  Handle<Value> callback = args[args.Length() - 1];
+  BinArg<crypto_box_BOXZEROBYTES> c;
+  FixedBinArg<crypto_box_NONCEBYTES> n;
+  BoxKeys keys;
+  ArgReader in(args);
+  if (!async_read_formats(in, args, 4) ||
+      !in.read(c, "ciphertext_message") || !in.read(n, "nonce") ||
+      !keys.read(in))
+    return in.failure();
+  if (!callback->IsFunction())
+    LEAVE_VIA_EXCEPTION("callback needs to be a function");
+
+  const char *bad = keys.check();
+  if (!bad && !n.rightSize())
+    bad = "incorrect nonce length";
+  if (bad)
+    return BadBoxError::raise(bad);
+
+  BatchOp *op = new BatchOp();
+  op->kind = ASYNC_BOX_OPEN;
+  op->key.reserve(crypto_box_PUBLICKEYBYTES + crypto_box_SECRETKEYBYTES);
+  op->key.assign(reinterpret_cast<const char *>(keys.pk.data()),
+                 crypto_box_PUBLICKEYBYTES);
+  op->key.append(reinterpret_cast<const char *>(keys.sk.data()),
+                 crypto_box_SECRETKEYBYTES);
+  op->nonce.assign(reinterpret_cast<const char *>(n.data()),
+                   crypto_box_NONCEBYTES);
+  op->in.assign(reinterpret_cast<const char *>(c.padded()), c.paddedSize());
+  async_submit(op, callback, in.output());
+  return scope.Close(Undefined());
+}
 
-  PREP_BIN_CHARS_FOR_RETURN(buf, sizeof(buf)/sizeof(buf[0]));
-  return scope.Close(ret);
+Handle<Value>
+nacl_secretbox_open_async(const Arguments &args)
+{
+  HandleScope scope;
+  CAPTURE_CALL(CAPTURE_OP_SECRETBOX_OPEN_ASYNC);
+
+  BAIL_IF_NOT_N_ARGS_OR_ENCODING(4,
+    "Need 4 args: ciphertext, nonce, key, callback");
+  Handle<Value> callback = args[args.Length() - 1];
+  BinArg<crypto_secretbox_BOXZEROBYTES> c;
+  FixedBinArg<crypto_secretbox_NONCEBYTES> n;
+  SecretBoxKeys keys;
+  ArgReader in(args);
+  if (!async_read_formats(in, args, 3) ||
+      !in.read(c, "ciphertext_message") || !in.read(n, "nonce") ||
+      !keys.read(in))
+    return in.failure();
+  if (!callback->IsFunction())
+    LEAVE_VIA_EXCEPTION("callback needs to be a function");
+
+  const char *bad = keys.check();
+  if (!bad && !n.rightSize())
+    bad = "incorrect nonce length";
+  if (bad)
+    return BadSecretBoxError::raise(bad);
+
+  BatchOp *op = new BatchOp();
+  op->kind = ASYNC_SECRETBOX_OPEN;
+  op->key.assign(reinterpret_cast<const char *>(keys.k.data()),
+                 crypto_secretbox_KEYBYTES);
+  op->nonce.assign(reinterpret_cast<const char *>(n.data()),
+                   crypto_secretbox_NONCEBYTES);
+  op->in.assign(reinterpret_cast<const char *>(c.padded()), c.paddedSize());
+  async_submit(op, callback, in.output());
+  return scope.Close(Undefined());
 }
 
 Handle<Value>
-nacl_secretbox_random_nonce(const Arguments &args)
+nacl_hash512_256_async(const Arguments &args)
 {
   HandleScope scope;
-  char buf[crypto_secretbox_NONCEBYTES];
+  CAPTURE_CALL(CAPTURE_OP_HASH512_256_ASYNC);
+
+  BAIL_IF_NOT_N_ARGS_OR_ENCODING(2, "Need 2 args: message, callback");
+  Handle<Value> callback = args[args.Length() - 1];
+  BinArg<> m;
+  ArgReader in(args);
+  if (!async_read_formats(in, args, 1) || !in.read(m, "message"))
+    return in.failure();
+  if (!callback->IsFunction())
+    LEAVE_VIA_EXCEPTION("callback needs to be a function");
+
+  BatchOp *op = new BatchOp();
+  op->kind = ASYNC_HASH512_256;
+  op->in.assign(reinterpret_cast<const char *>(m.data()), m.size());
+  async_submit(op, callback, in.output());
+  return scope.Close(Undefined());
+}
 
-  BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
+/**
+ * Tune the batch scheduler: maxBatch, lateFlushMicros, smallBytes,
+ *  largeLaneThreads and poolThreads, any of which can be left out.
+ */
+Handle<Value>
+nacl_batch_configure(const Arguments &args)
+{
+  HandleScope scope;
 
-  randombytes(reinterpret_cast<unsigned char *>(&buf),
-              crypto_secretbox_NONCEBYTES);
+  BAIL_IF_NOT_N_ARGS(1, "Need 1 arg: options");
+  if (!args[0]->IsObject())
+    LEAVE_VIA_EXCEPTION("options needs to be an object");
+  Local<Object> opts = args[0]->ToObject();
+
+  BatchScheduler::Options options = AsyncScheduler.options();
+  if (!uint32_option(opts, "maxBatch", &options.maxBatch))
+    LEAVE_VIA_EXCEPTION("maxBatch needs to be a uint32");
+  if (!uint32_option(opts, "lateFlushMicros", &options.lateFlushMicros))
+    LEAVE_VIA_EXCEPTION("lateFlushMicros needs to be a uint32");
+  if (!uint32_option(opts, "smallBytes", &options.smallBytes))
+    LEAVE_VIA_EXCEPTION("smallBytes needs to be a uint32");
+  if (!uint32_option(opts, "largeLaneThreads", &options.largeLaneThreads))
+    LEAVE_VIA_EXCEPTION("largeLaneThreads needs to be a uint32");
+  if (!uint32_option(opts, "poolThreads", &options.poolThreads))
+    LEAVE_VIA_EXCEPTION("poolThreads needs to be a uint32");
+  if (const char *err = AsyncScheduler.configure(options))
+    LEAVE_VIA_EXCEPTION(err);
 
-  PREP_BIN_CHARS_FOR_RETURN(buf, sizeof(buf)/sizeof(buf[0]));
-  return scope.Close(ret);
+  return scope.Close(Undefined());
 }
 
 Handle<Value>
-nacl_secretbox_random_key(const Arguments &args)
+nacl_batch_stats(const Arguments &args)
 {
   HandleScope scope;
-  char buf[crypto_secretbox_KEYBYTES];
 
   BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
 
-  randombytes(reinterpret_cast<unsigned char *>(&buf),
-              crypto_secretbox_KEYBYTES);
+  BatchScheduler::Stats stats;
+  AsyncScheduler.stats(&stats);
+  const BatchScheduler::Options &options = AsyncScheduler.options();
 
-  PREP_BIN_CHARS_FOR_RETURN(buf, sizeof(buf)/sizeof(buf[0]));
+  Local<Object> ret = Object::New();
+  ret->Set(String::New("maxBatch"),
+           Integer::NewFromUnsigned(options.maxBatch));
+  ret->Set(String::New("lateFlushMicros"),
+           Integer::NewFromUnsigned(options.lateFlushMicros));
+  ret->Set(String::New("smallBytes"),
+           Integer::NewFromUnsigned(options.smallBytes));
+  ret->Set(String::New("largeLaneThreads"),
+           Integer::NewFromUnsigned(options.largeLaneThreads));
+  ret->Set(String::New("poolThreads"),
+           Integer::NewFromUnsigned(options.poolThreads));
+  ret->Set(String::New("submitted"), Number::New(stats.submitted));
+  ret->Set(String::New("completed"), Number::New(stats.completed));
+  ret->Set(String::New("batches"), Number::New(stats.batches));
+  ret->Set(String::New("jobs"), Number::New(stats.jobs));
+  ret->Set(String::New("fullFlushes"), Number::New(stats.fullFlushes));
+  ret->Set(String::New("lateFlushes"), Number::New(stats.lateFlushes));
+  ret->Set(String::New("turnFlushes"), Number::New(stats.turnFlushes));
+  ret->Set(String::New("largestBatch"), Number::New(stats.largestBatch));
+  ret->Set(String::New("pending"), Integer::NewFromUnsigned(stats.pending));
+  ret->Set(String::New("largeQueued"),
+           Integer::NewFromUnsigned(stats.largeQueued));
   return scope.Close(ret);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Workload capture
+
+/**
+ * Start recording a trace of every binding call (sizes and timings only, never
+ *  keys or payloads) to the given file for tools/nacl_replay to play back.
+ */
 Handle<Value>
-nacl_auth_random_key(const Arguments &args)
+nacl_capture_start(const Arguments &args)
 {
   HandleScope scope;
-  char buf[crypto_auth_KEYBYTES];
 
-  BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
+  BAIL_IF_NOT_N_ARGS(1, "Need 1 string arg: trace_path");
+  Utf8Arg<> path;
+  ArgReader in(args);
+  if (!in.read(path, "trace_path"))
+    return in.failure();
 
-  randombytes(reinterpret_cast<unsigned char *>(&buf),
-              crypto_auth_KEYBYTES);
+  if (!capture_start(path.c_str()))
+    LEAVE_VIA_EXCEPTION("Unable to open the trace file for writing");
 
-  PREP_BIN_CHARS_FOR_RETURN(buf, sizeof(buf)/sizeof(buf[0]));
-  return scope.Close(ret);
+  return scope.Close(Undefined());
 }
 
+/**
+ * Stop recording, returning how many calls were captured.
+ */
+Handle<Value>
+nacl_capture_stop(const Arguments &args)
+{
+  HandleScope scope;
+
+  BAIL_IF_NOT_N_ARGS(0, "No arguments required/supported");
+
+  return scope.Close(Number::New(capture_stop()));
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -813,6 +1716,20 @@ extern "C" void init(Handle<Object> target)
 
   NODE_SET_METHOD(target, "randombytes", nacl_randombytes);
 
+  // -- keypair pools (made-up-by-us)
+  NODE_SET_METHOD(target, "keypair_pool_configure",
+                          nacl_keypair_pool_configure);
+  NODE_SET_METHOD(target, "keypair_pool_stats", nacl_keypair_pool_stats);
+
+  // -- verification cache (made-up-by-us)
+  NODE_SET_METHOD(target, "verify_cache_configure",
+                          nacl_verify_cache_configure);
+  NODE_SET_METHOD(target, "verify_cache_stats", nacl_verify_cache_stats);
+
+  // -- workload capture (made-up-by-us)
+  NODE_SET_METHOD(target, "capture_start", nacl_capture_start);
+  NODE_SET_METHOD(target, "capture_stop", nacl_capture_stop);
+
   // -- signing
   NODE_SET_METHOD(target, "sign_keypair", nacl_sign_keypair);
   NODE_SET_METHOD(target, "sign", nacl_sign);
@@ -862,6 +1779,20 @@ extern "C" void init(Handle<Object> target)
   NODE_SET_METHOD(target, "auth_utf8", nacl_auth_utf8);
   NODE_SET_METHOD(target, "auth_verify_utf8", nacl_auth_verify_utf8);
 
+  // -- raw stream / onetimeauth
+  NAMED_CONSTANT(target, "stream_xsalsa20_KEYBYTES",
+                 crypto_stream_xsalsa20_KEYBYTES);
+  NAMED_CONSTANT(target, "stream_xsalsa20_NONCEBYTES",
+                 crypto_stream_xsalsa20_NONCEBYTES);
+  NAMED_CONSTANT(target, "stream_xsalsa20_MAXBYTES", MAX_STREAM_BYTES);
+  NAMED_CONSTANT(target, "onetimeauth_BYTES", crypto_onetimeauth_BYTES);
+  NAMED_CONSTANT(target, "onetimeauth_KEYBYTES", crypto_onetimeauth_KEYBYTES);
+
+  NODE_SET_METHOD(target, "stream_xsalsa20", nacl_stream_xsalsa20);
+  NODE_SET_METHOD(target, "stream_xsalsa20_xor", nacl_stream_xsalsa20_xor);
+  NODE_SET_METHOD(target, "onetimeauth", nacl_onetimeauth);
+  NODE_SET_METHOD(target, "onetimeauth_verify", nacl_onetimeauth_verify);
+
   // -- hash
   // we are exposing a 512 truncating to 256 mainly because:
   // a) I want a 32-byte hash, not a 64-byte hash.
@@ -870,4 +1801,20 @@ extern "C" void init(Handle<Object> target)
   //     particularly risky primitive to expose.
   NODE_SET_METHOD(target, "hash512_256", nacl_hash512_256);
   NODE_SET_METHOD(target, "hash512_256_utf8", nacl_hash512_256_utf8);
+  NODE_SET_METHOD(target, "hash512_256_batch",
+                          nacl_hash512_256_batch); // made-up
+
+  // -- secure channels (made-up-by-us)
+  NAMED_CONSTANT(target, "channel_RECORD_OVERHEAD", CHANNEL_RECORD_OVERHEAD);
+  NAMED_CONSTANT(target, "channel_HELLO_BYTES", CHANNEL_HELLO_BYTES);
+
+  ChannelWrap::Init(target);
+
+  // -- batched async operations (made-up-by-us)
+  NODE_SET_METHOD(target, "sign_open_async", nacl_sign_open_async);
+  NODE_SET_METHOD(target, "box_open_async", nacl_box_open_async);
+  NODE_SET_METHOD(target, "secretbox_open_async", nacl_secretbox_open_async);
+  NODE_SET_METHOD(target, "hash512_256_async", nacl_hash512_256_async);
+  NODE_SET_METHOD(target, "batch_configure", nacl_batch_configure);
+  NODE_SET_METHOD(target, "batch_stats", nacl_batch_stats);
 };
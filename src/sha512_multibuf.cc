@@ -0,0 +1,309 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "crypto_hash_sha512.h"
+
+#include "sha512_multibuf.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+static void
+sha512_scalar(unsigned char *out, unsigned int outlen,
+              const unsigned char *const *msgs,
+              const unsigned long long *lens, size_t count)
+{
+  unsigned char h[crypto_hash_sha512_BYTES];
+
+  for (size_t i = 0; i < count; i++) {
+    crypto_hash_sha512(h, msgs[i], lens[i]);
+    memcpy(out + i * outlen, h, outlen);
+  }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+
+#define LANES 4
+#define BLOCK_BYTES 128
+
+static const uint64_t K[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+  0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+  0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+  0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+  0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+  0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+  0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+  0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+  0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+  0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+  0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+  0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+  0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+  0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+  0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+  0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+  0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+  0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+  0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+  0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+  0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static const uint64_t IV[8] = {
+  0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+  0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+  0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static uint64_t
+load64_be(const unsigned char *p)
+{
+  uint64_t r = 0;
+  for (int i = 0; i < 8; i++)
+    r = (r << 8) | p[i];
+  return r;
+}
+
+/**
+ * One message's worth of bookkeeping for a lane: the full blocks come straight
+ *  out of the caller's memory and the padded final block(s) out of `tail`.
+ */
+struct LaneJob {
+  const unsigned char *msg;
+  unsigned long long fullBlocks, totalBlocks, nextBlock;
+  size_t index;
+  unsigned char tail[2 * BLOCK_BYTES];
+};
+
+static void
+lane_job_init(LaneJob *job, size_t index, const unsigned char *msg,
+              unsigned long long len)
+{
+  unsigned long long rem = len % BLOCK_BYTES;
+  unsigned long long tailBlocks = (rem + 17 <= BLOCK_BYTES) ? 1 : 2;
+  unsigned long long bits = len << 3;
+
+  job->msg = msg;
+  job->index = index;
+  job->fullBlocks = len / BLOCK_BYTES;
+  job->totalBlocks = job->fullBlocks + tailBlocks;
+  job->nextBlock = 0;
+
+  memset(job->tail, 0, sizeof(job->tail));
+  if (rem)
+    memcpy(job->tail, msg + job->fullBlocks * BLOCK_BYTES, rem);
+  job->tail[rem] = 0x80;
+  // big-endian 128-bit bit count; only the low 67 bits can be non-zero
+  unsigned char *lenp = job->tail + tailBlocks * BLOCK_BYTES - 8;
+  for (int i = 7; i >= 0; i--, bits >>= 8)
+    lenp[i] = bits & 0xff;
+  if (len >> 61)
+    lenp[-1] = (unsigned char) (len >> 61);
+}
+
+static const unsigned char *
+lane_job_block(const LaneJob *job)
+{
+  if (job->nextBlock < job->fullBlocks)
+    return job->msg + job->nextBlock * BLOCK_BYTES;
+  return job->tail + (job->nextBlock - job->fullBlocks) * BLOCK_BYTES;
+}
+
+#define ROTR(x, n) \
+  _mm256_or_si256(_mm256_srli_epi64((x), (n)), _mm256_slli_epi64((x), 64 - (n)))
+
+/**
+ * Run one block from each lane through the compression function.  state[i]
+ *  holds word i of all 4 lanes.
+ */
+__attribute__((target("avx2")))
+static void
+compress_x4(uint64_t state[8][LANES], const unsigned char *blocks[LANES])
+{
+  __m256i w[16];
+  __m256i a, b, c, d, e, f, g, h;
+  int t;
+
+  for (t = 0; t < 16; t++)
+    w[t] = _mm256_set_epi64x(load64_be(blocks[3] + 8 * t),
+                             load64_be(blocks[2] + 8 * t),
+                             load64_be(blocks[1] + 8 * t),
+                             load64_be(blocks[0] + 8 * t));
+
+  a = _mm256_loadu_si256((const __m256i *) state[0]);
+  b = _mm256_loadu_si256((const __m256i *) state[1]);
+  c = _mm256_loadu_si256((const __m256i *) state[2]);
+  d = _mm256_loadu_si256((const __m256i *) state[3]);
+  e = _mm256_loadu_si256((const __m256i *) state[4]);
+  f = _mm256_loadu_si256((const __m256i *) state[5]);
+  g = _mm256_loadu_si256((const __m256i *) state[6]);
+  h = _mm256_loadu_si256((const __m256i *) state[7]);
+
+  for (t = 0; t < 80; t++) {
+    __m256i wt;
+    if (t < 16) {
+      wt = w[t];
+    }
+    else {
+      __m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+      __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR(w15, 1),
+                                                     ROTR(w15, 8)),
+                                    _mm256_srli_epi64(w15, 7));
+      __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR(w2, 19),
+                                                     ROTR(w2, 61)),
+                                    _mm256_srli_epi64(w2, 6));
+      wt = _mm256_add_epi64(_mm256_add_epi64(w[t & 15], s0),
+                            _mm256_add_epi64(w[(t - 7) & 15], s1));
+      w[t & 15] = wt;
+    }
+
+    __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(ROTR(e, 14), ROTR(e, 18)),
+                                  ROTR(e, 41));
+    __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                  _mm256_andnot_si256(e, g));
+    __m256i t1 = _mm256_add_epi64(_mm256_add_epi64(h, S1),
+                                  _mm256_add_epi64(ch, wt));
+    t1 = _mm256_add_epi64(t1, _mm256_set1_epi64x((long long) K[t]));
+    __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(ROTR(a, 28), ROTR(a, 34)),
+                                  ROTR(a, 39));
+    __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b),
+                                  _mm256_and_si256(c, _mm256_or_si256(a, b)));
+    __m256i t2 = _mm256_add_epi64(S0, maj);
+
+    h = g; g = f; f = e;
+    e = _mm256_add_epi64(d, t1);
+    d = c; c = b; b = a;
+    a = _mm256_add_epi64(t1, t2);
+  }
+
+#define FOLD(i, v)                                                      \
+  _mm256_storeu_si256((__m256i *) state[i],                             \
+    _mm256_add_epi64(_mm256_loadu_si256((const __m256i *) state[i]), (v)))
+  FOLD(0, a); FOLD(1, b); FOLD(2, c); FOLD(3, d);
+  FOLD(4, e); FOLD(5, f); FOLD(6, g); FOLD(7, h);
+#undef FOLD
+}
+
+#undef ROTR
+
+static void
+sha512_x4(unsigned char *out, unsigned int outlen,
+          const unsigned char *const *msgs,
+          const unsigned long long *lens, size_t count)
+{
+  static const unsigned char idleBlock[BLOCK_BYTES] = { 0 };
+  uint64_t state[8][LANES];
+  LaneJob jobs[LANES];
+  bool busy[LANES];
+  const unsigned char *blocks[LANES];
+  size_t next = 0;
+  int lane, i;
+
+  for (lane = 0; lane < LANES; lane++) {
+    busy[lane] = next < count;
+    if (busy[lane]) {
+      lane_job_init(&jobs[lane], next, msgs[next], lens[next]);
+      next++;
+    }
+    for (i = 0; i < 8; i++)
+      state[i][lane] = IV[i];
+  }
+
+  for (;;) {
+    bool any = false;
+    for (lane = 0; lane < LANES; lane++) {
+      blocks[lane] = busy[lane] ? lane_job_block(&jobs[lane]) : idleBlock;
+      any = any || busy[lane];
+    }
+    if (!any)
+      break;
+
+    compress_x4(state, blocks);
+
+    for (lane = 0; lane < LANES; lane++) {
+      if (!busy[lane] || ++jobs[lane].nextBlock < jobs[lane].totalBlocks)
+        continue;
+
+      // This lane's message is done; write out its digest and refill it.
+      unsigned char digest[crypto_hash_sha512_BYTES];
+      for (i = 0; i < 8; i++) {
+        uint64_t v = state[i][lane];
+        for (int j = 7; j >= 0; j--, v >>= 8)
+          digest[8 * i + j] = v & 0xff;
+        state[i][lane] = IV[i];
+      }
+      memcpy(out + jobs[lane].index * outlen, digest, outlen);
+
+      busy[lane] = next < count;
+      if (busy[lane]) {
+        lane_job_init(&jobs[lane], next, msgs[next], lens[next]);
+        next++;
+      }
+    }
+  }
+
+  memset(jobs, 0, sizeof(jobs));
+}
+
+#endif // HAVE_AVX2_KERNEL
+
+void
+sha512_multibuf(unsigned char *out, unsigned int outlen,
+                const unsigned char *const *msgs,
+                const unsigned long long *lens, size_t count)
+{
+#ifdef HAVE_AVX2_KERNEL
+  // (Not worth spinning up the lanes for a single message.)
+  if (count > 1 && __builtin_cpu_supports("avx2")) {
+    sha512_x4(out, outlen, msgs, lens, count);
+    return;
+  }
+#endif
+  sha512_scalar(out, outlen, msgs, lens, count);
+}
@@ -0,0 +1,57 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NACL_NODE_SHA512_MULTIBUF_H
+#define NACL_NODE_SHA512_MULTIBUF_H
+
+#include <stddef.h>
+
+/**
+ * Hash `count` independent messages with SHA-512, writing the first `outlen`
+ *  bytes of each digest contiguously into `out` (which needs count * outlen
+ *  bytes of room).
+ *
+ * On CPUs with AVX2 this runs a multi-buffer kernel that pushes 4 messages
+ *  through the compression function at once, refilling each lane as soon as
+ *  its message is done, so it wins big on lots of short messages.  Otherwise
+ *  it just calls crypto_hash_sha512 on each message in turn.
+ */
+void sha512_multibuf(unsigned char *out, unsigned int outlen,
+                     const unsigned char *const *msgs,
+                     const unsigned long long *lens, size_t count);
+
+#endif // NACL_NODE_SHA512_MULTIBUF_H
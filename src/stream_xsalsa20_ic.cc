@@ -0,0 +1,84 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <string.h>
+
+#include "crypto_core_hsalsa20.h"
+#include "crypto_core_salsa20.h"
+#include "crypto_stream_xsalsa20.h"
+
+#include "stream_xsalsa20_ic.h"
+
+static const unsigned char sigma[17] = "expand 32-byte k";
+
+int
+stream_xsalsa20_xor_ic(unsigned char *c, const unsigned char *m,
+                       unsigned long long mlen, const unsigned char *n,
+                       unsigned long long counter, const unsigned char *k)
+{
+  if (!counter)
+    return crypto_stream_xsalsa20_xor(c, m, mlen, n, k);
+
+  // xsalsa20 is salsa20 keyed with hsalsa20(k, n[0..15]), using n[16..23] as
+  //  the salsa20 nonce and a little-endian block counter after it.
+  unsigned char subkey[32];
+  unsigned char in[16];
+  unsigned char block[64];
+  unsigned long long i;
+
+  crypto_core_hsalsa20(subkey, n, k, sigma);
+  memcpy(in, n + 16, 8);
+
+  while (mlen) {
+    unsigned long long ctr = counter;
+    for (i = 8; i < 16; i++, ctr >>= 8)
+      in[i] = ctr & 0xff;
+    crypto_core_salsa20(block, in, subkey, sigma);
+
+    unsigned long long chunk = mlen < 64 ? mlen : 64;
+    for (i = 0; i < chunk; i++)
+      c[i] = m[i] ^ block[i];
+    c += chunk;
+    m += chunk;
+    mlen -= chunk;
+    counter++;
+  }
+
+  memset(subkey, 0, sizeof(subkey));
+  memset(block, 0, sizeof(block));
+  return 0;
+}
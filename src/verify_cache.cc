@@ -0,0 +1,277 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include <string.h>
+
+#include "crypto_hash_sha512.h"
+#include "crypto_hashblocks_sha512.h"
+
+#include "verify_cache.h"
+
+VerifyCache::VerifyCache()
+  : m_enabled(false), m_budgetBytes(0)
+{
+  for (int i = 0; i < VERIFY_CACHE_SHARDS; i++) {
+    Shard &shard = m_shards[i];
+    pthread_mutex_init(&shard.lock, NULL);
+    shard.entries = NULL;
+    shard.nsets = shard.used = 0;
+    shard.tick = shard.hits = shard.misses = shard.evictions = 0;
+  }
+}
+
+VerifyCache::~VerifyCache()
+{
+  for (int i = 0; i < VERIFY_CACHE_SHARDS; i++) {
+    delete[] m_shards[i].entries;
+    pthread_mutex_destroy(&m_shards[i].lock);
+  }
+}
+
+void
+VerifyCache::configure(size_t budgetBytes)
+{
+  size_t setBytes = VERIFY_CACHE_WAYS * sizeof(Entry);
+  size_t nsets = budgetBytes / (VERIFY_CACHE_SHARDS * setBytes);
+  if (budgetBytes && !nsets)
+    nsets = 1;
+
+  // (nobody looks at m_enabled under a lock, so switch it off first and back
+  //  on last; lookups that race us just miss)
+  m_enabled = false;
+  for (int i = 0; i < VERIFY_CACHE_SHARDS; i++) {
+    Shard &shard = m_shards[i];
+    Entry *entries = NULL;
+    if (nsets) {
+      entries = new Entry[nsets * VERIFY_CACHE_WAYS];
+      memset(entries, 0, nsets * setBytes);
+    }
+
+    pthread_mutex_lock(&shard.lock);
+    delete[] shard.entries;
+    shard.entries = entries;
+    shard.nsets = nsets;
+    shard.used = 0;
+    pthread_mutex_unlock(&shard.lock);
+  }
+  m_budgetBytes = budgetBytes;
+  m_enabled = nsets != 0;
+}
+
+#define BLOCK_BYTES 128
+
+static const unsigned char SHA512_IV[crypto_hash_sha512_BYTES] = {
+  0x6a, 0x09, 0xe6, 0x67, 0xf3, 0xbc, 0xc9, 0x08,
+  0xbb, 0x67, 0xae, 0x85, 0x84, 0xca, 0xa7, 0x3b,
+  0x3c, 0x6e, 0xf3, 0x72, 0xfe, 0x94, 0xf8, 0x2b,
+  0xa5, 0x4f, 0xf5, 0x3a, 0x5f, 0x1d, 0x36, 0xf1,
+  0x51, 0x0e, 0x52, 0x7f, 0xad, 0xe6, 0x82, 0xd1,
+  0x9b, 0x05, 0x68, 0x8c, 0x2b, 0x3e, 0x6c, 0x1f,
+  0x1f, 0x83, 0xd9, 0xab, 0xfb, 0x41, 0xbd, 0x6b,
+  0x5b, 0xe0, 0xcd, 0x19, 0x13, 0x7e, 0x21, 0x79
+};
+
+/**
+ * SHA-512 over a few separate pieces of memory, so that digest() never has
+ *  to gather a (possibly large) signed message into one buffer first.  Whole
+ *  blocks are compressed straight out of the caller's memory; only the bits
+ *  that straddle pieces and the final padding go through `buf`.
+ */
+struct PieceHasher {
+  unsigned char state[crypto_hash_sha512_BYTES];
+  unsigned char buf[2 * BLOCK_BYTES];
+  size_t buffered;
+  unsigned long long total;
+
+  PieceHasher() : buffered(0), total(0)
+  {
+    memcpy(state, SHA512_IV, sizeof(state));
+  }
+
+  ~PieceHasher()
+  {
+    // (the pieces can include a secret auth key)
+    memset(state, 0, sizeof(state));
+    memset(buf, 0, sizeof(buf));
+  }
+
+  void update(const unsigned char *p, size_t len)
+  {
+    if (!len)
+      return;
+    total += len;
+    if (buffered) {
+      size_t take = BLOCK_BYTES - buffered < len ? BLOCK_BYTES - buffered : len;
+      memcpy(buf + buffered, p, take);
+      buffered += take;
+      p += take;
+      len -= take;
+      if (buffered < BLOCK_BYTES)
+        return;
+      crypto_hashblocks_sha512(state, buf, BLOCK_BYTES);
+      buffered = 0;
+    }
+    size_t whole = len - len % BLOCK_BYTES;
+    if (whole)
+      crypto_hashblocks_sha512(state, p, whole);
+    memcpy(buf, p + whole, len - whole);
+    buffered = len - whole;
+  }
+
+  /** The same padding crypto_hash_sha512 does. */
+  void final(unsigned char *out)
+  {
+    size_t padded = buffered + 17 <= BLOCK_BYTES ? BLOCK_BYTES
+                                                 : 2 * BLOCK_BYTES;
+    buf[buffered] = 0x80;
+    memset(buf + buffered + 1, 0, padded - buffered - 1);
+    buf[padded - 9] = static_cast<unsigned char>(total >> 61);
+    unsigned long long bits = total << 3;
+    for (int i = 1; i <= 8; i++, bits >>= 8)
+      buf[padded - i] = static_cast<unsigned char>(bits);
+    crypto_hashblocks_sha512(state, buf, padded);
+    memcpy(out, state, sizeof(state));
+  }
+};
+
+void
+VerifyCache::digest(unsigned char *out, Kind kind,
+                    const unsigned char *key, size_t keyLen,
+                    const unsigned char *a, size_t aLen,
+                    const unsigned char *b, size_t bLen)
+{
+  unsigned char tag = static_cast<unsigned char>(kind);
+  PieceHasher hasher;
+  hasher.update(&tag, 1);
+  hasher.update(key, keyLen);
+  hasher.update(a, aLen);
+  hasher.update(b, bLen);
+
+  unsigned char h[crypto_hash_sha512_BYTES];
+  hasher.final(h);
+  memcpy(out, h, VERIFY_CACHE_DIGESTBYTES);
+  memset(h, 0, sizeof(h));
+}
+
+/**
+ * The digest is already uniformly distributed, so its first byte picks the
+ *  shard and the next three the set within it.
+ */
+VerifyCache::Shard &
+VerifyCache::shardFor(const unsigned char *digest, size_t *set)
+{
+  *set = (static_cast<size_t>(digest[1]) << 16 |
+          static_cast<size_t>(digest[2]) << 8 | digest[3]);
+  return m_shards[digest[0] % VERIFY_CACHE_SHARDS];
+}
+
+bool
+VerifyCache::lookup(const unsigned char *digest)
+{
+  size_t index;
+  Shard &shard = shardFor(digest, &index);
+  bool hit = false;
+
+  pthread_mutex_lock(&shard.lock);
+  if (shard.nsets) {
+    Entry *set = shard.entries + (index % shard.nsets) * VERIFY_CACHE_WAYS;
+    for (int i = 0; i < VERIFY_CACHE_WAYS; i++) {
+      if (set[i].stamp &&
+          !memcmp(set[i].digest, digest, VERIFY_CACHE_DIGESTBYTES)) {
+        set[i].stamp = ++shard.tick;
+        hit = true;
+        break;
+      }
+    }
+    if (hit)
+      shard.hits++;
+    else
+      shard.misses++;
+  }
+  pthread_mutex_unlock(&shard.lock);
+  return hit;
+}
+
+void
+VerifyCache::insert(const unsigned char *digest)
+{
+  size_t index;
+  Shard &shard = shardFor(digest, &index);
+
+  pthread_mutex_lock(&shard.lock);
+  if (shard.nsets) {
+    Entry *set = shard.entries + (index % shard.nsets) * VERIFY_CACHE_WAYS;
+    Entry *victim = &set[0];
+    for (int i = 0; i < VERIFY_CACHE_WAYS; i++) {
+      if (set[i].stamp &&
+          !memcmp(set[i].digest, digest, VERIFY_CACHE_DIGESTBYTES)) {
+        // (two threads verified the same thing at once)
+        victim = NULL;
+        set[i].stamp = ++shard.tick;
+        break;
+      }
+      if (set[i].stamp < victim->stamp)
+        victim = &set[i];
+    }
+    if (victim) {
+      if (victim->stamp)
+        shard.evictions++;
+      else
+        shard.used++;
+      memcpy(victim->digest, digest, VERIFY_CACHE_DIGESTBYTES);
+      victim->stamp = ++shard.tick;
+    }
+  }
+  pthread_mutex_unlock(&shard.lock);
+}
+
+void
+VerifyCache::stats(Stats *out)
+{
+  memset(out, 0, sizeof(*out));
+  out->budgetBytes = m_budgetBytes;
+  for (int i = 0; i < VERIFY_CACHE_SHARDS; i++) {
+    Shard &shard = m_shards[i];
+    pthread_mutex_lock(&shard.lock);
+    out->capacity += shard.nsets * VERIFY_CACHE_WAYS;
+    out->entries += shard.used;
+    out->hits += shard.hits;
+    out->misses += shard.misses;
+    out->evictions += shard.evictions;
+    pthread_mutex_unlock(&shard.lock);
+  }
+}
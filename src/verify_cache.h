@@ -0,0 +1,131 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NACL_NODE_VERIFY_CACHE_H
+#define NACL_NODE_VERIFY_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define VERIFY_CACHE_DIGESTBYTES 32
+#define VERIFY_CACHE_SHARDS 16
+/** Entries per set; the least recently used one in a full set goes. */
+#define VERIFY_CACHE_WAYS 4
+
+/**
+ * Remembers inputs that have already verified, so that checking the same
+ *  signed message against the same public key (or the same authenticator
+ *  over the same message and key) a second time costs a SHA-512 and a table
+ *  lookup rather than another round of curve arithmetic.
+ *
+ * Entries are SHA-512 digests (truncated to 256 bits) of a tag for the kind
+ *  of check, the key and the inputs.  Only successful verifications ever get
+ *  inserted, so feeding us forgeries can evict entries but never make one
+ *  pass.
+ *
+ * The table is set-associative and split into VERIFY_CACHE_SHARDS shards,
+ *  each with its own lock, so it is fine to use from worker threads.  It is
+ *  disabled (and takes no memory) until configure() gets a non-zero budget.
+ */
+class VerifyCache {
+public:
+  enum Kind {
+    SIGN_OPEN = 'S',
+    AUTH_VERIFY = 'A'
+  };
+
+  VerifyCache();
+  ~VerifyCache();
+
+  /**
+   * Size the table to fit in about `budgetBytes`, dropping every entry.  A
+   *  budget of 0 turns the cache off and frees the table.
+   */
+  void configure(size_t budgetBytes);
+
+  /**
+   * Cheap check for whether it's worth computing a digest at all.  (It can
+   *  be stale while someone else is calling configure(); that's harmless.)
+   */
+  bool enabled() const { return m_enabled; }
+
+  /**
+   * digest = SHA-512(kind || key || a || b), truncated.
+   */
+  static void digest(unsigned char *out, Kind kind,
+                     const unsigned char *key, size_t keyLen,
+                     const unsigned char *a, size_t aLen,
+                     const unsigned char *b, size_t bLen);
+
+  /** Has this digest verified before?  Counts a hit or a miss. */
+  bool lookup(const unsigned char *digest);
+  /** Remember a digest that just verified. */
+  void insert(const unsigned char *digest);
+
+  struct Stats {
+    size_t budgetBytes, capacity, entries;
+    unsigned long long hits, misses, evictions;
+  };
+  void stats(Stats *out);
+
+private:
+  VerifyCache(const VerifyCache &);
+  VerifyCache &operator=(const VerifyCache &);
+
+  struct Entry {
+    unsigned char digest[VERIFY_CACHE_DIGESTBYTES];
+    /** When this entry was last used; 0 for an empty entry. */
+    unsigned long long stamp;
+  };
+
+  struct Shard {
+    pthread_mutex_t lock;
+    // everything below here is protected by lock
+    Entry *entries;
+    size_t nsets, used;
+    unsigned long long tick;
+    unsigned long long hits, misses, evictions;
+  };
+
+  Shard &shardFor(const unsigned char *digest, size_t *set);
+
+  Shard m_shards[VERIFY_CACHE_SHARDS];
+  volatile bool m_enabled;
+  size_t m_budgetBytes;
+};
+
+#endif // NACL_NODE_VERIFY_CACHE_H
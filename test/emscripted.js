@@ -430,3 +430,44 @@ exports.testHash = function(test) {
 
   test.done();
 };
+
+/**
+ * Buffers go through the same bulk heap copies as binary strings, so they
+ *  should be interchangeable anywhere a binary string is accepted.
+ */
+exports.testBufferArguments = function(test) {
+  var key = nacl.secretbox_random_key();
+  var nonce = nacl.secretbox_random_nonce();
+  var asBuf = function(s) { return new $buf.Buffer(s, 'binary'); };
+
+  var boxed = nacl.secretbox(BINNONREP, nonce, key);
+  test.equal(nacl.secretbox_open(asBuf(boxed), asBuf(nonce), asBuf(key)),
+             BINNONREP);
+  test.equal(nacl.secretbox_open(nacl.secretbox(asBuf(BINNONREP), nonce, key),
+                                 nonce, key),
+             BINNONREP);
+
+  var keys = nacl.sign_keypair();
+  var signed = nacl.sign(asBuf(ALPHA_STEW), asBuf(keys.sk));
+  test.equal(nacl.sign_open(asBuf(signed), keys.pk), ALPHA_STEW);
+  test.equal(nacl.sign_peek(asBuf(signed)), ALPHA_STEW);
+
+  test.equal(nacl.hash512_256(asBuf(NOT_VALID_UTF8)),
+             nacl.hash512_256(NOT_VALID_UTF8));
+  var hashes = nacl.hash512_256_batch([ALPHA_STEW, asBuf(BINNONREP)]);
+  test.equal(hashes.toString('binary'),
+             nacl.hash512_256(ALPHA_STEW) + nacl.hash512_256(BINNONREP));
+
+  // (in place, like the native binding, even though we have to copy)
+  var stream = nacl.stream_xsalsa20(ALPHA_STEW.length, nonce, key);
+  var buf = asBuf('[' + ALPHA_STEW + ']');
+  nacl.stream_xsalsa20_xor(buf, 1, ALPHA_STEW.length, nonce, key);
+  for (var i = 0; i < ALPHA_STEW.length; i++) {
+    test.equal(buf[i + 1],
+               ALPHA_STEW.charCodeAt(i) ^ stream.charCodeAt(i));
+  }
+  nacl.stream_xsalsa20_xor(buf, 1, ALPHA_STEW.length, nonce, key);
+  test.equal(buf.toString('binary'), '[' + ALPHA_STEW + ']');
+
+  test.done();
+};
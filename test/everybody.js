@@ -203,6 +203,21 @@ exports.testSigning = function(test) {
   test.done();
 };
 
+/**
+ * Signatures go through our fixed-base signer rather than nacl's; the scheme
+ *  is deterministic, so signing twice had better produce identical bytes, and
+ *  lots of fresh keys had better all verify.
+ */
+exports.testFixedBaseSigning = function(test) {
+  for (var i = 0; i < 32; i++) {
+    var keys = nacl.sign_keypair();
+    var signed_message = nacl.sign(BINNONREP, keys.sk);
+    test.equal(signed_message, nacl.sign(BINNONREP, keys.sk));
+    test.equal(nacl.sign_open(signed_message, keys.pk), BINNONREP);
+  }
+  test.done();
+};
+
 function checkBoxRoundTripOf(message, binaryMode, test) {
   var boxer, unboxer;
   if (binaryMode) {
@@ -404,6 +419,131 @@ exports.testAuthenticators = function(test) {
   test.done();
 };
 
+/**
+ * Turn on the keypair pools and make sure that what comes out of them (or out
+ *  of the synchronous fallback when they are empty) still works and that the
+ *  counters account for every call.
+ */
+exports.testKeypairPools = function(test) {
+  nacl.keypair_pool_configure('sign', 2, 8);
+  nacl.keypair_pool_configure('box', 2, 8);
+
+  var i, before = nacl.keypair_pool_stats();
+  test.equal(before.sign.highWater, 8);
+  test.equal(before.box.lowWater, 2);
+
+  for (i = 0; i < 16; i++) {
+    checkSignatureOf(BINNONREP, true, test);
+    checkBoxRoundTripOf(BINNONREP, true, test);
+  }
+
+  // checkSignatureOf generates 2 signing keypairs, checkBoxRoundTripOf 2 boxing
+  var after = nacl.keypair_pool_stats();
+  test.equal((after.sign.hits + after.sign.misses) -
+             (before.sign.hits + before.sign.misses), 32);
+  test.equal((after.box.hits + after.box.misses) -
+             (before.box.hits + before.box.misses), 32);
+
+  assert.throws(function() {
+    nacl.keypair_pool_configure('sign', 9, 8);
+  }, /low_water needs to be <= high_water/);
+  assert.throws(function() {
+    nacl.keypair_pool_configure('bogus', 2, 8);
+  }, /kind needs to be 'sign' or 'box'/);
+
+  // turn them back off so the pools don't count against the other tests
+  nacl.keypair_pool_configure('sign', 0, 0);
+  nacl.keypair_pool_configure('box', 0, 0);
+  var off = nacl.keypair_pool_stats();
+  test.equal(off.sign.available, 0);
+  test.equal(off.box.available, 0);
+
+  test.done();
+};
+
+/**
+ * Turn on the verification cache and make sure repeats of a good signature or
+ *  authenticator hit it, that forgeries still fail and never get remembered,
+ *  and that a budget of 0 turns it back off.
+ */
+exports.testVerifyCache = function(test) {
+  nacl.verify_cache_configure(1 << 16);
+
+  var signKeys = nacl.sign_keypair();
+  var signed = nacl.sign('cache me if you can', signKeys.sk);
+  var authKey = nacl.auth_random_key();
+  var authenticator = nacl.auth('cache me too', authKey);
+
+  var before = nacl.verify_cache_stats();
+  test.ok(before.capacity > 0);
+  test.equal(before.entries, 0);
+
+  var i;
+  for (i = 0; i < 3; i++) {
+    test.equal(nacl.sign_open(signed, signKeys.pk), 'cache me if you can');
+    nacl.auth_verify(authenticator, 'cache me too', authKey);
+  }
+
+  var after = nacl.verify_cache_stats();
+  test.equal(after.entries, 2);
+  test.equal(after.misses - before.misses, 2);
+  test.equal(after.hits - before.hits, 4);
+
+  assert.throws(function() {
+    nacl.sign_open(corruptString(signed), signKeys.pk);
+  }, nacl.BadSignatureError);
+  assert.throws(function() {
+    nacl.auth_verify(authenticator, 'cache me three', authKey);
+  }, nacl.BadAuthenticatorError);
+  // (and a cached message is no good under someone else's key)
+  assert.throws(function() {
+    nacl.sign_open(signed, nacl.sign_keypair().pk);
+  }, nacl.BadSignatureError);
+  test.equal(nacl.verify_cache_stats().entries, 2);
+
+  assert.throws(function() {
+    nacl.verify_cache_configure((1 << 30) + 1);
+  }, /too big a verification cache/);
+
+  nacl.verify_cache_configure(0);
+  var off = nacl.verify_cache_stats();
+  test.equal(off.capacity, 0);
+  test.equal(off.entries, 0);
+  test.equal(nacl.sign_open(signed, signKeys.pk), 'cache me if you can');
+
+  test.done();
+};
+
+/**
+ * Capture a few calls and make sure they (and only they) land in the trace
+ *  without any of the payload bytes.
+ */
+exports.testCapture = function(test) {
+  var $fs = require('fs');
+  var path = '/tmp/nacl-capture-test-' + process.pid + '.trace';
+  var secret = 'TOPSECRETTOPSECRETTOPSECRET';
+
+  nacl.capture_start(path);
+  var key = nacl.secretbox_random_key();
+  var nonce = nacl.secretbox_random_nonce();
+  var boxed = nacl.secretbox(secret, nonce, key);
+  nacl.secretbox_open(boxed, nonce, key);
+  assert.throws(function() {
+    nacl.secretbox_open(corruptString(boxed), nonce, key);
+  }, nacl.BadSecretBoxError);
+  test.equal(nacl.capture_stop(), 5);
+  // (not captured)
+  nacl.hash512_256(secret);
+
+  var trace = $fs.readFileSync(path);
+  $fs.unlinkSync(path);
+  test.equal(trace.toString('binary', 0, 8), 'NACLTRC1');
+  test.equal(trace.toString('binary').indexOf(secret), -1);
+  test.equal(trace.toString('binary').indexOf(key), -1);
+
+  test.done();
+};
+
 /**
  * Make sure we expose our constants and they are correct.  The constants
  *  are accordingly hard-coded here.
@@ -430,3 +570,415 @@ exports.testHash = function(test) {
 
   test.done();
 };
+
+exports.testHashBatch = function(test) {
+  var msgs = ['', 'Hello World!', ALPHA_STEW, ZEROES_64, BINNONREP,
+              NOT_VALID_UTF8, new $buf.Buffer(JSON_STEW, 'binary')];
+  // long enough to need more than one block, and more messages than lanes
+  var big = ALPHA_STEW;
+  while (big.length < 300)
+    big += big;
+  msgs.push(big);
+
+  function expected(msg) {
+    var hasher = $crypto.createHash('sha512');
+    hasher.update(Buffer.isBuffer(msg) ? msg.toString('binary') : msg,
+                  'binary');
+    return hasher.digest('binary').substring(0, 32);
+  }
+
+  var i, hashes = nacl.hash512_256_batch(msgs);
+  test.equal(hashes.length, msgs.length * 32);
+  for (i = 0; i < msgs.length; i++) {
+    test.equal(hashes.toString('binary', i * 32, (i + 1) * 32),
+               expected(msgs[i]));
+  }
+
+  // - the same messages packed into one buffer
+  var packed = '', offsets = [];
+  for (i = 0; i < msgs.length; i++) {
+    offsets.push(packed.length);
+    packed += Buffer.isBuffer(msgs[i]) ? msgs[i].toString('binary') : msgs[i];
+  }
+  var packedHashes = nacl.hash512_256_batch(new $buf.Buffer(packed, 'binary'),
+                                            offsets);
+  test.equal(packedHashes.toString('binary'), hashes.toString('binary'));
+
+  test.equal(nacl.hash512_256_batch([]).length, 0);
+  assert.throws(function() {
+    nacl.hash512_256_batch(new $buf.Buffer(4), [0, 8]);
+  }, /offsets need to be ascending/);
+
+  test.done();
+};
+
+exports.testStreamOnetimeauth = function(test) {
+  var key = nacl.secretbox_random_key();
+  var nonce = nacl.secretbox_random_nonce();
+  var msg = ALPHA_STEW + BINNONREP + ALPHA_STEW;
+
+  // - xor in place round-trips, and only touches the requested range
+  var buf = new $buf.Buffer('[' + msg + ']', 'binary');
+  nacl.stream_xsalsa20_xor(buf, 1, msg.length, nonce, key);
+  test.notEqual(buf.toString('binary', 1, msg.length + 1), msg);
+  test.equal(buf.toString('binary', 0, 1), '[');
+  test.equal(buf.toString('binary', msg.length + 1), ']');
+  nacl.stream_xsalsa20_xor(buf, 1, msg.length, nonce, key);
+  test.equal(buf.toString('binary'), '[' + msg + ']');
+
+  // - starting at a block counter picks up the stream at 64 * counter
+  var stream = nacl.stream_xsalsa20(256, nonce, key);
+  var zeroes = new $buf.Buffer(100);
+  zeroes.fill(0);
+  nacl.stream_xsalsa20_xor(zeroes, 0, 100, nonce, key, 2);
+  test.equal(zeroes.toString('binary'), stream.substring(128, 228));
+
+  // - secretbox is exactly onetimeauth over stream xor
+  var boxed = nacl.secretbox(msg, nonce, key);
+  var payload = new $buf.Buffer(msg, 'binary');
+  var otaKey = nacl.stream_xsalsa20(32, nonce, key);
+  var block = new $buf.Buffer(32 + msg.length);
+  block.fill(0);
+  payload.copy(block, 32);
+  nacl.stream_xsalsa20_xor(block, 0, block.length, nonce, key);
+  var tag = nacl.onetimeauth(block, 32, msg.length, otaKey);
+  test.equal(tag.length, nacl.onetimeauth_BYTES);
+  test.equal(tag + block.toString('binary', 32), boxed);
+
+  nacl.onetimeauth_verify(tag, block, 32, msg.length, otaKey);
+  assert.throws(function() {
+    nacl.onetimeauth_verify(tag, block, 33, msg.length - 1, otaKey);
+  }, nacl.BadAuthenticatorError);
+
+  assert.throws(function() {
+    nacl.stream_xsalsa20_xor(buf, 1, buf.length, nonce, key);
+  }, /range does not fit/);
+  assert.throws(function() {
+    nacl.stream_xsalsa20_xor(buf, 0, 1, nonce.substring(1), key);
+  }, /incorrect nonce length/);
+  test.equal(nacl.stream_xsalsa20(nacl.stream_xsalsa20_MAXBYTES, nonce,
+                                  key).length,
+             nacl.stream_xsalsa20_MAXBYTES);
+  assert.throws(function() {
+    nacl.stream_xsalsa20(0xffffffff, nonce, key);
+  }, /too long a keystream/);
+
+  test.done();
+};
+
+exports.testChannel = function(test) {
+  var alice = nacl.box_keypair(), bob = nacl.box_keypair();
+  var a = new nacl.Channel(alice.sk, bob.pk, {maxRecordBytes: 256,
+                                              rekeyRecords: 2});
+  var b = new nacl.Channel(bob.sk, alice.pk);
+
+  // - nothing gets sealed until the hellos have been swapped
+  assert.throws(function() { a.seal(ALPHA_STEW); }, /peer's hello/);
+  test.equal(a.hello().length, nacl.channel_HELLO_BYTES);
+  a.accept(b.hello());
+  b.accept(a.hello());
+
+  function openAll(channel, records) {
+    var got = [];
+    records.forEach(function(record) {
+      channel.open(record).forEach(function(m) {
+        got.push(m.toString('binary'));
+      });
+    });
+    return got;
+  }
+
+  // - small messages get coalesced into one record
+  a.push(ALPHA_STEW);
+  a.push(BINNONREP);
+  var records = a.seal(JSON_STEW);
+  test.equal(records.length, 1);
+  test.ok($buf.Buffer.isBuffer(records[0]));
+  test.equal(records[0].length, nacl.channel_RECORD_OVERHEAD + 3 * 4 +
+             ALPHA_STEW.length + BINNONREP.length + JSON_STEW.length);
+  test.deepEqual(openAll(b, records), [ALPHA_STEW, BINNONREP, JSON_STEW]);
+
+  // - a replayed or tampered record is rejected, and changes nothing
+  assert.throws(function() { b.open(records[0]); }, nacl.BadBoxError);
+  records = a.seal(BINNONREP);
+  var tampered = new $buf.Buffer(records[0].length);
+  records[0].copy(tampered);
+  tampered[tampered.length - 1] ^= 1;
+  assert.throws(function() { b.open(tampered); }, nacl.BadBoxError);
+  test.deepEqual(openAll(b, records), [BINNONREP]);
+
+  // - a big message gets split over records (and epochs) and put back together
+  var big = '';
+  while (big.length < 2000)
+    big += BINNONREP + ALPHA_STEW;
+  records = a.seal(big);
+  // (every record carries a 4-byte fragment header)
+  test.equal(records.length, Math.ceil(big.length / (256 - 4)));
+  test.ok(records.length > 2);
+  test.deepEqual(openAll(b, records), [big]);
+  test.ok(b.stats().recvEpoch > 0);
+  test.equal(b.stats().recvEpoch, a.stats().sendEpoch);
+
+  // - records can arrive out of order within the window
+  records = a.seal('first').concat(a.seal('second'));
+  test.deepEqual(openAll(b, records.reverse()), ['second', 'first']);
+
+  // - and each direction has its own key
+  records = b.seal(ALPHA_STEW);
+  assert.throws(function() { b.open(records[0]); }, nacl.BadBoxError);
+  test.deepEqual(openAll(a, records), [ALPHA_STEW]);
+
+  test.equal(a.seal().length, 0);
+  assert.throws(function() {
+    new nacl.Channel(alice.sk, alice.pk);
+  }, /two different keypairs/);
+  assert.throws(function() { a.accept(b.hello()); }, /already has its keys/);
+
+  // - the methods refuse to run on anything that isn't a Channel
+  assert.throws(function() {
+    nacl.Channel.prototype.seal.call({}, ALPHA_STEW);
+  }, TypeError);
+  assert.throws(function() {
+    nacl.Channel.prototype.stats.call(Object.create(nacl.Channel.prototype));
+  }, TypeError);
+
+  test.done();
+};
+
+/**
+ * A reconnect between the same two keypairs is a new session: its records
+ *  must never match (or open in) an earlier session's.
+ */
+exports.testChannelSessions = function(test) {
+  var alice = nacl.box_keypair(), bob = nacl.box_keypair();
+  function session() {
+    var a = new nacl.Channel(alice.sk, bob.pk),
+        b = new nacl.Channel(bob.sk, alice.pk);
+    a.accept(b.hello());
+    b.accept(a.hello());
+    return {a: a, b: b};
+  }
+
+  var first = session(), second = session();
+  var old = first.a.seal(ALPHA_STEW)[0], fresh = second.a.seal(ALPHA_STEW)[0];
+  test.notEqual(old.toString('binary'), fresh.toString('binary'));
+  assert.throws(function() { second.b.open(old); }, nacl.BadBoxError);
+  test.equal(second.b.open(fresh)[0].toString('binary'), ALPHA_STEW);
+
+  // - a record whose last fragment takes a message past maxMessageBytes is
+  //  refused whole: nothing comes out and it isn't counted as seen
+  var a = new nacl.Channel(alice.sk, bob.pk, {maxRecordBytes: 256}),
+      b = new nacl.Channel(bob.sk, alice.pk, {maxMessageBytes: 300});
+  a.accept(b.hello());
+  b.accept(a.hello());
+  var big = '';
+  while (big.length < 400)
+    big += ALPHA_STEW;
+  var records = a.seal(BINNONREP).concat(a.seal(big));
+  test.equal(b.open(records[0])[0].toString('binary'), BINNONREP);
+  records = records.slice(1);
+  var i;
+  for (i = 0; i < records.length - 1; i++)
+    test.deepEqual(b.open(records[i]), []);
+  assert.throws(function() {
+    b.open(records[i]);
+  }, /bigger than maxMessageBytes/);
+  assert.throws(function() {
+    b.open(records[i]);
+  }, /bigger than maxMessageBytes/);
+  test.equal(b.stats().replaysRejected, 0);
+  a.push(JSON_STEW);
+  test.deepEqual(b.open(a.seal()[0]).map(function(m) {
+    return m.toString('binary');
+  }), [JSON_STEW]);
+
+  test.done();
+};
+
+/**
+ * Fire off a bunch of async opens/hashes in one tick and make sure each
+ *  callback gets its own answer (or error), and that they went out in fewer
+ *  batches than there were calls.
+ */
+exports.testBatchedAsync = function(test) {
+  var defaults = nacl.batch_stats();
+  nacl.batch_configure({maxBatch: 8, smallBytes: 1024});
+  var before = nacl.batch_stats();
+
+  var signKeys = nacl.sign_keypair();
+  var alice = nacl.box_keypair(), bob = nacl.box_keypair();
+  var key = nacl.secretbox_random_key();
+  var nonce = nacl.box_random_nonce();
+  var big = new $buf.Buffer(4096);
+  big.fill(7);
+
+  var expected = 0, answered = 0;
+  function expect(wantErr, want) {
+    expected++;
+    return function(err, got) {
+      if (wantErr) {
+        test.ok(err instanceof wantErr);
+      }
+      else {
+        test.equal(err, null);
+        test.equal(got, want);
+      }
+      if (++answered === expected) {
+        var after = nacl.batch_stats();
+        test.equal(after.completed - before.completed, expected);
+        test.ok(after.batches - before.batches < expected);
+        // (sign_open/secretbox_open batches get spread over the pool)
+        test.ok(after.jobs - before.jobs > after.batches - before.batches);
+        // put things back so the other tests get the defaults
+        nacl.batch_configure({maxBatch: defaults.maxBatch,
+                              smallBytes: defaults.smallBytes});
+        test.done();
+      }
+    };
+  }
+
+  var i, m;
+  for (i = 0; i < 12; i++) {
+    m = ALPHA_STEW + i;
+    nacl.sign_open_async(nacl.sign(m, signKeys.sk), signKeys.pk,
+                         expect(null, m));
+    nacl.box_open_async(nacl.box(m, nonce, bob.pk, alice.sk), nonce,
+                        alice.pk, bob.sk, expect(null, m));
+    nacl.secretbox_open_async(nacl.secretbox(m, nonce, key), nonce, key,
+                              expect(null, m));
+    nacl.hash512_256_async(m, expect(null, nacl.hash512_256(m)));
+  }
+  // (a big one, in the other lane)
+  nacl.hash512_256_async(big, expect(null, nacl.hash512_256(big)));
+
+  // failures land in the callback as the usual errors
+  var signed = nacl.sign(BINNONREP, signKeys.sk);
+  nacl.sign_open_async(corruptString(signed), signKeys.pk,
+                       expect(nacl.BadSignatureError));
+  nacl.box_open_async(ZEROES_64, nonce, alice.pk, bob.sk,
+                      expect(nacl.BadBoxError));
+  nacl.secretbox_open_async(ZEROES_64, nonce, key,
+                            expect(nacl.BadSecretBoxError));
+
+  // but argument problems still throw right away
+  assert.throws(function() {
+    nacl.sign_open_async(signed, signKeys.pk);
+  }, /Need 3 args/);
+  assert.throws(function() {
+    nacl.secretbox_open_async(ZEROES_64, nonce, 'short', function() {});
+  }, nacl.BadSecretBoxError);
+  assert.throws(function() {
+    nacl.batch_configure({maxBatch: 0});
+  }, /maxBatch needs to be at least 1/);
+
+  // (nothing runs until the end of the tick, except for full batches)
+  test.ok(nacl.batch_stats().pending > 0);
+  test.ok(nacl.batch_stats().fullFlushes > before.fullFlushes);
+};
+
+/**
+ * A callback that throws gets reported as an uncaught exception, and the
+ *  rest of its batch still gets answered (on a later turn).
+ */
+exports.testBatchedAsyncThrow = function(test) {
+  var listeners = process.listeners('uncaughtException').slice();
+  process.removeAllListeners('uncaughtException');
+  var caught = [], answered = [];
+  process.on('uncaughtException', function(err) {
+    caught.push(err.message);
+  });
+
+  // (hashes share a batch, so all three land in one)
+  var i;
+  for (i = 0; i < 3; i++) {
+    nacl.hash512_256_async(ALPHA_STEW + i, (function(i) {
+      return function(err, got) {
+        test.equal(err, null);
+        test.equal(got, nacl.hash512_256(ALPHA_STEW + i));
+        answered.push(i);
+        if (i === 0)
+          throw new Error('callback 0 threw');
+        if (answered.length === 3) {
+          process.removeAllListeners('uncaughtException');
+          listeners.forEach(function(listener) {
+            process.on('uncaughtException', listener);
+          });
+          test.deepEqual(caught, ['callback 0 threw']);
+          test.deepEqual(answered, [0, 1, 2]);
+          test.done();
+        }
+      };
+    })(i));
+  }
+};
+
+/**
+ * The optional trailing encoding argument, for both the sync and the batched
+ *  async calls.
+ */
+exports.testEncodings = function(test) {
+  function hex(s) { return new $buf.Buffer(s, 'binary').toString('hex'); }
+  function b64(s) { return new $buf.Buffer(s, 'binary').toString('base64'); }
+
+  var signKeys = nacl.sign_keypair(),
+      hexKeys = {pk: hex(signKeys.pk), sk: hex(signKeys.sk)};
+  var signed = nacl.sign(BINNONREP, signKeys.sk);
+  test.equal(nacl.sign(hex(BINNONREP), hexKeys.sk, 'hex'), hex(signed));
+  test.equal(nacl.sign_open(b64(signed), b64(signKeys.pk), 'base64'),
+             b64(BINNONREP));
+  test.equal(nacl.sign_open(hex(signed), hexKeys.pk,
+                            {input: 'hex', output: 'binary'}),
+             BINNONREP);
+  test.equal(nacl.sign_peek(signed, {output: 'hex'}), hex(BINNONREP));
+
+  var alice = nacl.box_keypair('base64'), bob = nacl.box_keypair('base64'),
+      nonce = nacl.box_random_nonce('base64');
+  test.equal(new $buf.Buffer(alice.pk, 'base64').length,
+             nacl.box_PUBLICKEYBYTES);
+  var boxed = nacl.box(b64(ZEROES_64), nonce, bob.pk, alice.sk, 'base64');
+  test.equal(nacl.box_open(boxed, nonce, alice.pk, bob.sk,
+                           {input: 'base64'}),
+             ZEROES_64);
+
+  // base64url has no padding and its own two characters
+  var url = nacl.hash512_256(BINNONREP, {output: 'base64url'});
+  test.equal(url, b64(nacl.hash512_256(BINNONREP)).replace(/\+/g, '-')
+                    .replace(/\//g, '_').replace(/=+$/, ''));
+
+  // 'buffer' hands back a Buffer; results past the inline limit still work
+  var big = new $buf.Buffer(4096);
+  big.fill(0x5a);
+  var hash = nacl.hash512_256(big, 'buffer');
+  test.ok($buf.Buffer.isBuffer(hash));
+  test.equal(hash.length, 32);
+  test.equal(nacl.randombytes(200, 'hex').length, 400);
+  var key = nacl.secretbox_random_key('hex');
+  var sealed = nacl.secretbox(big, nacl.secretbox_random_nonce('hex'), key,
+                              {input: 'hex', output: 'base64'});
+  test.ok(sealed.length > 4096);
+
+  assert.throws(function() {
+    nacl.sign_open('zz' + hex(signed), hexKeys.pk, 'hex');
+  }, /needs to be a hex string or buffer/);
+  assert.throws(function() {
+    nacl.hash512_256('a', 'base64');
+  }, /needs to be a base64 string or buffer/);
+  assert.throws(function() {
+    nacl.hash512_256(BINNONREP, 'utf16');
+  }, /encoding needs to be/);
+  // (the keypair and random calls ignore anything but an encoding, as they
+  //  always ignored their arguments)
+  test.equal(nacl.box_keypair('hex', 'hex').pk.length,
+             2 * nacl.box_PUBLICKEYBYTES);
+  test.equal(nacl.box_keypair(7).pk.length, nacl.box_PUBLICKEYBYTES);
+  test.equal(nacl.secretbox_random_key(function() {}, 'hex').length, 32);
+  assert.throws(function() {
+    nacl.sign_keypair('utf16');
+  }, /encoding needs to be/);
+
+  nacl.sign_open_async(hex(signed), hexKeys.pk, 'hex', function(err, got) {
+    test.equal(err, null);
+    test.equal(got, hex(BINNONREP));
+    test.done();
+  });
+};
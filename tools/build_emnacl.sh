@@ -0,0 +1,209 @@
+#!/bin/sh
+#
+# Build the WebAssembly fallback for hosts that cannot compile the native
+#  addon.  We compile the reference implementations out of the nacl submodule
+#  with emcc, swap in our own Salsa20 (SIMD-128) and Poly1305 kernels, and
+#  link them with src/emnacl_exports.cc and emnacl.js (as the --post-js glue).
+#
+# Two flavours land in build/emnacl/: emnacled_simd.js, built with -msimd128,
+#  and emnacled.js without it.  The top-level emnacled.js picks one at load
+#  time depending on whether the engine supports SIMD.
+#
+# Both flavours then have to pass test/emscripted.js.
+#
+# Usage: tools/build_emnacl.sh   (needs emcc and nodeunit on the PATH)
+
+set -e
+cd "$(dirname "$0")/.."
+
+NACL=nacl
+OUT=build/emnacl
+CFLAGS="-O3"
+
+# What emnacl.js calls; keep in sync with src/emnacl_exports.cc.
+EXPORTS="_malloc,_free"
+for f in sign_keypair sign sign_open box_keypair box box_open \
+         secretbox secretbox_open auth auth_verify hash512_256 \
+         stream_xsalsa20_xor onetimeauth onetimeauth_verify; do
+  EXPORTS="$EXPORTS,_emnacl_$f"
+done
+EXPORTS="[$EXPORTS]"
+
+# Every primitive (op/primitive) the exported functions pull in.  We always
+#  use the portable "ref" implementation; the others are x86 assembly.
+PRIMITIVES="
+crypto_verify/16
+crypto_verify/32
+crypto_core/salsa20
+crypto_core/hsalsa20
+crypto_stream/salsa20
+crypto_stream/xsalsa20
+crypto_onetimeauth/poly1305
+crypto_secretbox/xsalsa20poly1305
+crypto_scalarmult/curve25519
+crypto_box/curve25519xsalsa20poly1305
+crypto_hashblocks/sha512
+crypto_hash/sha512
+crypto_auth/hmacsha512256
+crypto_sign/edwards25519sha512batch
+"
+# The primitive each generic crypto_<op>.h refers to, matching the addon.
+DEFAULTS="
+crypto_stream/xsalsa20
+crypto_onetimeauth/poly1305
+crypto_secretbox/xsalsa20poly1305
+crypto_box/curve25519xsalsa20poly1305
+crypto_hash/sha512
+crypto_auth/hmacsha512256
+crypto_sign/edwards25519sha512batch
+"
+
+if [ ! -f $NACL/MACROS ]; then
+  echo "The nacl submodule is missing; run: git submodule update --init" >&2
+  exit 1
+fi
+
+# Print the MACROS entries belonging to operation $1 (e.g. crypto_hash, but
+#  not crypto_hashblocks).
+op_macros() {
+  egrep "^$1(_|\$)" $NACL/MACROS
+}
+
+# Write the header for primitive $2 of operation $1 the way nacl's "do" does:
+#  the api.h constants and the prototypes, named after the ref
+#  implementation, plus the unqualified aliases.
+primitive_header() {
+  o=$1_$2
+  impl=${o}_ref
+  {
+    echo "#ifndef ${o}_H"
+    echo "#define ${o}_H"
+    echo
+    sed "s/[ 	]CRYPTO_/ ${impl}_/" < $NACL/$1/$2/ref/api.h
+    echo "#ifdef __cplusplus"
+    echo "extern \"C\" {"
+    echo "#endif"
+    egrep "[ *]$1[(_]" $NACL/PROTOTYPES.c | sed "s/\([ *]\)$1\([(_]\)/\1${impl}\2/"
+    echo "#ifdef __cplusplus"
+    echo "}"
+    echo "#endif"
+    echo
+    for macro in $(op_macros $1); do
+      suffix=${macro#$1}
+      echo "#define ${o}${suffix} ${impl}${suffix}"
+    done
+    echo "#define ${o}_IMPLEMENTATION \"$1/$2/ref\""
+    echo "#define ${o}_VERSION \"-\""
+    echo
+    echo "#endif"
+  } > $OUT/include/${o}.h
+}
+
+# Write the generic crypto_<op>.h for primitive $2 of operation $1 into $3.
+generic_header() {
+  o=$1_$2
+  {
+    echo "#ifndef $1_H"
+    echo "#define $1_H"
+    echo
+    echo "#include \"${o}.h\""
+    echo
+    for macro in $(op_macros $1); do
+      suffix=${macro#$1}
+      echo "#define ${macro} ${o}${suffix}"
+    done
+    echo "#define $1_PRIMITIVE \"$2\""
+    echo "#define $1_IMPLEMENTATION ${o}_IMPLEMENTATION"
+    echo "#define $1_VERSION ${o}_VERSION"
+    echo
+    echo "#endif"
+  } > $3/$1.h
+}
+
+rm -rf $OUT
+mkdir -p $OUT/include $OUT/default
+
+for bits in 32 64; do
+  for sign in int uint; do
+    case $sign in int) t="";; uint) t="unsigned ";; esac
+    case $bits in 32) t="${t}int";; 64) t="${t}long long";; esac
+    {
+      echo "#ifndef crypto_${sign}${bits}_h"
+      echo "#define crypto_${sign}${bits}_h"
+      echo "typedef $t crypto_${sign}${bits};"
+      echo "#endif"
+    } > $OUT/include/crypto_${sign}${bits}.h
+  done
+done
+{
+  echo "#ifndef randombytes_H"
+  echo "#define randombytes_H"
+  echo "#ifdef __cplusplus"
+  echo "extern \"C\" {"
+  echo "#endif"
+  echo "extern void randombytes(unsigned char *,unsigned long long);"
+  echo "#ifdef __cplusplus"
+  echo "}"
+  echo "#endif"
+  echo "#endif"
+} > $OUT/include/randombytes.h
+
+for p in $PRIMITIVES; do
+  primitive_header ${p%/*} ${p#*/}
+done
+for p in $DEFAULTS; do
+  generic_header ${p%/*} ${p#*/} $OUT/default
+done
+
+# build_flavour <name> <extra cflags> <use simd kernels: 0/1>
+build_flavour() {
+  objdir=$OUT/obj-$1
+  mkdir -p $objdir
+  objs=""
+  for p in $PRIMITIVES; do
+    op=${p%/*}
+    prim=${p#*/}
+    # each implementation sees its own primitive behind the generic name
+    mkdir -p $objdir/$op/$prim
+    generic_header $op $prim $objdir/$op/$prim
+
+    case "$p:$3" in
+      crypto_stream/salsa20:1) srcs=src/emnacl_salsa20_simd128.cc ;;
+      crypto_onetimeauth/poly1305:*) srcs=src/emnacl_poly1305.cc ;;
+      *) srcs=$(ls $NACL/$op/$prim/ref/*.c) ;;
+    esac
+    for src in $srcs; do
+      obj=$objdir/$op/$prim/$(basename $src).o
+      emcc $CFLAGS $2 -I$objdir/$op/$prim -I$OUT/include -I$NACL/$op/$prim/ref \
+        -c $src -o $obj
+      objs="$objs $obj"
+    done
+  done
+
+  emcc $CFLAGS $2 -I$OUT/default -I$OUT/include -Isrc \
+    $objs src/emnacl_exports.cc src/stream_xsalsa20_ic.cc \
+    -o $OUT/$1.js \
+    -s WASM=1 \
+    -s ENVIRONMENT=node \
+    -s WASM_ASYNC_COMPILATION=0 \
+    -s ALLOW_MEMORY_GROWTH=1 \
+    -s NODEJS_CATCH_EXIT=0 \
+    -s NODEJS_CATCH_REJECTION=0 \
+    -s EXPORTED_FUNCTIONS="$EXPORTS" \
+    --js-library tools/emnacl_library.js \
+    --post-js emnacl.js
+}
+
+build_flavour emnacled "" 0
+build_flavour emnacled_simd "-msimd128" 1
+
+echo "Built $OUT/emnacled.js and $OUT/emnacled_simd.js"
+
+# Neither flavour is any use until it passes the same tests; set -e makes a
+#  failure here fail the build.
+NODEUNIT=node_modules/.bin/nodeunit
+[ -x $NODEUNIT ] || NODEUNIT=nodeunit
+for flavour in plain simd; do
+  echo "Testing the $flavour flavour"
+  EMNACL_FLAVOUR=$flavour $NODEUNIT test/emscripted.js
+done
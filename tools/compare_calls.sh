@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# What a change to the binding layer has to go through before it lands: build
+#  the addon at a base revision and at the working tree, run the test suite
+#  against the new build, and time the two side by side with
+#  benchmark_calls.js.  The numbers also land in build/compare/calls.txt, for
+#  the commit message.
+#
+# Usage: tools/compare_calls.sh BASE-REVISION
+#  (needs node 0.6 with node-waf, and nodeunit and microtime on the PATH /
+#  NODE_PATH)
+
+set -e
+cd "$(dirname "$0")/.."
+
+if [ $# -ne 1 ]; then
+  echo "usage: $0 BASE-REVISION" >&2
+  exit 2
+fi
+BASE=$1
+TOP=$(pwd)
+OUT=build/compare
+
+# The working tree first; that also builds libnacl, which the base reuses.
+node-waf configure build
+nodeunit test/everybody.js
+
+rm -rf "$OUT"
+mkdir -p "$OUT/base"
+git archive "$BASE" | tar -x -C "$OUT/base"
+# (git archive leaves the submodule out)
+rmdir "$OUT/base/nacl" 2>/dev/null || rm -rf "$OUT/base/nacl"
+ln -s "$TOP/nacl" "$OUT/base/nacl"
+(cd "$OUT/base" && node-waf configure build)
+
+node benchmark_calls.js "$TOP/$OUT/base/build/Release/nacl.node" \
+                        "$TOP/build/Release/nacl.node" | tee "$OUT/calls.txt"
@@ -0,0 +1,9 @@
+// emscripten --js-library for the WebAssembly build; see build_emnacl.sh.
+//
+// nacl wants randombytes() to come from the OS; under node that means the
+//  crypto module, copied into the heap in one go.
+mergeInto(LibraryManager.library, {
+  emnacl_fill_random: function(ptr, len) {
+    HEAPU8.set(require('crypto').randomBytes(len), ptr);
+  },
+});
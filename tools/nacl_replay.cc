@@ -0,0 +1,667 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at:
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Original Code is NaCl node binding.
+ *
+ * The Initial Developer of the Original Code is
+ *   The Mozilla Foundation
+ * Portions created by the Initial Developer are Copyright (C) 2011
+ * the Initial Developer. All Rights Reserved.
+ *
+ * Contributor(s):
+ *   Andrew Sutherland <asutherland@asutherland.org>
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * either the GNU General Public License Version 2 or later (the "GPL"), or
+ * the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ * in which case the provisions of the GPL or the LGPL are applicable instead
+ * of those above. If you wish to allow use of your version of this file only
+ * under the terms of either the GPL or the LGPL, and not to allow others to
+ * use your version of this file under the terms of the MPL, indicate your
+ * decision by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL or the LGPL. If you do not delete
+ * the provisions above, a recipient may use your version of this file under
+ * the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+/**
+ * Replay driver for traces recorded with nacl.capture_start().
+ *
+ *   nacl_replay [--threads N] [--recorded-speed] trace_file
+ *
+ * Every recorded call is re-executed against the same native code paths the
+ *  addon uses, with synthetic keys/payloads of the recorded sizes.  Calls that
+ *  succeeded in the trace get inputs that will succeed again (real signatures,
+ *  real boxes, ...), calls that threw get same-sized garbage.  All inputs are
+ *  prepared up front so only the crypto itself gets timed; that does mean the
+ *  whole trace's payloads sit in memory.
+ *
+ * By default calls are issued back to back; --recorded-speed sleeps to match
+ *  the recorded inter-arrival times instead.  With --threads N the calls are
+ *  dealt round-robin to N threads.  We report throughput and per-function
+ *  latency percentiles; the _utf8 variants do the same native work as their
+ *  binary siblings (the JS string conversion is what differs), so they are
+ *  replayed as such but still reported separately.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "randombytes.h"
+#include "crypto_box.h"
+#include "crypto_sign.h"
+#include "crypto_secretbox.h"
+#include "crypto_auth.h"
+#include "crypto_hash.h"
+#include "crypto_stream_xsalsa20.h"
+#include "crypto_onetimeauth.h"
+
+#include "capture.h"
+#include "channel.h"
+#include "fixedbase25519.h"
+#include "sha512_multibuf.h"
+#include "stream_xsalsa20_ic.h"
+
+/** Same limit as the binding's nacl_randombytes. */
+#define MAX_RANDOM_BYTES 256
+
+static double
+now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::string
+synth(unsigned long long size)
+{
+  std::string s(size, '\0');
+  if (size)
+    randombytes(reinterpret_cast<unsigned char *>(&s[0]), size);
+  return s;
+}
+
+/** The real key if the recorded size matches it, otherwise garbage. */
+static std::string
+key_or_synth(const std::string &key, unsigned long long size)
+{
+  return size == key.size() ? key : synth(size);
+}
+
+static std::string
+sign_str(const std::string &m, const std::string &sk)
+{
+  std::string sm(m.size() + crypto_sign_BYTES, '\0');
+  unsigned long long smlen;
+  fixedbase_sign(reinterpret_cast<unsigned char *>(&sm[0]), &smlen,
+                 reinterpret_cast<const unsigned char *>(m.data()), m.size(),
+                 reinterpret_cast<const unsigned char *>(sk.data()));
+  return sm;
+}
+
+static const unsigned char *
+bytes(const std::string &s)
+{
+  return reinterpret_cast<const unsigned char *>(s.data());
+}
+
+static unsigned char *
+alloc_record(void *ctx, size_t len)
+{
+  std::vector<std::string> *records =
+    static_cast<std::vector<std::string> *>(ctx);
+  records->push_back(std::string(len, '\0'));
+  return reinterpret_cast<unsigned char *>(&records->back()[0]);
+}
+
+static void
+discard_message(void *ctx, const unsigned char *m, size_t len)
+{
+}
+
+/**
+ * Per-thread key material.  boxPk/boxSk and peerPk/peerSk are two different
+ *  parties so that boxes go somewhere.  Channel calls are replayed on
+ *  `channel` (us to the peer), and `peerChannel` seals the records we open.
+ */
+struct Keys {
+  std::string signPk, signSk;
+  std::string boxPk, boxSk, peerPk, peerSk;
+  std::string secretboxKey, authKey, onetimeauthKey;
+  SecureChannel channel, peerChannel;
+
+  Keys()
+  {
+    signPk = crypto_sign_keypair(&signSk);
+    boxPk = crypto_box_keypair(&boxSk);
+    peerPk = crypto_box_keypair(&peerSk);
+    secretboxKey = synth(crypto_secretbox_KEYBYTES);
+    authKey = synth(crypto_auth_KEYBYTES);
+    onetimeauthKey = synth(crypto_onetimeauth_KEYBYTES);
+
+    // (big records so any recorded record size can be reproduced)
+    SecureChannel::Options options;
+    options.maxRecordBytes = CHANNEL_MAX_RECORD_BYTES;
+    channel.init(bytes(boxSk), bytes(peerPk), options);
+    peerChannel.init(bytes(peerSk), bytes(boxPk), options);
+    channel.accept(peerChannel.hello(), CHANNEL_HELLO_BYTES);
+    peerChannel.accept(channel.hello(), CHANNEL_HELLO_BYTES);
+  }
+};
+
+struct Call {
+  CaptureRecord rec;
+  /** When to issue the call, relative to the start of the replay. */
+  double scheduled;
+  std::vector<std::string> in;
+  double latency;
+  bool ok;
+};
+
+static unsigned long long
+arg(const CaptureRecord &rec, int i)
+{
+  return i < rec.nargs ? rec.argSizes[i] : 0;
+}
+
+static void
+prepare(Call *call, Keys &keys)
+{
+  const CaptureRecord &rec = call->rec;
+  bool wantOk = !(rec.flags & CAPTURE_FLAG_THREW);
+  std::vector<std::string> &in = call->in;
+
+  switch (rec.op) {
+    case CAPTURE_OP_SIGN:
+    case CAPTURE_OP_SIGN_UTF8:
+      in.push_back(synth(arg(rec, 0)));
+      in.push_back(key_or_synth(keys.signSk, arg(rec, 1)));
+      break;
+
+    case CAPTURE_OP_SIGN_OPEN:
+    case CAPTURE_OP_SIGN_OPEN_UTF8:
+    case CAPTURE_OP_SIGN_OPEN_ASYNC:
+    case CAPTURE_OP_SIGN_PEEK:
+    case CAPTURE_OP_SIGN_PEEK_UTF8:
+      if (wantOk && arg(rec, 0) >= crypto_sign_BYTES)
+        in.push_back(sign_str(synth(arg(rec, 0) - crypto_sign_BYTES),
+                              keys.signSk));
+      else
+        in.push_back(synth(arg(rec, 0)));
+      in.push_back(key_or_synth(keys.signPk, arg(rec, 1)));
+      break;
+
+    case CAPTURE_OP_BOX:
+    case CAPTURE_OP_BOX_UTF8:
+      in.push_back(synth(arg(rec, 0)));
+      in.push_back(synth(arg(rec, 1)));
+      in.push_back(key_or_synth(keys.peerPk, arg(rec, 2)));
+      in.push_back(key_or_synth(keys.boxSk, arg(rec, 3)));
+      break;
+
+    case CAPTURE_OP_BOX_OPEN:
+    case CAPTURE_OP_BOX_OPEN_UTF8:
+    case CAPTURE_OP_BOX_OPEN_ASYNC: {
+      std::string n = synth(arg(rec, 1));
+      if (wantOk && arg(rec, 0) >= crypto_box_ZEROBYTES -
+                                   crypto_box_BOXZEROBYTES &&
+          n.size() == crypto_box_NONCEBYTES)
+        in.push_back(crypto_box(synth(arg(rec, 0) - crypto_box_ZEROBYTES +
+                                      crypto_box_BOXZEROBYTES),
+                                n, keys.peerPk, keys.boxSk));
+      else
+        in.push_back(synth(arg(rec, 0)));
+      in.push_back(n);
+      in.push_back(key_or_synth(keys.boxPk, arg(rec, 2)));
+      in.push_back(key_or_synth(keys.peerSk, arg(rec, 3)));
+      break;
+    }
+
+    case CAPTURE_OP_SECRETBOX:
+    case CAPTURE_OP_SECRETBOX_UTF8:
+      in.push_back(synth(arg(rec, 0)));
+      in.push_back(synth(arg(rec, 1)));
+      in.push_back(key_or_synth(keys.secretboxKey, arg(rec, 2)));
+      break;
+
+    case CAPTURE_OP_SECRETBOX_OPEN:
+    case CAPTURE_OP_SECRETBOX_OPEN_UTF8:
+    case CAPTURE_OP_SECRETBOX_OPEN_ASYNC: {
+      std::string n = synth(arg(rec, 1));
+      if (wantOk && arg(rec, 0) >= crypto_secretbox_ZEROBYTES -
+                                   crypto_secretbox_BOXZEROBYTES &&
+          n.size() == crypto_secretbox_NONCEBYTES)
+        in.push_back(crypto_secretbox(synth(arg(rec, 0) -
+                                            crypto_secretbox_ZEROBYTES +
+                                            crypto_secretbox_BOXZEROBYTES),
+                                      n, keys.secretboxKey));
+      else
+        in.push_back(synth(arg(rec, 0)));
+      in.push_back(n);
+      in.push_back(key_or_synth(keys.secretboxKey, arg(rec, 2)));
+      break;
+    }
+
+    case CAPTURE_OP_AUTH:
+    case CAPTURE_OP_AUTH_UTF8:
+      in.push_back(synth(arg(rec, 0)));
+      in.push_back(key_or_synth(keys.authKey, arg(rec, 1)));
+      break;
+
+    case CAPTURE_OP_AUTH_VERIFY:
+    case CAPTURE_OP_AUTH_VERIFY_UTF8: {
+      std::string m = synth(arg(rec, 1));
+      if (wantOk && arg(rec, 0) == crypto_auth_BYTES)
+        in.push_back(crypto_auth(m, keys.authKey));
+      else
+        in.push_back(synth(arg(rec, 0)));
+      in.push_back(m);
+      in.push_back(key_or_synth(keys.authKey, arg(rec, 2)));
+      break;
+    }
+
+    case CAPTURE_OP_HASH512_256:
+    case CAPTURE_OP_HASH512_256_UTF8:
+    case CAPTURE_OP_HASH512_256_ASYNC:
+    case CAPTURE_OP_HASH512_256_BATCH:
+      in.push_back(synth(arg(rec, 0)));
+      break;
+
+    case CAPTURE_OP_STREAM_XSALSA20:
+      in.push_back(synth(arg(rec, 1)));
+      in.push_back(key_or_synth(keys.secretboxKey, arg(rec, 2)));
+      break;
+
+    case CAPTURE_OP_STREAM_XSALSA20_XOR:
+      in.push_back(synth(arg(rec, 0)));
+      in.push_back(synth(arg(rec, 3)));
+      in.push_back(key_or_synth(keys.secretboxKey, arg(rec, 4)));
+      break;
+
+    case CAPTURE_OP_ONETIMEAUTH:
+      in.push_back(synth(arg(rec, 0)));
+      in.push_back(key_or_synth(keys.onetimeauthKey, arg(rec, 3)));
+      break;
+
+    case CAPTURE_OP_ONETIMEAUTH_VERIFY: {
+      std::string m = synth(arg(rec, 1));
+      if (wantOk && arg(rec, 0) == crypto_onetimeauth_BYTES)
+        in.push_back(crypto_onetimeauth(m, keys.onetimeauthKey));
+      else
+        in.push_back(synth(arg(rec, 0)));
+      in.push_back(m);
+      in.push_back(key_or_synth(keys.onetimeauthKey, arg(rec, 4)));
+      break;
+    }
+
+    case CAPTURE_OP_CHANNEL_NEW:
+      in.push_back(key_or_synth(keys.boxSk, arg(rec, 0)));
+      in.push_back(key_or_synth(keys.peerPk, arg(rec, 1)));
+      break;
+
+    case CAPTURE_OP_CHANNEL_PUSH:
+    case CAPTURE_OP_CHANNEL_SEAL:
+      in.push_back(synth(arg(rec, 0)));
+      break;
+
+    case CAPTURE_OP_CHANNEL_OPEN: {
+      // a single-message record comes out exactly the recorded size
+      unsigned long long overhead = CHANNEL_RECORD_OVERHEAD +
+                                    CHANNEL_FRAGMENT_HEADER_BYTES;
+      std::vector<std::string> records;
+      if (wantOk && arg(rec, 0) >= overhead &&
+          arg(rec, 0) - CHANNEL_RECORD_OVERHEAD <= CHANNEL_MAX_RECORD_BYTES) {
+        std::string m = synth(arg(rec, 0) - overhead);
+        keys.peerChannel.seal(alloc_record, &records, bytes(m), m.size());
+        in.push_back(records[0]);
+      }
+      else
+        in.push_back(synth(arg(rec, 0)));
+      break;
+    }
+
+    default:
+      // keypairs, random bytes and nonces need no inputs
+      break;
+  }
+}
+
+/**
+ * Do what the binding would have done.  Returns whether it would have
+ *  succeeded rather than thrown.
+ */
+static bool
+execute(Call &call, Keys &keys)
+{
+  const CaptureRecord &rec = call.rec;
+  std::vector<std::string> &in = call.in;
+  unsigned char pk[crypto_sign_PUBLICKEYBYTES];
+  unsigned char sk[crypto_sign_SECRETKEYBYTES];
+  unsigned char buf[MAX_RANDOM_BYTES];
+
+  try {
+    switch (rec.op) {
+      case CAPTURE_OP_RANDOMBYTES:
+        if (arg(rec, 0) >= MAX_RANDOM_BYTES)
+          return false;
+        randombytes(buf, arg(rec, 0));
+        return true;
+      case CAPTURE_OP_BOX_RANDOM_NONCE:
+        randombytes(buf, crypto_box_NONCEBYTES);
+        return true;
+      case CAPTURE_OP_SECRETBOX_RANDOM_NONCE:
+        randombytes(buf, crypto_secretbox_NONCEBYTES);
+        return true;
+      case CAPTURE_OP_SECRETBOX_RANDOM_KEY:
+        randombytes(buf, crypto_secretbox_KEYBYTES);
+        return true;
+      case CAPTURE_OP_AUTH_RANDOM_KEY:
+        randombytes(buf, crypto_auth_KEYBYTES);
+        return true;
+
+      case CAPTURE_OP_SIGN_KEYPAIR:
+        fixedbase_sign_keypair(pk, sk);
+        return true;
+      case CAPTURE_OP_BOX_KEYPAIR:
+        fixedbase_box_keypair(pk, sk);
+        return true;
+
+      case CAPTURE_OP_SIGN:
+      case CAPTURE_OP_SIGN_UTF8:
+        if (in[1].size() != crypto_sign_SECRETKEYBYTES)
+          return false;
+        sign_str(in[0], in[1]);
+        return true;
+      case CAPTURE_OP_SIGN_OPEN:
+      case CAPTURE_OP_SIGN_OPEN_UTF8:
+      case CAPTURE_OP_SIGN_OPEN_ASYNC:
+        if (in[0].size() < crypto_sign_BYTES)
+          return false;
+        crypto_sign_open(in[0], in[1]);
+        return true;
+      case CAPTURE_OP_SIGN_PEEK:
+      case CAPTURE_OP_SIGN_PEEK_UTF8:
+        if (in[0].size() < crypto_sign_BYTES)
+          return false;
+        in[0].substr(crypto_sign_BYTES / 2,
+                     in[0].size() - crypto_sign_BYTES);
+        return true;
+
+      case CAPTURE_OP_BOX:
+      case CAPTURE_OP_BOX_UTF8:
+        crypto_box(in[0], in[1], in[2], in[3]);
+        return true;
+      case CAPTURE_OP_BOX_OPEN:
+      case CAPTURE_OP_BOX_OPEN_UTF8:
+      case CAPTURE_OP_BOX_OPEN_ASYNC:
+        crypto_box_open(in[0], in[1], in[2], in[3]);
+        return true;
+
+      case CAPTURE_OP_SECRETBOX:
+      case CAPTURE_OP_SECRETBOX_UTF8:
+        crypto_secretbox(in[0], in[1], in[2]);
+        return true;
+      case CAPTURE_OP_SECRETBOX_OPEN:
+      case CAPTURE_OP_SECRETBOX_OPEN_UTF8:
+      case CAPTURE_OP_SECRETBOX_OPEN_ASYNC:
+        crypto_secretbox_open(in[0], in[1], in[2]);
+        return true;
+
+      case CAPTURE_OP_AUTH:
+      case CAPTURE_OP_AUTH_UTF8:
+        crypto_auth(in[0], in[1]);
+        return true;
+      case CAPTURE_OP_AUTH_VERIFY:
+      case CAPTURE_OP_AUTH_VERIFY_UTF8:
+        crypto_auth_verify(in[0], in[1], in[2]);
+        return true;
+
+      case CAPTURE_OP_HASH512_256:
+      case CAPTURE_OP_HASH512_256_UTF8:
+      case CAPTURE_OP_HASH512_256_ASYNC:
+        crypto_hash(in[0]);
+        return true;
+      case CAPTURE_OP_HASH512_256_BATCH: {
+        // split the recorded total evenly over the recorded message count
+        size_t count = arg(rec, 1);
+        if (!count)
+          return true;
+        std::vector<const unsigned char *> msgs(count);
+        std::vector<unsigned long long> lens(count);
+        std::vector<unsigned char> out(count * 32);
+        const unsigned char *data =
+          reinterpret_cast<const unsigned char *>(in[0].data());
+        size_t each = in[0].size() / count;
+        for (size_t i = 0; i < count; i++) {
+          msgs[i] = data + i * each;
+          lens[i] = i + 1 < count ? each : in[0].size() - i * each;
+        }
+        sha512_multibuf(&out[0], 32, &msgs[0], &lens[0], count);
+        return true;
+      }
+
+      case CAPTURE_OP_STREAM_XSALSA20:
+        crypto_stream_xsalsa20(arg(rec, 0), in[0], in[1]);
+        return true;
+      case CAPTURE_OP_STREAM_XSALSA20_XOR:
+        // in place over our own synthetic input, just like the binding
+        if (in[1].size() != crypto_stream_xsalsa20_NONCEBYTES ||
+            in[2].size() != crypto_stream_xsalsa20_KEYBYTES)
+          return false;
+        if (in[0].empty())
+          return true;
+        stream_xsalsa20_xor_ic(
+          reinterpret_cast<unsigned char *>(&in[0][0]),
+          reinterpret_cast<const unsigned char *>(in[0].data()),
+          in[0].size(),
+          reinterpret_cast<const unsigned char *>(in[1].data()),
+          arg(rec, 5),
+          reinterpret_cast<const unsigned char *>(in[2].data()));
+        return true;
+      case CAPTURE_OP_ONETIMEAUTH:
+        crypto_onetimeauth(in[0], in[1]);
+        return true;
+      case CAPTURE_OP_ONETIMEAUTH_VERIFY:
+        crypto_onetimeauth_verify(in[0], in[1], in[2]);
+        return true;
+
+      case CAPTURE_OP_CHANNEL_NEW: {
+        if (in[0].size() != crypto_box_SECRETKEYBYTES ||
+            in[1].size() != crypto_box_PUBLICKEYBYTES)
+          return false;
+        SecureChannel channel;
+        return !channel.init(bytes(in[0]), bytes(in[1]),
+                             SecureChannel::Options());
+      }
+      case CAPTURE_OP_CHANNEL_PUSH:
+        keys.channel.queue(bytes(in[0]), in[0].size());
+        return true;
+      case CAPTURE_OP_CHANNEL_SEAL: {
+        std::vector<std::string> records;
+        return !keys.channel.seal(alloc_record, &records,
+                                  in[0].empty() ? NULL : bytes(in[0]),
+                                  in[0].size());
+      }
+      case CAPTURE_OP_CHANNEL_OPEN:
+        return !keys.channel.open(bytes(in[0]), in[0].size(),
+                                  discard_message, NULL);
+    }
+  }
+  catch (const char *s) {
+    return false;
+  }
+  return false;
+}
+
+struct Worker {
+  pthread_t thread;
+  std::vector<Call> calls;
+  bool recordedSpeed;
+};
+
+static pthread_barrier_t startBarrier;
+static double replayStart;
+
+static void *
+worker_main(void *arg)
+{
+  Worker *w = static_cast<Worker *>(arg);
+
+  Keys keys;
+  for (size_t i = 0; i < w->calls.size(); i++)
+    prepare(&w->calls[i], keys);
+
+  // everyone waits for the slowest preparer, then one of us starts the clock
+  if (pthread_barrier_wait(&startBarrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+    replayStart = now_seconds();
+  pthread_barrier_wait(&startBarrier);
+
+  for (size_t i = 0; i < w->calls.size(); i++) {
+    Call &call = w->calls[i];
+    if (w->recordedSpeed) {
+      double wait = replayStart + call.scheduled - now_seconds();
+      if (wait > 0) {
+        struct timespec ts;
+        ts.tv_sec = (time_t) wait;
+        ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1e9);
+        while (nanosleep(&ts, &ts) && errno == EINTR)
+          ;
+      }
+    }
+    double before = now_seconds();
+    call.ok = execute(call, keys);
+    call.latency = now_seconds() - before;
+  }
+  return NULL;
+}
+
+static double
+percentile(const std::vector<double> &sorted, double p)
+{
+  size_t i = (size_t) (p * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+static int
+usage()
+{
+  fprintf(stderr,
+          "usage: nacl_replay [--threads N] [--recorded-speed] trace_file\n");
+  return 2;
+}
+
+int
+main(int argc, char **argv)
+{
+  int nthreads = 1;
+  bool recordedSpeed = false;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+      nthreads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--recorded-speed"))
+      recordedSpeed = true;
+    else if (!path && argv[i][0] != '-')
+      path = argv[i];
+    else
+      return usage();
+  }
+  if (!path || nthreads < 1)
+    return usage();
+
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return 1;
+  }
+  if (!capture_read_header(f)) {
+    fprintf(stderr, "%s: not a nacl trace\n", path);
+    return 1;
+  }
+
+  // the tables get built on first use; don't let that land in anyone's timing
+  fixedbase_available();
+
+  std::vector<Worker> workers(nthreads);
+  CaptureRecord rec;
+  double scheduled = 0;
+  size_t total = 0;
+  while (capture_read_record(f, &rec)) {
+    Call call;
+    call.rec = rec;
+    scheduled += rec.deltaMicros / 1e6;
+    call.scheduled = scheduled;
+    call.latency = 0;
+    call.ok = false;
+    workers[total++ % nthreads].calls.push_back(call);
+  }
+  if (!feof(f))
+    fprintf(stderr, "%s: trace is truncated or corrupt after %lu calls\n",
+            path, (unsigned long) total);
+  fclose(f);
+
+  pthread_barrier_init(&startBarrier, NULL, nthreads);
+  for (int t = 0; t < nthreads; t++) {
+    workers[t].recordedSpeed = recordedSpeed;
+    pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+  }
+  for (int t = 0; t < nthreads; t++)
+    pthread_join(workers[t].thread, NULL);
+  double elapsed = now_seconds() - replayStart;
+  pthread_barrier_destroy(&startBarrier);
+
+  std::vector<std::vector<double> > latencies(CAPTURE_OP_COUNT);
+  std::vector<double> all;
+  unsigned long mismatched = 0;
+  for (int t = 0; t < nthreads; t++) {
+    for (size_t i = 0; i < workers[t].calls.size(); i++) {
+      const Call &call = workers[t].calls[i];
+      latencies[call.rec.op].push_back(call.latency * 1e6);
+      all.push_back(call.latency * 1e6);
+      if (call.ok != !(call.rec.flags & CAPTURE_FLAG_THREW))
+        mismatched++;
+    }
+  }
+
+  printf("replayed %lu calls on %d thread(s) in %.3f s: %.1f calls/s",
+         (unsigned long) total, nthreads, elapsed,
+         elapsed > 0 ? total / elapsed : 0.0);
+  printf(" (%lu with a different outcome than recorded)\n\n", mismatched);
+  if (!total)
+    return 0;
+
+  printf("%-24s %10s %10s %10s %10s %10s\n",
+         "function", "calls", "p50 us", "p90 us", "p99 us", "max us");
+  for (int op = 0; op <= CAPTURE_OP_COUNT; op++) {
+    std::vector<double> &l = op < CAPTURE_OP_COUNT ? latencies[op] : all;
+    if (l.empty())
+      continue;
+    std::sort(l.begin(), l.end());
+    printf("%-24s %10lu %10.1f %10.1f %10.1f %10.1f\n",
+           op < CAPTURE_OP_COUNT ? CaptureOpNames[op] : "(all)",
+           (unsigned long) l.size(), percentile(l, 0.5), percentile(l, 0.9),
+           percentile(l, 0.99), l.back());
+  }
+  return 0;
+}